@@ -0,0 +1,77 @@
+#ifndef _BENCH_UTIL_H_
+#define _BENCH_UTIL_H_
+
+/* Utilities shared by the benchmarks in this directory: a deterministic
+ * random number generator, a clock, and the size distributions of the
+ * workloads.
+ */
+#include <math.h>
+#include <stdint.h>
+#include <time.h>
+
+#define PAGE_SZ     4096
+
+static uint64_t rand_state;
+
+static inline void
+rand_seed(uint64_t seed) {
+    rand_state = seed * 0x9E3779B97F4A7C15ull + 1;
+}
+
+/* xorshift64* */
+static inline uint64_t
+rand_next(void) {
+    rand_state ^= rand_state >> 12;
+    rand_state ^= rand_state << 25;
+    rand_state ^= rand_state >> 27;
+    return rand_state * 2685821657736338717ull;
+}
+
+/* Uniformly distributed in [0, 1) */
+static inline double
+rand_unit(void) {
+    return (rand_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static inline uint64_t
+now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/****************************************************************************
+ *
+ *              Size distributions
+ *
+ ****************************************************************************
+ */
+typedef size_t (*size_dist_t)(void);
+
+static inline size_t
+fixed_size(void) {
+    return 64 * 1024;
+}
+
+/* Pareto-distributed sizes between one page and 64MB, alpha = 1.2 */
+static inline size_t
+power_law_size(void) {
+    const double min_sz = PAGE_SZ, max_sz = 64.0 * 1024 * 1024;
+    double sz = min_sz / pow(1.0 - rand_unit(), 1 / 1.2);
+    return sz > max_sz ? (size_t)max_sz : (size_t)sz;
+}
+
+/* LuaJIT's allocator mostly maps 128k segments, and maps bigger objects
+ * directly.
+ */
+static inline size_t
+luajit_size(void) {
+    double r = rand_unit();
+    if (r < 0.70)
+        return 128 * 1024;
+    if (r < 0.95)
+        return (16 + (rand_next() % 240)) * PAGE_SZ - (rand_next() % 256);
+    return (256 + (rand_next() % 3840)) * PAGE_SZ;
+}
+
+#endif /* _BENCH_UTIL_H_ */
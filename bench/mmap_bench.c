@@ -0,0 +1,266 @@
+/* Microbenchmarks of the public mmap API, i.e. lm_mmap(), lm_munmap() and
+ * lm_mremap(), as well as lm_init2()/lm_fini().
+ *
+ *   Every benchmark runs on a freshly initialized libljmm, once with the
+ * block-cache disabled and once with it enabled. The random numbers are
+ * generated with fixed seeds, so two runs perform exactly the same sequence
+ * of operations, and their results can be compared run-to-run, say before
+ * and after a change to page_alloc.c or rbtree.c.
+ *
+ *   The results are written to stdout in JSON:
+ *    { "benchmarks": [ { "name": ..., "block_cache": 0|1, "ops": ...,
+ *                        "ns_per_op": ..., "mops_per_sec": ... }, ...] }
+ *
+ * Usage: mmap_bench [-n scale] [-f name-filter]
+ *   -n: scale the number of operations of each benchmark, default 1.
+ *   -f: only run the benchmarks whose name contains the given string.
+ *
+ *   If built with "make PROFILE=1" (along with the lib), the latency
+ * histograms of each benchmark are dumped to stderr.
+ */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+#include <sys/mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "lj_mm.h"
+#include "bench_util.h"
+
+#define LIVE_SLOTS  512
+
+static int scale = 1;
+static int blk_cache = 0;
+static int first_result = 1;
+
+/****************************************************************************
+ *
+ *              Utilities
+ *
+ ****************************************************************************
+ */
+static int
+bench_init(void) {
+    ljmm_opt_t opt;
+    lm_init_mm_opt(&opt);
+    opt.mode = LM_USER_MODE;
+    opt.enable_block_cache = blk_cache;
+    if (!lm_init2(&opt)) {
+        fprintf(stderr, "fail to call lm_init2()\n");
+        exit(1);
+    }
+#ifdef LJMM_PROFILE
+    lm_reset_profile();
+#endif
+    return 1;
+}
+
+static inline void*
+bench_mmap(size_t len) {
+    void* p = lm_mmap(NULL, len, PROT_READ|PROT_WRITE,
+                      MAP_32BIT|MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "fail to mmap %lu bytes\n", (unsigned long)len);
+        exit(1);
+    }
+    return p;
+}
+
+static inline void
+bench_munmap(void* p, size_t len) {
+    if (lm_munmap(p, len) != 0) {
+        fprintf(stderr, "fail to munmap %p, %lu bytes\n", p,
+                (unsigned long)len);
+        exit(1);
+    }
+}
+
+static void
+report(const char* name, long ops, uint64_t elapse_ns) {
+    double ns_per_op = ops ? (double)elapse_ns / ops : 0;
+    fprintf(stdout, "%s    { \"name\": \"%s\", \"block_cache\": %d, "
+            "\"ops\": %ld, \"ns_per_op\": %.1f, \"mops_per_sec\": %.3f }",
+            first_result ? "" : ",\n", name, blk_cache, ops, ns_per_op,
+            ns_per_op ? 1000.0 / ns_per_op : 0);
+    first_result = 0;
+
+#ifdef LJMM_PROFILE
+    fprintf(stderr, "\n%s, block_cache=%d:\n", name, blk_cache);
+    lm_dump_profile(stderr);
+#endif
+}
+
+/****************************************************************************
+ *
+ *              Benchmarks
+ *
+ ****************************************************************************
+ */
+
+/* Keep LIVE_SLOTS mappings alive; each operation replaces a random one. */
+static void
+bench_churn(const char* name, size_dist_t dist) {
+    bench_init();
+    rand_seed(28);
+
+    void* addr[LIVE_SLOTS];
+    size_t len[LIVE_SLOTS];
+    int i;
+    for (i = 0; i < LIVE_SLOTS; i++) {
+        len[i] = dist();
+        addr[i] = bench_mmap(len[i]);
+    }
+
+    long ops = 20000L * scale;
+    uint64_t t0 = now_ns();
+    long n;
+    for (n = 0; n < ops; n++) {
+        int slot = rand_next() % LIVE_SLOTS;
+        bench_munmap(addr[slot], len[slot]);
+        len[slot] = dist();
+        addr[slot] = bench_mmap(len[slot]);
+    }
+    uint64_t elapse = now_ns() - t0;
+
+    for (i = 0; i < LIVE_SLOTS; i++)
+        bench_munmap(addr[i], len[i]);
+    lm_fini();
+
+    /* Each iteration performs one mmap and one munmap */
+    report(name, ops * 2, elapse);
+}
+
+/* Grow a mapping from one page to 64MB with mremap, or shrink a 64MB mapping
+ * to a single page. Shrinking halves the mapping each time: lm_mremap()
+ * cannot shrink a block unless doing so frees at least one buddy.
+ */
+static void
+bench_mremap_chain(const char* name, int grow) {
+    bench_init();
+
+    /* A neighbour allocated after the mapping forces some of the growth
+     * to move the mapping rather than to extend it in place.
+     */
+    long ops = 0;
+    uint64_t elapse = 0;
+    int round;
+    for (round = 0; round < 20 * scale; round++) {
+        size_t sz = grow ? PAGE_SZ : 64 * 1024 * 1024;
+        char* p = bench_mmap(sz);
+        void* neighbour = bench_mmap(PAGE_SZ);
+
+        uint64_t t0 = now_ns();
+        while (grow ? sz < 64 * 1024 * 1024 : sz > PAGE_SZ) {
+            size_t new_sz = grow ? sz + sz / 2 + PAGE_SZ : sz / 2;
+            p = lm_mremap(p, sz, new_sz, MREMAP_MAYMOVE);
+            if (p == MAP_FAILED) {
+                fprintf(stderr, "fail to mremap %lu -> %lu bytes\n",
+                        (unsigned long)sz, (unsigned long)new_sz);
+                exit(1);
+            }
+            sz = new_sz;
+            ops++;
+        }
+        elapse += now_ns() - t0;
+
+        bench_munmap(p, sz);
+        bench_munmap(neighbour, PAGE_SZ);
+    }
+    lm_fini();
+
+    report(name, ops, elapse);
+}
+
+/* Map 2^k pages, then repeatedly unmap its leading or trailing half down to
+ * a single page. As with mremap, the halves are what lm_munmap() is able to
+ * return to the free lists.
+ */
+static void
+bench_partial_unmap(const char* name, int leading) {
+    bench_init();
+    rand_seed(28);
+
+    long ops = 0;
+    uint64_t elapse = 0;
+    int round;
+    for (round = 0; round < 4000 * scale; round++) {
+        size_t sz = ((size_t)4 << (rand_next() % 8)) * PAGE_SZ;
+        char* p = bench_mmap(sz);
+
+        uint64_t t0 = now_ns();
+        while (sz > PAGE_SZ) {
+            size_t half = sz / 2;
+            if (leading) {
+                bench_munmap(p, half);
+                p += half;
+            } else {
+                bench_munmap(p + half, half);
+            }
+            sz -= half;
+            ops++;
+        }
+        elapse += now_ns() - t0;
+
+        bench_munmap(p, sz);
+    }
+    lm_fini();
+
+    report(name, ops, elapse);
+}
+
+static void
+bench_init_fini(const char* name) {
+    long ops = 200L * scale;
+    uint64_t t0 = now_ns();
+    long n;
+    for (n = 0; n < ops; n++) {
+        bench_init();
+        lm_fini();
+    }
+    report(name, ops, now_ns() - t0);
+}
+
+static void
+run_all(const char* filter) {
+#define RUN(name, call) \
+    if (!filter || strstr(name, filter)) { call; fflush(stdout); }
+
+    RUN("churn_fixed", bench_churn("churn_fixed", fixed_size));
+    RUN("churn_power_law", bench_churn("churn_power_law", power_law_size));
+    RUN("churn_luajit", bench_churn("churn_luajit", luajit_size));
+    RUN("mremap_grow", bench_mremap_chain("mremap_grow", 1));
+    RUN("mremap_shrink", bench_mremap_chain("mremap_shrink", 0));
+    RUN("unmap_leading", bench_partial_unmap("unmap_leading", 1));
+    RUN("unmap_trailing", bench_partial_unmap("unmap_trailing", 0));
+    RUN("init_fini", bench_init_fini("init_fini"));
+
+#undef RUN
+}
+
+int
+main(int argc, char** argv) {
+    const char* filter = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:f:")) != -1) {
+        switch (opt) {
+        case 'n': scale = atoi(optarg); break;
+        case 'f': filter = optarg; break;
+        default:
+            fprintf(stderr, "Usage: %s [-n scale] [-f name-filter]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    if (scale <= 0)
+        scale = 1;
+
+    fprintf(stdout, "{ \"benchmarks\": [\n");
+    for (blk_cache = 0; blk_cache <= 1; blk_cache++)
+        run_all(filter);
+    fprintf(stdout, "\n] }\n");
+
+    return 0;
+}
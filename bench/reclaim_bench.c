@@ -0,0 +1,305 @@
+/* Memory-footprint and page-fault benchmark of the reclaim policies.
+ *
+ *   When a block is freed, the block-cache (block_cache.c) keeps its pages
+ * resident for a while in the hope that they are soon reused, and zaps them
+ * with madvise(MADV_DONTNEED) once they are evicted. Keeping more pages
+ * resident means fewer zero-fill page faults but a bigger footprint. This
+ * benchmark measures both sides of the trade-off.
+ *
+ *   For each configuration, a child process runs a churn workload for a
+ * fixed time: it keeps LIVE_SLOTS mappings alive, repeatedly replaces a
+ * random one, and writes to every page of the new mapping. The RSS (from
+ * /proc/self/statm) and the minor page faults (from getrusage()) are sampled
+ * periodically. The RSS is reported relative to the one measured right
+ * after lm_init2().
+ *
+ *   The configurations are: no block-cache, and the LRU block-cache with
+ * various blk_cache_in_page. Note that without the block-cache, the pages
+ * of free blocks are never given back to the OS.
+ *
+ * Usage: reclaim_bench [-t seconds] [-i interval-ms] [-d distribution]
+ *                      [-c cache-pages[,cache-pages...]]
+ *   -t: how long each configuration runs, default 2 seconds.
+ *   -i: sample interval, default 100ms.
+ *   -d: size distribution, one of fixed, power-law and luajit (default).
+ *   -c: blk_cache_in_page of the LRU configurations, default 64,512,4096.
+ */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "lj_mm.h"
+#include "bench_util.h"
+
+#define LIVE_SLOTS  256
+#define MAX_CONFIG  16
+
+typedef struct {
+    char name[32];
+    int enable_block_cache;
+    int blk_cache_in_page;
+} config_t;
+
+/* Filled by the children, and reported by the parent. */
+typedef struct {
+    int succ;
+    long sample_num;
+    double alloc_mb;        /* total size of the mappings created */
+    long minor_faults;
+    double avg_rss_mb;
+    double peak_rss_mb;
+} result_t;
+
+static config_t configs[MAX_CONFIG];
+static int config_num;
+static double run_sec = 2;
+static int interval_ms = 100;
+static size_dist_t dist = luajit_size;
+
+/****************************************************************************
+ *
+ *              Sampling
+ *
+ ****************************************************************************
+ */
+static long
+rss_in_kb(void) {
+    /* Use read() rather than stdio to keep malloc out of the picture */
+    char buf[128];
+    int fd = open("/proc/self/statm", O_RDONLY);
+    if (fd < 0)
+        return 0;
+
+    int len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0)
+        return 0;
+    buf[len] = '\0';
+
+    long size, resident;
+    if (sscanf(buf, "%ld %ld", &size, &resident) != 2)
+        return 0;
+
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static long
+minor_faults(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_minflt;
+}
+
+/****************************************************************************
+ *
+ *              Workload
+ *
+ ****************************************************************************
+ */
+static void*
+map_and_touch(size_t len) {
+    char* p = lm_mmap(NULL, len, PROT_READ|PROT_WRITE,
+                      MAP_32BIT|MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+
+    size_t ofst;
+    for (ofst = 0; ofst < len; ofst += PAGE_SZ)
+        p[ofst] = 1;
+
+    return p;
+}
+
+static void
+run_config(const config_t* cfg, result_t* res) {
+    ljmm_opt_t opt;
+    lm_init_mm_opt(&opt);
+    opt.mode = LM_USER_MODE;
+    opt.enable_block_cache = cfg->enable_block_cache;
+    opt.blk_cache_in_page = cfg->blk_cache_in_page;
+    if (!lm_init2(&opt)) {
+        fprintf(stderr, "%s: fail to call lm_init2()\n", cfg->name);
+        return;
+    }
+
+    rand_seed(29);
+
+    void* addr[LIVE_SLOTS];
+    size_t len[LIVE_SLOTS];
+    int i;
+    for (i = 0; i < LIVE_SLOTS; i++)
+        addr[i] = NULL, len[i] = 0;
+
+    long base_rss = rss_in_kb();
+    long base_faults = minor_faults();
+    double total_rss = 0;
+    long peak_rss = 0;
+    double alloc_bytes = 0;
+
+    uint64_t start = now_ns();
+    uint64_t end = start + (uint64_t)(run_sec * 1e9);
+    uint64_t interval = (uint64_t)interval_ms * 1000000;
+    uint64_t next_sample = start + interval;
+
+    for (;;) {
+        int slot = rand_next() % LIVE_SLOTS;
+        if (addr[slot] && lm_munmap(addr[slot], len[slot]) != 0) {
+            fprintf(stderr, "%s: fail to munmap\n", cfg->name);
+            return;
+        }
+
+        len[slot] = dist();
+        if (!(addr[slot] = map_and_touch(len[slot]))) {
+            fprintf(stderr, "%s: fail to mmap %lu bytes\n", cfg->name,
+                    (unsigned long)len[slot]);
+            return;
+        }
+        alloc_bytes += len[slot];
+
+        uint64_t now = now_ns();
+        if (now < next_sample)
+            continue;
+
+        long rss = rss_in_kb() - base_rss;
+        long faults = minor_faults() - base_faults;
+        fprintf(stdout, "%-12s %8.0f %10ld %10ld %10.1f\n", cfg->name,
+                (now - start) / 1e6, rss, faults, alloc_bytes / (1 << 20));
+
+        total_rss += rss;
+        if (rss > peak_rss)
+            peak_rss = rss;
+        res->sample_num++;
+
+        if (now >= end)
+            break;
+        next_sample += interval;
+    }
+
+    res->minor_faults = minor_faults() - base_faults;
+    res->alloc_mb = alloc_bytes / (1 << 20);
+    res->avg_rss_mb = total_rss / res->sample_num / 1024;
+    res->peak_rss_mb = peak_rss / 1024.0;
+    res->succ = 1;
+
+    for (i = 0; i < LIVE_SLOTS; i++)
+        lm_munmap(addr[i], len[i]);
+    lm_fini();
+}
+
+/****************************************************************************
+ *
+ *              main
+ *
+ ****************************************************************************
+ */
+static void
+add_config(const char* name, int enable_bc, int cache_pages) {
+    if (config_num == MAX_CONFIG)
+        return;
+
+    config_t* cfg = configs + config_num++;
+    snprintf(cfg->name, sizeof(cfg->name), "%s", name);
+    cfg->enable_block_cache = enable_bc;
+    cfg->blk_cache_in_page = cache_pages;
+}
+
+static void
+add_lru_configs(const char* list) {
+    char* dup = strdup(list);
+    char* tok;
+    for (tok = strtok(dup, ","); tok; tok = strtok(NULL, ",")) {
+        char name[32];
+        snprintf(name, sizeof(name), "lru-%d", atoi(tok));
+        add_config(name, 1, atoi(tok));
+    }
+    free(dup);
+}
+
+int
+main(int argc, char** argv) {
+    const char* lru_list = "64,512,4096";
+    int opt;
+    while ((opt = getopt(argc, argv, "t:i:d:c:")) != -1) {
+        switch (opt) {
+        case 't': run_sec = atof(optarg); break;
+        case 'i': interval_ms = atoi(optarg); break;
+        case 'c': lru_list = optarg; break;
+        case 'd':
+            if (!strcmp(optarg, "fixed"))
+                dist = fixed_size;
+            else if (!strcmp(optarg, "power-law"))
+                dist = power_law_size;
+            else if (!strcmp(optarg, "luajit"))
+                dist = luajit_size;
+            else
+                goto usage;
+            break;
+        default:
+            goto usage;
+        }
+    }
+
+    if (run_sec <= 0 || interval_ms <= 0)
+        goto usage;
+
+    add_config("none", 0, 0);
+    add_lru_configs(lru_list);
+
+    result_t* results = mmap(NULL, sizeof(result_t) * MAX_CONFIG,
+                             PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS,
+                             -1, 0);
+    if (results == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    memset(results, 0, sizeof(result_t) * MAX_CONFIG);
+
+    /* Each configuration runs in its own process so that the footprint and
+     * the page faults of one do not leak into the next.
+     */
+    fprintf(stdout, "%-12s %8s %10s %10s %10s\n", "# config", "t(ms)",
+            "rss(KB)", "minflt", "alloc(MB)");
+    fflush(stdout);
+
+    int i;
+    for (i = 0; i < config_num; i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            run_config(configs + i, results + i);
+            fflush(stdout);
+            _exit(results[i].succ ? 0 : 1);
+        }
+
+        int status;
+        waitpid(pid, &status, 0);
+    }
+
+    int fail = 0;
+    fprintf(stdout, "\n%-12s %10s %10s %12s %12s %12s\n", "config",
+            "alloc(MB)", "minflt", "flt/MB", "avg-rss(MB)", "peak-rss(MB)");
+    for (i = 0; i < config_num; i++) {
+        result_t* r = results + i;
+        if (!r->succ) {
+            fprintf(stdout, "%-12s failed\n", configs[i].name);
+            fail = 1;
+            continue;
+        }
+        fprintf(stdout, "%-12s %10.1f %10ld %12.2f %12.1f %12.1f\n",
+                configs[i].name, r->alloc_mb, r->minor_faults,
+                r->minor_faults / r->alloc_mb, r->avg_rss_mb, r->peak_rss_mb);
+    }
+
+    return fail;
+
+usage:
+    fprintf(stderr, "Usage: %s [-t seconds] [-i interval-ms] "
+            "[-d fixed|power-law|luajit] [-c cache-pages,...]\n", argv[0]);
+    return 1;
+}
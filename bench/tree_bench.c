@@ -0,0 +1,179 @@
+/* Microbenchmark of the rb-tree operations (rbtree.c) the page allocator
+ * relies on: insert, exact search, "less-or-equal" search and delete of
+ * random keys, as well as a random mix of the four on a steady-state tree.
+ *
+ *   The trees are exercised at several sizes: the free-block trees of the
+ * buddy allocator usually hold a handful to a few thousand blocks, while
+ * the allocated-block tree may grow to hundreds of thousands. Both kinds of
+ * trees are measured: maps (with values, e.g. alloc_blks) and sets (keys
+ * only, e.g. free_blks).
+ *
+ *   The same source is built twice: tree_bench against rbtree.c, and
+ * tree_bench_btree against the B+-tree (btree.c).
+ *
+ * Usage: tree_bench [-n scale]
+ *   -n: scale the number of operations, default 1.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "rbtree.h"
+#include "bench_util.h"
+
+static int scale = 1;
+
+static void
+shuffle(int* v, int n) {
+    int i;
+    for (i = n - 1; i > 0; i--) {
+        int j = rand_next() % (i + 1);
+        int t = v[i];
+        v[i] = v[j];
+        v[j] = t;
+    }
+}
+
+static void
+report(const char* op, int is_set, int tree_sz, long ops, uint64_t elapse_ns) {
+    fprintf(stdout, "%-10s %5s %10d %12ld %10.1f\n", op, is_set ? "set" : "map",
+            tree_sz, ops, (double)elapse_ns / ops);
+}
+
+static void
+bench_tree(int tree_sz, int is_set) {
+    rand_seed(32);
+
+    /* Keys are spread out so that searches for absent keys hit gaps */
+    int* keys = (int*)malloc(sizeof(int) * tree_sz);
+    int i;
+    for (i = 0; i < tree_sz; i++)
+        keys[i] = i * 4;
+
+    /* Repeat small trees so that each measurement is long enough */
+    int rounds = (1 << 20) / tree_sz * scale;
+    if (rounds < 1)
+        rounds = 1;
+
+    uint64_t t_ins = 0, t_search = 0, t_le = 0, t_del = 0;
+    long checksum = 0;
+    int r;
+    for (r = 0; r < rounds; r++) {
+        rb_tree_t* rbt = is_set ? rbt_create_set() : rbt_create();
+        uint64_t t0;
+
+        shuffle(keys, tree_sz);
+        t0 = now_ns();
+        for (i = 0; i < tree_sz; i++)
+            rbt_insert(rbt, keys[i], keys[i]);
+        t_ins += now_ns() - t0;
+
+        shuffle(keys, tree_sz);
+        t0 = now_ns();
+        for (i = 0; i < tree_sz; i++) {
+            intptr_t v;
+            checksum += rbt_search(rbt, keys[i], &v);
+        }
+        t_search += now_ns() - t0;
+
+        t0 = now_ns();
+        for (i = 0; i < tree_sz; i++) {
+            int k;
+            intptr_t v;
+            checksum += rbt_search_le(rbt, keys[i] + 1, &k, &v);
+        }
+        t_le += now_ns() - t0;
+
+        shuffle(keys, tree_sz);
+        t0 = now_ns();
+        for (i = 0; i < tree_sz; i++)
+            rbt_delete(rbt, keys[i], NULL);
+        t_del += now_ns() - t0;
+
+        rbt_destroy(rbt);
+    }
+
+    if (checksum != (long)rounds * tree_sz * 3) {
+        fprintf(stderr, "checksum mismatch\n");
+        exit(1);
+    }
+
+    long ops = (long)rounds * tree_sz;
+    report("insert", is_set, tree_sz, ops, t_ins);
+    report("search", is_set, tree_sz, ops, t_search);
+    report("search_le", is_set, tree_sz, ops, t_le);
+    report("delete", is_set, tree_sz, ops, t_del);
+
+    free(keys);
+}
+
+/* Start with every other key of [0, 2 * tree_sz) in the tree, then perform
+ * random inserts, deletes, searches and "less-or-equal" searches in equal
+ * proportion, which keeps the tree at about the same size.
+ */
+static void
+bench_mix(int tree_sz, int is_set) {
+    rand_seed(33);
+
+    rb_tree_t* rbt = is_set ? rbt_create_set() : rbt_create();
+    int i;
+    for (i = 0; i < tree_sz; i++)
+        rbt_insert(rbt, i * 8, i);
+
+    long ops = (1L << 20) * scale;
+    long checksum = 0;
+    uint64_t t0 = now_ns();
+    long n;
+    for (n = 0; n < ops; n++) {
+        uint64_t r = rand_next();
+        int key = (int)(r % (2 * tree_sz)) * 4;
+        intptr_t v;
+        int k;
+        switch (r >> 62) {
+        case 0: checksum += rbt_insert(rbt, key, key); break;
+        case 1: checksum += rbt_delete(rbt, key, NULL); break;
+        case 2: checksum += rbt_search(rbt, key, &v); break;
+        default: checksum += rbt_search_le(rbt, key, &k, &v); break;
+        }
+    }
+    uint64_t elapse = now_ns() - t0;
+
+    /* Keep the checksum alive */
+    if (checksum < 0)
+        fprintf(stderr, "checksum: %ld\n", checksum);
+
+    report("mix", is_set, tree_sz, ops, elapse);
+    rbt_destroy(rbt);
+}
+
+int
+main(int argc, char** argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+        case 'n': scale = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-n scale]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (scale <= 0)
+        scale = 1;
+
+#ifdef LJMM_BTREE
+    fprintf(stdout, "B+-tree\n");
+#else
+    fprintf(stdout, "RB-tree\n");
+#endif
+    fprintf(stdout, "%-10s %5s %10s %12s %10s\n", "op", "kind", "tree-size",
+            "ops", "ns/op");
+
+    int sizes[] = { 64, 1024, 32768, 1 << 20 };
+    for (unsigned i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+        bench_tree(sizes[i], 0);
+        bench_tree(sizes[i], 1);
+        bench_mix(sizes[i], 0);
+        bench_mix(sizes[i], 1);
+    }
+
+    return 0;
+}
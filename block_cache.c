@@ -19,6 +19,8 @@
 #include "util.h"
 #include "page_alloc.h"
 #include "block_cache.h"
+#include "commit.h"
+#include "profile.h"
 
 #define LRU_MAX_ENTRY 64
 #define INVALID_LRU_IDX (-1)
@@ -221,8 +223,16 @@ int
 bc_remove_block(page_idx_t start_page, int order, int zap_page) {
     if (zap_page) {
         char* p = get_page_addr(start_page);
-        size_t len = ((size_t)(1 << order)) << alloc_info->page_size_log2;
-        madvise(p, len, MADV_DONTDUMP|MADV_DONTNEED);
+        char* e = p + (((size_t)(1 << order)) << alloc_info->page_size_log2);
+        p = lm_mapped_start(p);
+        if (p < e) {
+            LM_PROF_BEGIN(madv_start);
+            madvise(p, e - p, MADV_DONTNEED);
+            madvise(p, e - p, MADV_DONTDUMP);
+            LM_PROF_END(LM_PROF_MADVISE, madv_start);
+        }
+        cm_decommit(start_page, 1 << order);
+        reset_dirty_blk(alloc_info->page_info + start_page);
     }
 
     if (!blk_cache_init || !enable_blk_cache)
@@ -243,6 +253,8 @@ bc_remove_block(page_idx_t start_page, int order, int zap_page) {
 
 int
 bc_evict_oldest() {
+    LM_PROF_SCOPE(LM_PROF_BC_EVICT);
+
     if (!blk_cache_init || !enable_blk_cache)
         return 0;
 
@@ -0,0 +1,971 @@
+/* A B+-tree implementing the interface declared in rbtree.h, compiled in
+ * only if LJMM_BTREE is defined (e.g. "make BTREE=1"). See btree.h for the
+ * layout of the nodes.
+ */
+#ifdef LJMM_BTREE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+#include "rbtree.h"
+#include "util.h"
+#include "profile.h"
+
+#define INVALID_IDX     (-1)
+
+/* The bounds of the number of keys of a node, except the root */
+#define LEAF_MIN        (BT_ORDER / 2)
+#define INNER_MAX       (BT_ORDER - 2)
+#define INNER_MIN       (INNER_MAX / 2)
+
+/* Way more than enough: each level multiplies the capacity by at least 8 */
+#define MAX_HEIGHT      16
+
+#define CACHE_LINE      64
+
+/* The position in each inner node on the path from the root to a leaf */
+typedef struct {
+    int node;
+    int pos;
+} bt_path_t;
+
+/****************************************************************************
+ *
+ *                  Node management
+ *
+ ****************************************************************************
+ */
+
+/* Resize the node vector, and the value vector if the tree is not a set.
+ * The node vector is reallocated by hand to keep it cache-line aligned.
+ * Return 1 on success, 0 otherwise.
+ */
+static int
+bt_resize(rb_tree_t* rbt, int cap) {
+    LM_PROF_BEGIN(resize_start);
+    void* mem = MYMALLOC(cap * sizeof(bt_node_t) + CACHE_LINE - 1);
+    if (!mem)
+        return 0;
+
+    if (rbt->values) {
+        intptr_t* vals;
+        vals = (intptr_t*)MYREALLOC(rbt->values,
+                                    cap * BT_ORDER * sizeof(intptr_t));
+        if (!vals) {
+            MYFREE(mem);
+            return 0;
+        }
+        rbt->values = vals;
+    }
+
+    uintptr_t aligned = ((uintptr_t)mem + CACHE_LINE - 1) & ~(CACHE_LINE - 1);
+    bt_node_t* nodes = (bt_node_t*)aligned;
+    if (rbt->node_num)
+        memcpy(nodes, rbt->nodes, rbt->node_num * sizeof(bt_node_t));
+
+    if (rbt->node_mem)
+        MYFREE(rbt->node_mem);
+    rbt->node_mem = mem;
+    rbt->nodes = nodes;
+    rbt->capacity = cap;
+    LM_PROF_END(LM_PROF_TREE_RESIZE, resize_start);
+
+    return 1;
+}
+
+/* Make sure <n> more nodes can be allocated without a resize */
+static int
+bt_reserve(rb_tree_t* rbt, int n) {
+    if (rbt->capacity - rbt->node_num >= n)
+        return 1;
+
+    int cap = rbt->capacity * 3 / 2;
+    if (cap < rbt->node_num + n)
+        cap = rbt->node_num + n;
+    return bt_resize(rbt, cap);
+}
+
+/* Fill the unused key slots with INT_MAX, see node_count_less() */
+static inline void
+node_pad(bt_node_t* nd) {
+    int i;
+    for (i = nd->num; i < BT_ORDER; i++)
+        nd->key[i] = INT_MAX;
+}
+
+/* Allocate a node, which must have been reserved by bt_reserve() unless it
+ * can be taken from the free list.
+ */
+static int
+bt_new_node(rb_tree_t* rbt) {
+    int idx = rbt->free_list;
+    if (idx != INVALID_IDX) {
+        rbt->free_list = rbt->nodes[idx].kid[0];
+    } else {
+        ASSERT(rbt->node_num < rbt->capacity);
+        idx = rbt->node_num++;
+    }
+
+    bt_node_t* nd = rbt->nodes + idx;
+    nd->num = 0;
+    nd->kid[0] = INVALID_IDX;
+    node_pad(nd);
+
+    return idx;
+}
+
+static inline void
+bt_free_node(rb_tree_t* rbt, int idx) {
+    rbt->nodes[idx].kid[0] = rbt->free_list;
+    rbt->free_list = idx;
+}
+
+/****************************************************************************
+ *
+ *                  Constructors & Destructors
+ *
+ ****************************************************************************
+ */
+static int
+rbt_init_helper(rb_tree_t* rbt, int is_set) {
+    const int init_cap = 4;
+
+    rbt->nodes = NULL;
+    rbt->node_mem = NULL;
+    rbt->node_num = rbt->capacity = 0;
+    rbt->values = NULL;
+    if (!is_set) {
+        rbt->values =
+            (intptr_t*)MYMALLOC(init_cap * BT_ORDER * sizeof(intptr_t));
+        if (!rbt->values)
+            return 0;
+    }
+
+    if (!bt_resize(rbt, init_cap)) {
+        if (rbt->values)
+            MYFREE(rbt->values);
+        rbt->values = NULL;
+        return 0;
+    }
+
+    /* The tree starts with an empty leaf as the root */
+    rbt->free_list = INVALID_IDX;
+    rbt->root = rbt->first = bt_new_node(rbt);
+    rbt->height = 0;
+    rbt->size = 0;
+
+    return 1;
+}
+
+int
+rbt_init(rb_tree_t* rbt) {
+    return rbt_init_helper(rbt, 0);
+}
+
+int
+rbt_init_set(rb_tree_t* rbt) {
+    return rbt_init_helper(rbt, 1);
+}
+
+void
+rbt_fini(rb_tree_t* rbt) {
+    if (rbt && rbt->node_mem) {
+        MYFREE(rbt->node_mem);
+        if (rbt->values)
+            MYFREE((void*)rbt->values);
+        rbt->nodes = NULL;
+        rbt->node_mem = NULL;
+        rbt->values = NULL;
+        rbt->capacity = rbt->node_num = rbt->size = 0;
+        rbt->root = rbt->first = rbt->free_list = INVALID_IDX;
+    }
+}
+
+static rb_tree_t*
+rbt_create_helper(int is_set) {
+    rb_tree_t* rbt = (rb_tree_t*)MYMALLOC(sizeof(rb_tree_t));
+    if (rbt && rbt_init_helper(rbt, is_set))
+        return rbt;
+
+    MYFREE((void*)rbt);
+    return NULL;
+}
+
+rb_tree_t*
+rbt_create(void) {
+    return rbt_create_helper(0);
+}
+
+rb_tree_t*
+rbt_create_set(void) {
+    return rbt_create_helper(1);
+}
+
+void
+rbt_destroy(rb_tree_t* rbt) {
+    if (rbt) {
+        rbt_fini(rbt);
+        MYFREE((void*)rbt);
+    }
+}
+
+/****************************************************************************
+ *
+ *                  In-node operations
+ *
+ ****************************************************************************
+ */
+
+/* Return the number of the node's keys which are less than <key>, i.e. the
+ * position <key> is to be inserted at. All the BT_ORDER slots are compared
+ * at once; this is fine as the unused slots, being INT_MAX, never count.
+ */
+static inline int
+node_count_less(const bt_node_t* nd, int key) {
+#ifdef __SSE2__
+    const __m128i* v = (const __m128i*)nd->key;
+    __m128i k = _mm_set1_epi32(key);
+    __m128i lt0 = _mm_cmplt_epi32(_mm_load_si128(v), k);
+    __m128i lt1 = _mm_cmplt_epi32(_mm_load_si128(v + 1), k);
+    __m128i lt2 = _mm_cmplt_epi32(_mm_load_si128(v + 2), k);
+    __m128i lt3 = _mm_cmplt_epi32(_mm_load_si128(v + 3), k);
+
+    /* Narrow the 16 32-bit masks down to 16 bytes */
+    __m128i lt = _mm_packs_epi16(_mm_packs_epi32(lt0, lt1),
+                                 _mm_packs_epi32(lt2, lt3));
+    return __builtin_popcount(_mm_movemask_epi8(lt));
+#else
+    int i, n = 0;
+    for (i = 0; i < BT_ORDER; i++)
+        n += nd->key[i] < key;
+    return n;
+#endif
+}
+
+/* Return the position of the kid of an inner node covering <key> */
+static inline int
+inner_kid_pos(const bt_node_t* nd, int key) {
+    int pos = node_count_less(nd, key);
+    if (pos < nd->num && nd->key[pos] == key)
+        pos++;
+    return pos;
+}
+
+/* Move <n> key/value pairs of leaves, the ranges may overlap */
+static inline void
+leaf_move(rb_tree_t* rbt, int dst, int dst_pos, int src, int src_pos, int n) {
+    memmove(rbt->nodes[dst].key + dst_pos, rbt->nodes[src].key + src_pos,
+            n * sizeof(int));
+    if (rbt->values) {
+        memmove(rbt->values + dst * BT_ORDER + dst_pos,
+                rbt->values + src * BT_ORDER + src_pos,
+                n * sizeof(intptr_t));
+    }
+}
+
+static void
+leaf_insert_at(rb_tree_t* rbt, int leaf_idx, int pos, int key, intptr_t val) {
+    bt_node_t* leaf = rbt->nodes + leaf_idx;
+    leaf_move(rbt, leaf_idx, pos + 1, leaf_idx, pos, leaf->num - pos);
+    leaf->key[pos] = key;
+    if (rbt->values)
+        rbt->values[leaf_idx * BT_ORDER + pos] = val;
+    leaf->num++;
+}
+
+static void
+leaf_remove_at(rb_tree_t* rbt, int leaf_idx, int pos) {
+    bt_node_t* leaf = rbt->nodes + leaf_idx;
+    leaf_move(rbt, leaf_idx, pos, leaf_idx, pos + 1, leaf->num - pos - 1);
+    leaf->num--;
+    leaf->key[leaf->num] = INT_MAX;
+}
+
+/* Insert the separator <key> at <pos>, and <kid> right after it */
+static void
+inner_insert_at(bt_node_t* nd, int pos, int key, int kid) {
+    memmove(nd->key + pos + 1, nd->key + pos, (nd->num - pos) * sizeof(int));
+    memmove(nd->kid + pos + 2, nd->kid + pos + 1,
+            (nd->num - pos) * sizeof(int));
+    nd->key[pos] = key;
+    nd->kid[pos + 1] = kid;
+    nd->num++;
+}
+
+/* Remove the separator at <pos>, and the kid right after it */
+static void
+inner_remove_at(bt_node_t* nd, int pos) {
+    memmove(nd->key + pos, nd->key + pos + 1,
+            (nd->num - pos - 1) * sizeof(int));
+    memmove(nd->kid + pos + 1, nd->kid + pos + 2,
+            (nd->num - pos - 1) * sizeof(int));
+    nd->num--;
+    nd->key[nd->num] = INT_MAX;
+}
+
+/****************************************************************************
+ *
+ *              B+-tree operations
+ *
+ ****************************************************************************
+ */
+
+/* Return the leaf which covers <key>. If <path> is not NULL, record the path
+ * from the root to the leaf.
+ */
+static inline int
+bt_descend(rb_tree_t* rbt, int key, bt_path_t* path) {
+    int idx = rbt->root;
+    int lvl;
+    for (lvl = 0; lvl < rbt->height; lvl++) {
+        bt_node_t* nd = rbt->nodes + idx;
+        int pos = inner_kid_pos(nd, key);
+        if (path) {
+            path[lvl].node = idx;
+            path[lvl].pos = pos;
+        }
+        idx = nd->kid[pos];
+    }
+    return idx;
+}
+
+RBS_RESULT
+rbt_search(rb_tree_t* rbt, int key, intptr_t* value) {
+    int leaf_idx = bt_descend(rbt, key, NULL);
+    bt_node_t* leaf = rbt->nodes + leaf_idx;
+    int pos = node_count_less(leaf, key);
+    if (pos < leaf->num && leaf->key[pos] == key) {
+        if (value) {
+            *value = rbt->values ?
+                     rbt->values[leaf_idx * BT_ORDER + pos] : 0;
+        }
+        return RBS_EXACT;
+    }
+    return RBS_FAIL;
+}
+
+RBS_RESULT
+rbt_search_variant(rb_tree_t* rbt, int key, int* res_key, intptr_t* res_value,
+                   int le) {
+    /* The leaves are not linked backwards. In case the predecessor is not
+     * in the leaf covering <key>, it is the maximum of the subtree right
+     * before the deepest branch taken other than the leftmost one.
+     */
+    int left_subtree = INVALID_IDX;
+    int left_lvl = 0;
+
+    int idx = rbt->root;
+    int lvl;
+    for (lvl = 0; lvl < rbt->height; lvl++) {
+        bt_node_t* nd = rbt->nodes + idx;
+        int pos = inner_kid_pos(nd, key);
+        if (pos > 0) {
+            left_subtree = nd->kid[pos - 1];
+            left_lvl = lvl + 1;
+        }
+        idx = nd->kid[pos];
+    }
+
+    bt_node_t* leaf = rbt->nodes + idx;
+    int pos = node_count_less(leaf, key);
+
+    RBS_RESULT res = RBS_FAIL;
+    if (pos < leaf->num && leaf->key[pos] == key) {
+        res = RBS_EXACT;
+    } else if (le) {
+        if (pos > 0) {
+            pos--;
+            res = RBS_LESS;
+        } else if (left_subtree != INVALID_IDX) {
+            idx = left_subtree;
+            for (lvl = left_lvl; lvl < rbt->height; lvl++)
+                idx = rbt->nodes[idx].kid[rbt->nodes[idx].num];
+            pos = rbt->nodes[idx].num - 1;
+            res = RBS_LESS;
+        }
+    } else {
+        if (pos < leaf->num) {
+            res = RBS_GREATER;
+        } else if (leaf->kid[0] != INVALID_IDX) {
+            idx = leaf->kid[0];
+            pos = 0;
+            res = RBS_GREATER;
+        }
+    }
+
+    if (res != RBS_FAIL) {
+        if (res_key)
+            *res_key = rbt->nodes[idx].key[pos];
+
+        if (res_value) {
+            *res_value = rbt->values ?
+                         rbt->values[idx * BT_ORDER + pos] : 0;
+        }
+    }
+
+    return res;
+}
+
+int
+rbt_get_min(rb_tree_t* rbt) {
+    ASSERT(!rbt_is_empty(rbt));
+    return rbt->nodes[rbt->first].key[0];
+}
+
+int
+rbt_get_max(rb_tree_t* rbt) {
+    ASSERT(!rbt_is_empty(rbt));
+
+    int idx = rbt->root;
+    int lvl;
+    for (lvl = 0; lvl < rbt->height; lvl++)
+        idx = rbt->nodes[idx].kid[rbt->nodes[idx].num];
+
+    return rbt->nodes[idx].key[rbt->nodes[idx].num - 1];
+}
+
+int
+rbt_set_value(rb_tree_t* rbt, int key, intptr_t value) {
+    if (unlikely(!rbt->values))
+        return 0;
+
+    int leaf_idx = bt_descend(rbt, key, NULL);
+    bt_node_t* leaf = rbt->nodes + leaf_idx;
+    int pos = node_count_less(leaf, key);
+    if (pos < leaf->num && leaf->key[pos] == key) {
+        rbt->values[leaf_idx * BT_ORDER + pos] = value;
+        return 1;
+    }
+    return 0;
+}
+
+rb_iter_t
+rbt_iter_seek(rb_tree_t* rbt, int key) {
+    int leaf_idx = bt_descend(rbt, key, NULL);
+    bt_node_t* leaf = rbt->nodes + leaf_idx;
+    int pos = node_count_less(leaf, key);
+    if (pos < leaf->num)
+        return (leaf_idx << BT_ORDER_LOG2) + pos;
+
+    /* All the keys of the next leaf, if any, are greater */
+    return leaf->kid[0] < 0 ? -1 : leaf->kid[0] << BT_ORDER_LOG2;
+}
+
+/* Helper of rbt_insert(). Insert the separator <key> along with the new
+ * <kid> right after it into the inner node at level <lvl> of the path,
+ * splitting the nodes up the path as necessary.
+ */
+static void
+bt_insert_up(rb_tree_t* rbt, const bt_path_t* path, int lvl, int key,
+             int kid) {
+    for (; lvl >= 0; lvl--) {
+        int idx = path[lvl].node;
+        int pos = path[lvl].pos;
+        bt_node_t* nd = rbt->nodes + idx;
+        if (nd->num < INNER_MAX) {
+            inner_insert_at(nd, pos, key, kid);
+            return;
+        }
+
+        /* Split the node: the lower half of the INNER_MAX + 1 separators
+         * stay, the upper half move to a new node, and the one in the middle
+         * moves up.
+         */
+        int keys[INNER_MAX + 1], kids[INNER_MAX + 2];
+        memcpy(keys, nd->key, INNER_MAX * sizeof(int));
+        memcpy(kids, nd->kid, (INNER_MAX + 1) * sizeof(int));
+        memmove(keys + pos + 1, keys + pos, (INNER_MAX - pos) * sizeof(int));
+        memmove(kids + pos + 2, kids + pos + 1,
+                (INNER_MAX - pos) * sizeof(int));
+        keys[pos] = key;
+        kids[pos + 1] = kid;
+
+        int right_idx = bt_new_node(rbt);
+        nd = rbt->nodes + idx;
+        bt_node_t* right = rbt->nodes + right_idx;
+
+        const int half = (INNER_MAX + 1) / 2;
+        const int right_num = INNER_MAX - half;
+        memcpy(nd->key, keys, half * sizeof(int));
+        memcpy(nd->kid, kids, (half + 1) * sizeof(int));
+        nd->num = half;
+        node_pad(nd);
+
+        memcpy(right->key, keys + half + 1, right_num * sizeof(int));
+        memcpy(right->kid, kids + half + 1, (right_num + 1) * sizeof(int));
+        right->num = right_num;
+        node_pad(right);
+
+        key = keys[half];
+        kid = right_idx;
+    }
+
+    /* The root was split, grow a new root */
+    int root_idx = bt_new_node(rbt);
+    bt_node_t* root = rbt->nodes + root_idx;
+    root->key[0] = key;
+    root->kid[0] = rbt->root;
+    root->kid[1] = kid;
+    root->num = 1;
+
+    rbt->root = root_idx;
+    rbt->height++;
+}
+
+int
+rbt_insert(rb_tree_t* rbt, int key, intptr_t value) {
+    LM_PROF_SCOPE(LM_PROF_TREE_OP);
+
+    bt_path_t path[MAX_HEIGHT];
+    int leaf_idx = bt_descend(rbt, key, path);
+    bt_node_t* leaf = rbt->nodes + leaf_idx;
+
+    int pos = node_count_less(leaf, key);
+    if (pos < leaf->num && leaf->key[pos] == key)
+        return 0;
+
+    if (leaf->num < BT_ORDER) {
+        leaf_insert_at(rbt, leaf_idx, pos, key, value);
+        rbt->size++;
+        return 1;
+    }
+
+    /* The leaf is to be split. Reserve all the nodes the split may take
+     * beforehand, so that the tree is left intact on failure.
+     */
+    int need = 1;
+    int lvl;
+    for (lvl = rbt->height - 1; lvl >= 0; lvl--) {
+        if (rbt->nodes[path[lvl].node].num < INNER_MAX)
+            break;
+        need++;
+    }
+    if (lvl < 0)
+        need++;
+
+    if (!bt_reserve(rbt, need))
+        return 0;
+
+    int right_idx = bt_new_node(rbt);
+    leaf = rbt->nodes + leaf_idx;
+    bt_node_t* right = rbt->nodes + right_idx;
+
+    const int half = BT_ORDER / 2;
+    leaf_move(rbt, right_idx, 0, leaf_idx, half, BT_ORDER - half);
+    right->num = BT_ORDER - half;
+    leaf->num = half;
+    node_pad(leaf);
+
+    right->kid[0] = leaf->kid[0];
+    leaf->kid[0] = right_idx;
+
+    if (pos <= half)
+        leaf_insert_at(rbt, leaf_idx, pos, key, value);
+    else
+        leaf_insert_at(rbt, right_idx, pos - half, key, value);
+    rbt->size++;
+
+    bt_insert_up(rbt, path, rbt->height - 1, right->key[0], right_idx);
+    return 1;
+}
+
+/* Helper of rbt_delete(). Rebalance the underflowing inner nodes up the
+ * path, starting from level <lvl>, and shrink the tree if the root is left
+ * with a single kid.
+ */
+static void
+bt_rebalance_inner(rb_tree_t* rbt, const bt_path_t* path, int lvl) {
+    for (; lvl > 0; lvl--) {
+        int idx = path[lvl].node;
+        bt_node_t* nd = rbt->nodes + idx;
+        if (nd->num >= INNER_MIN)
+            break;
+
+        bt_node_t* dad = rbt->nodes + path[lvl - 1].node;
+        int pos = path[lvl - 1].pos;
+
+        if (pos < dad->num) {
+            int sib_idx = dad->kid[pos + 1];
+            bt_node_t* sib = rbt->nodes + sib_idx;
+            if (sib->num > INNER_MIN) {
+                /* Rotate the sibling's first kid over via the parent */
+                nd->key[nd->num] = dad->key[pos];
+                nd->kid[nd->num + 1] = sib->kid[0];
+                nd->num++;
+                dad->key[pos] = sib->key[0];
+
+                memmove(sib->kid, sib->kid + 1, sib->num * sizeof(int));
+                memmove(sib->key, sib->key + 1, (sib->num - 1) * sizeof(int));
+                sib->num--;
+                sib->key[sib->num] = INT_MAX;
+                break;
+            }
+
+            /* Merge the sibling into this node */
+            nd->key[nd->num] = dad->key[pos];
+            memcpy(nd->key + nd->num + 1, sib->key, sib->num * sizeof(int));
+            memcpy(nd->kid + nd->num + 1, sib->kid,
+                   (sib->num + 1) * sizeof(int));
+            nd->num += sib->num + 1;
+            bt_free_node(rbt, sib_idx);
+            inner_remove_at(dad, pos);
+        } else {
+            bt_node_t* sib = rbt->nodes + dad->kid[pos - 1];
+            if (sib->num > INNER_MIN) {
+                /* Rotate the sibling's last kid over via the parent */
+                memmove(nd->key + 1, nd->key, nd->num * sizeof(int));
+                memmove(nd->kid + 1, nd->kid, (nd->num + 1) * sizeof(int));
+                nd->key[0] = dad->key[pos - 1];
+                nd->kid[0] = sib->kid[sib->num];
+                nd->num++;
+
+                dad->key[pos - 1] = sib->key[sib->num - 1];
+                sib->num--;
+                sib->key[sib->num] = INT_MAX;
+                break;
+            }
+
+            /* Merge this node into the sibling */
+            sib->key[sib->num] = dad->key[pos - 1];
+            memcpy(sib->key + sib->num + 1, nd->key, nd->num * sizeof(int));
+            memcpy(sib->kid + sib->num + 1, nd->kid,
+                   (nd->num + 1) * sizeof(int));
+            sib->num += nd->num + 1;
+            bt_free_node(rbt, idx);
+            inner_remove_at(dad, pos - 1);
+        }
+    }
+
+    bt_node_t* root = rbt->nodes + rbt->root;
+    if (rbt->height && root->num == 0) {
+        int old_root = rbt->root;
+        rbt->root = root->kid[0];
+        rbt->height--;
+        bt_free_node(rbt, old_root);
+    }
+}
+
+int
+rbt_delete(rb_tree_t* rbt, int key, intptr_t* val) {
+    LM_PROF_SCOPE(LM_PROF_TREE_OP);
+
+    bt_path_t path[MAX_HEIGHT];
+    int leaf_idx = bt_descend(rbt, key, path);
+    bt_node_t* leaf = rbt->nodes + leaf_idx;
+
+    int pos = node_count_less(leaf, key);
+    if (pos >= leaf->num || leaf->key[pos] != key)
+        return 0;
+
+    if (val)
+        *val = rbt->values ? rbt->values[leaf_idx * BT_ORDER + pos] : 0;
+
+    leaf_remove_at(rbt, leaf_idx, pos);
+    rbt->size--;
+
+    if (rbt->height == 0 || leaf->num >= LEAF_MIN)
+        return 1;
+
+    /* The leaf underflows: borrow a key from, or merge with, a sibling. The
+     * separators need not be exact, they only need to route the keys.
+     */
+    int lvl = rbt->height - 1;
+    bt_node_t* dad = rbt->nodes + path[lvl].node;
+    pos = path[lvl].pos;
+
+    if (pos < dad->num) {
+        int sib_idx = dad->kid[pos + 1];
+        bt_node_t* sib = rbt->nodes + sib_idx;
+        if (sib->num > LEAF_MIN) {
+            leaf_move(rbt, leaf_idx, leaf->num, sib_idx, 0, 1);
+            leaf->num++;
+            leaf_remove_at(rbt, sib_idx, 0);
+            dad->key[pos] = sib->key[0];
+            return 1;
+        }
+
+        leaf_move(rbt, leaf_idx, leaf->num, sib_idx, 0, sib->num);
+        leaf->num += sib->num;
+        leaf->kid[0] = sib->kid[0];
+        bt_free_node(rbt, sib_idx);
+        inner_remove_at(dad, pos);
+    } else {
+        int sib_idx = dad->kid[pos - 1];
+        bt_node_t* sib = rbt->nodes + sib_idx;
+        if (sib->num > LEAF_MIN) {
+            leaf_insert_at(rbt, leaf_idx, 0, sib->key[sib->num - 1],
+                           rbt->values ? rbt->values[sib_idx * BT_ORDER +
+                                                     sib->num - 1] : 0);
+            sib->num--;
+            sib->key[sib->num] = INT_MAX;
+            dad->key[pos - 1] = leaf->key[0];
+            return 1;
+        }
+
+        /* Merge into the left sibling, so the leftmost leaf never goes */
+        leaf_move(rbt, sib_idx, sib->num, leaf_idx, 0, leaf->num);
+        sib->num += leaf->num;
+        sib->kid[0] = leaf->kid[0];
+        bt_free_node(rbt, leaf_idx);
+        inner_remove_at(dad, pos - 1);
+    }
+
+    bt_rebalance_inner(rbt, path, lvl);
+    return 1;
+}
+
+/****************************************************************************
+ *
+ *              Bulk construction
+ *
+ ****************************************************************************
+ */
+int
+rbt_build_sorted(rb_tree_t* rbt, const int* keys, const intptr_t* vals,
+                 int n) {
+    if (!rbt_is_empty(rbt) || n < 0)
+        return 0;
+
+    int i;
+    for (i = 1; i < n; i++) {
+        if (keys[i - 1] >= keys[i])
+            return 0;
+    }
+
+    if (n == 0)
+        return 1;
+
+    /* The keys (kids) are spread evenly over as few leaves (inner nodes) as
+     * possible, which keeps each node at least half full.
+     */
+    int leaf_num = (n + BT_ORDER - 1) / BT_ORDER;
+    int node_num = leaf_num;
+    int m;
+    for (m = leaf_num; m > 1; node_num += m)
+        m = (m + INNER_MAX) / (INNER_MAX + 1);
+
+    /* mins[i] is the minimum key of the i-th node of the current level */
+    int* mins = (int*)MYMALLOC(leaf_num * sizeof(int));
+    if (!mins)
+        return 0;
+
+    /* Allocate all the nodes at once, and start over */
+    if (rbt->capacity < node_num && !bt_resize(rbt, node_num)) {
+        MYFREE(mins);
+        return 0;
+    }
+    rbt->node_num = 0;
+    rbt->free_list = INVALID_IDX;
+
+    for (i = 0; i < leaf_num; i++) {
+        int lo = (long)n * i / leaf_num;
+        int hi = (long)n * (i + 1) / leaf_num;
+        int idx = bt_new_node(rbt);
+        bt_node_t* leaf = rbt->nodes + idx;
+
+        memcpy(leaf->key, keys + lo, (hi - lo) * sizeof(int));
+        leaf->num = hi - lo;
+        leaf->kid[0] = (i + 1 < leaf_num) ? idx + 1 : INVALID_IDX;
+        if (rbt->values) {
+            int k;
+            for (k = lo; k < hi; k++)
+                rbt->values[idx * BT_ORDER + k - lo] = vals ? vals[k] : 0;
+        }
+        mins[i] = keys[lo];
+    }
+
+    /* Build the inner levels bottom-up. The nodes of each level are
+     * allocated contiguously, starting from <level_start>.
+     */
+    int level_start = 0;
+    int height = 0;
+    for (m = leaf_num; m > 1; ) {
+        int cnt = (m + INNER_MAX) / (INNER_MAX + 1);
+        int next_start = rbt->node_num;
+        for (i = 0; i < cnt; i++) {
+            int lo = m * i / cnt;
+            int hi = m * (i + 1) / cnt;
+            int idx = bt_new_node(rbt);
+            bt_node_t* nd = rbt->nodes + idx;
+
+            int k;
+            for (k = lo; k < hi; k++) {
+                nd->kid[k - lo] = level_start + k;
+                if (k != lo)
+                    nd->key[k - lo - 1] = mins[k];
+            }
+            nd->num = hi - lo - 1;
+            mins[i] = mins[lo];
+        }
+        level_start = next_start;
+        m = cnt;
+        height++;
+    }
+    MYFREE(mins);
+
+    rbt->root = rbt->node_num - 1;
+    rbt->first = 0;
+    rbt->height = height;
+    rbt->size = n;
+
+    return 1;
+}
+
+/*****************************************************************************
+ *
+ *          Debugging and Testing Support
+ *
+ *****************************************************************************
+ */
+#if defined(DEBUG) || defined(ENABLE_TESTING)
+
+/* A B+-tree has no colors to speak of, they are simply ignored. */
+rb_tree_t*
+rbt_create_manually(rb_valcolor_t* node_info, int len) {
+    rb_tree_t* rbt = rbt_create();
+    if (!rbt)
+        return NULL;
+
+    int i;
+    for (i = 0; i < len; i++) {
+        if (!rbt_insert(rbt, node_info[i].key, node_info[i].value)) {
+            rbt_destroy(rbt);
+            return NULL;
+        }
+    }
+
+    return rbt;
+}
+
+typedef struct {
+    int last_leaf;
+    int key_num;
+} verify_state_t;
+
+/* Verify the subtree rooted at <idx> at level <lvl>, all of whose keys are
+ * supposed to be in [lo, hi).
+ */
+static int
+verify_subtree(rb_tree_t* rbt, int idx, int lvl, long lo, long hi,
+               verify_state_t* st) {
+    if (idx < 0 || idx >= rbt->node_num)
+        return 0;
+
+    bt_node_t* nd = rbt->nodes + idx;
+    int is_leaf = (lvl == rbt->height);
+    int is_root = (lvl == 0);
+    int min = is_root ? (is_leaf ? 0 : 1) : (is_leaf ? LEAF_MIN : INNER_MIN);
+    int max = is_leaf ? BT_ORDER : INNER_MAX;
+    if (nd->num < min || nd->num > max)
+        return 0;
+
+    int i;
+    for (i = 0; i < nd->num; i++) {
+        if (nd->key[i] < lo || nd->key[i] >= hi)
+            return 0;
+        if (i && nd->key[i - 1] >= nd->key[i])
+            return 0;
+    }
+    for (; i < BT_ORDER; i++) {
+        if (nd->key[i] != INT_MAX)
+            return 0;
+    }
+
+    if (is_leaf) {
+        /* The leaves must be chained in order */
+        if (st->last_leaf == INVALID_IDX) {
+            if (idx != rbt->first)
+                return 0;
+        } else if (rbt->nodes[st->last_leaf].kid[0] != idx) {
+            return 0;
+        }
+        st->last_leaf = idx;
+        st->key_num += nd->num;
+        return 1;
+    }
+
+    for (i = 0; i <= nd->num; i++) {
+        long kid_lo = i ? nd->key[i - 1] : lo;
+        long kid_hi = i < nd->num ? nd->key[i] : hi;
+        if (!verify_subtree(rbt, nd->kid[i], lvl + 1, kid_lo, kid_hi, st))
+            return 0;
+    }
+
+    return 1;
+}
+
+int
+rbt_verify(rb_tree_t* rbt) {
+    if (rbt->node_num > rbt->capacity || rbt->nodes == 0)
+        return 0;
+
+    if (((uintptr_t)rbt->nodes & (CACHE_LINE - 1)) != 0)
+        return 0;
+
+    verify_state_t st;
+    st.last_leaf = INVALID_IDX;
+    st.key_num = 0;
+    if (!verify_subtree(rbt, rbt->root, 0, INT_MIN, (long)INT_MAX + 1, &st))
+        return 0;
+
+    return rbt->nodes[st.last_leaf].kid[0] == INVALID_IDX &&
+           st.key_num == rbt->size;
+}
+
+static void
+dump_dot_subtree(rb_tree_t* rbt, FILE* f, int idx, int lvl) {
+    bt_node_t* nd = rbt->nodes + idx;
+    int i;
+
+    fprintf(f, "\tn%d [shape=record, label=\"", idx);
+    for (i = 0; i < nd->num; i++)
+        fprintf(f, "%s%d", i ? "|" : "", nd->key[i]);
+    fprintf(f, "\"];\n");
+
+    if (lvl == rbt->height)
+        return;
+
+    for (i = 0; i <= nd->num; i++) {
+        fprintf(f, "\tn%d -> n%d;\n", idx, nd->kid[i]);
+        dump_dot_subtree(rbt, f, nd->kid[i], lvl + 1);
+    }
+}
+
+int
+rbt_dump_dot(rb_tree_t* rbt, const char* name) {
+    FILE* f = fopen(name, "w");
+    if (f == 0)
+        return 0;
+
+    fprintf(f, "digraph G {\n");
+    dump_dot_subtree(rbt, f, rbt->root, 0);
+    fprintf(f, "}");
+    fclose(f);
+
+    return 1;
+}
+
+/* Print the tree directly to the console in plain text format*/
+void
+rbt_dump_text(rb_tree_t* rbt) {
+    fprintf(stdout, "B+ tree: root id:%d, height:%d, size:%d\n",
+            rbt->root, rbt->height, rbt->size);
+
+    rb_iter_t iter, iter_e;
+    for (iter = rbt_iter_begin(rbt), iter_e = rbt_iter_end(rbt);
+         iter != iter_e;
+         iter = rbt_iter_inc(rbt, iter)) {
+        fprintf(stdout, " Leaf:%d, key:%d, value:%ld\n",
+                iter >> BT_ORDER_LOG2, rbt_iter_key(rbt, iter),
+                (long)rbt_iter_value(rbt, iter));
+    }
+    fflush(stdout);
+}
+
+#endif /*defined(DEBUG) || defined(ENABLE_TESTING)*/
+
+#endif /*LJMM_BTREE*/
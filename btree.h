@@ -0,0 +1,79 @@
+#ifndef _BTREE_H_
+#define _BTREE_H_
+
+/* The data structures of the B+-tree, the alternative implementation of the
+ * interface declared in rbtree.h. It is selected at build time by defining
+ * LJMM_BTREE (e.g. "make BTREE=1"), and is not supposed to be included
+ * directly -- include rbtree.h instead.
+ *
+ *  The keys of a node occupy exactly one cache line, and are searched with
+ * SIMD comparisons, so a lookup touches one line per level rather than one
+ * per key as a binary tree does.
+ */
+#include <stdint.h> /* for intptr_t */
+
+/* The number of key slots of a node. A leaf holds up to BT_ORDER keys, an
+ * inner node up to BT_ORDER - 2 keys and BT_ORDER - 1 kids.
+ */
+#define BT_ORDER        16
+#define BT_ORDER_LOG2   4
+
+/* 128 bytes, and 64-byte aligned. The keys of a node are sorted in ascending
+ * order; the unused slots are filled with INT_MAX.
+ *
+ *  Inner node: kid[i] is the subtree of the keys in [key[i-1], key[i]).
+ *  Leaf: kid[0] is the next leaf, in the ascending order of keys.
+ */
+typedef struct {
+    int key[BT_ORDER];
+    int kid[BT_ORDER - 1];
+    int num;    /* number of keys */
+} bt_node_t;
+
+/* The nodes are kept in a vector, and refer to each other by index. The
+ * values are kept apart from the nodes: values[i * BT_ORDER + j] is the value
+ * of the j-th key of node i. A "set" does not have values (values == NULL).
+ */
+typedef struct {
+    bt_node_t* nodes;
+    void* node_mem;     /* the (unaligned) block <nodes> is carved from */
+    intptr_t* values;
+    int root;
+    int height;         /* 0 if the root is a leaf */
+    int first;          /* the leftmost leaf, which never changes */
+    int free_list;      /* freed nodes, linked via kid[0] */
+    int node_num;       /* nodes ever used, including the freed ones */
+    int capacity;
+    int size;           /* number of keys */
+} rb_tree_t;
+
+#define rbt_is_empty(rbt) ((rbt)->size == 0)
+
+#define rbt_size(rbt)     ((rbt)->size)
+
+/* Iterator, visiting the keys in ascending order along the chain of leaves.
+ * An iterator is the position "node * BT_ORDER + slot", or -1 at the end.
+ */
+typedef int rb_iter_t;
+
+static inline rb_iter_t
+bt_iter_next(const rb_tree_t* rbt, rb_iter_t iter) {
+    const bt_node_t* leaf = rbt->nodes + (iter >> BT_ORDER_LOG2);
+    if ((iter & (BT_ORDER - 1)) + 1 < leaf->num)
+        return iter + 1;
+
+    /* All leaves but the root are non-empty */
+    return leaf->kid[0] < 0 ? -1 : leaf->kid[0] << BT_ORDER_LOG2;
+}
+
+#define rbt_iter_begin(rbt) \
+    ((rbt)->size ? (rbt)->first << BT_ORDER_LOG2 : -1)
+#define rbt_iter_end(rbt)           (-1)
+#define rbt_iter_inc(rbt, iter)     bt_iter_next((rbt), (iter))
+
+#define rbt_iter_key(rbt, iter) \
+    ((rbt)->nodes[(iter) >> BT_ORDER_LOG2].key[(iter) & (BT_ORDER - 1)])
+#define rbt_iter_value(rbt, iter) \
+    ((rbt)->values ? (rbt)->values[(iter)] : 0)
+
+#endif /*_BTREE_H_*/
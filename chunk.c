@@ -1,14 +1,20 @@
-/* This file is to allocate a big chunk of memory right after .bss. Subsequent
- * lm_mmap() is to serve the allocation request by carving smaller blocker out
- * of this big chunk of memory.
+/* This file is to reserve big chunks of memory in the address windows given
+ * by ljmm_opt_t::windows -- by default, a single chunk right after .bss.
+ * Subsequent lm_mmap() is to serve the allocation request by carving smaller
+ * blocker out of these big chunks of memory.
+ *
+ * If ljmm_opt_t::harvest_holes is set, every unmapped hole in the windows,
+ * as listed by /proc/self/maps, is reserved as a chunk of its own instead.
  */
 #include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <strings.h> /* for bzero() */
 #include "util.h"
 #include "chunk.h"
+#include "page_alloc.h" /* for MAX_ORDER */
 #include "lj_mm.h"
 
 #define SIZE_1MB ((uint)0x100000)
@@ -20,53 +26,305 @@
  */
 #define MEM_TOO_SMALL (SIZE_1MB * 8)
 
-lm_chunk_t lm_big_chunk;
+/* Holes are numerous, so the smaller ones are worth reserving as well. */
+#define HOLE_TOO_SMALL SIZE_1MB
 
-lm_chunk_t*
-lm_alloc_chunk (ljmm_mode_t mode) {
-    if (lm_big_chunk.base)
-        return &lm_big_chunk;
+#ifndef MAP_FIXED_NOREPLACE
+    #define MAP_FIXED_NOREPLACE 0x100000
+#endif
 
-    uintptr_t cur_brk = (uintptr_t)sbrk(0);
-    uintptr_t page_sz = sysconf(_SC_PAGESIZE);
+lm_chunk_t lm_chunks[LM_MAX_CHUNK];
+int lm_chunk_num;
+lm_chunk_t* lm_lazy_chunk;
+
+/* Reserve a chunk of at least <min_sz> bytes in [start, end), and append it
+ * to lm_chunks[]. <extra_flags> and <prot> are passed on to mmap(). If
+ * <lazy_end> is above <start>, the chunk starts at <start>, but the part
+ * below <lazy_end> is left unmapped until lm_grow_chunk(). Return 1 on
+ * success, 0 otherwise.
+ */
+static int
+alloc_chunk(uintptr_t start, uintptr_t end, uintptr_t page_sz,
+            uintptr_t min_sz, int extra_flags, int prot, uintptr_t lazy_end) {
+    if (lm_chunk_num == LM_MAX_CHUNK)
+        return 0;
 
     /* The chunk must be page-aligned, and are multiple pages in size. */
-    cur_brk = (page_sz - 1 + cur_brk) & ~(page_sz - 1);
-    uintptr_t upbound = (mode == LM_USER_MODE) ? SIZE_2GB : SIZE_1GB;
-    if (cur_brk >= upbound)
-        return NULL;
-
-    uintptr_t avail = upbound - cur_brk;
-    avail = avail & ~(page_sz - 1);
-    if (avail < MEM_TOO_SMALL) {
+    start = (page_sz - 1 + start) & ~(page_sz - 1);
+    uintptr_t map_start = start;
+    if (lazy_end > start) {
+        map_start = (page_sz - 1 + lazy_end) & ~(page_sz - 1);
+        /* The mapped part must be right where it is supposed to be. */
+        extra_flags |= MAP_FIXED_NOREPLACE;
+    }
+    if (map_start >= end)
+        return 0;
+
+    uintptr_t avail = (end - map_start) & ~(page_sz - 1);
+    if (avail < min_sz) {
         /* Bail out as we can achieve almost nothing with 1MB.*/
-        return NULL;
+        return 0;
     }
 
+    /* Below 2G, MAP_32BIT keeps the kernel from placing the chunk elsewhere
+     * should the hint be taken. Above 2G, there is no such flag; the chunk
+     * is checked against the window instead.
+     */
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | extra_flags;
+    if (end <= SIZE_2GB)
+        flags |= MAP_32BIT;
+
     uintptr_t chunk = (uintptr_t)
-        mmap((void*)cur_brk, avail, PROT_READ|PROT_WRITE,
-             MAP_PRIVATE | MAP_32BIT | MAP_ANONYMOUS, -1, 0);
+        mmap((void*)map_start, avail, prot, flags, -1, 0);
 
     if (chunk == (uintptr_t)MAP_FAILED)
-        return NULL;
+        return 0;
+
+    if (chunk < start || chunk + avail > end ||
+        (map_start != start && chunk != map_start)) {
+        munmap((void*)chunk, avail);
+        return 0;
+    }
 
     /* If the program linked to this lib generates core-dump, do not dump those
-     * portions which are not allocated at all.
+     * portions which are not allocated at all. The advices are not flags, so
+     * they take a call each.
+     */
+    madvise((void*)chunk, avail, MADV_DONTNEED);
+    madvise((void*)chunk, avail, MADV_DONTDUMP);
+
+    uintptr_t base = map_start != start ? start : chunk;
+
+    /* Keep the chunks sorted */
+    int i = lm_chunk_num++;
+    for (; i > 0 && (uintptr_t)lm_chunks[i - 1].base > base; i--)
+        lm_chunks[i] = lm_chunks[i - 1];
+
+    lm_chunk_t* c = lm_chunks + i;
+    c->base = (char*)base;
+    c->low = (char*)chunk;
+    c->size = chunk + avail - base;
+    c->page_size = page_sz;
+    c->page_num = c->size / page_sz;
+
+    return 1;
+}
+
+int
+lm_grow_chunk(char* addr) {
+    lm_chunk_t* c = lm_lazy_chunk;
+    ASSERT(c && addr >= c->base && addr < c->low);
+
+    /* Only the missing part is mapped; adjacent mappings are merged by the
+     * kernel anyway.
+     */
+    size_t len = c->low - addr;
+    char* p = mmap(addr, len, PROT_READ|PROT_WRITE,
+                   MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED_NOREPLACE, -1, 0);
+    if (p != addr) {
+        if (p != MAP_FAILED)
+            munmap(p, len);
+        lm_lazy_chunk = NULL;
+        return 0;
+    }
+
+    madvise(p, len, MADV_DONTDUMP);
+    c->low = addr;
+    if (c->low == c->base)
+        lm_lazy_chunk = NULL;
+
+    return 1;
+}
+
+/* Return /proc/sys/vm/mmap_min_addr, i.e. the lowest address mmap() can
+ * map at.
+ */
+static uintptr_t
+get_mmap_min_addr(void) {
+    uintptr_t addr = 0;
+    char buf[32];
+    int fd = open("/proc/sys/vm/mmap_min_addr", O_RDONLY);
+    int len = fd >= 0 ? read(fd, buf, sizeof(buf)) : -1;
+    if (fd >= 0)
+        close(fd);
+
+    int i;
+    for (i = 0; i < len && buf[i] >= '0' && buf[i] <= '9'; i++)
+        addr = addr * 10 + buf[i] - '0';
+
+    /* The kernel's default, should the file be unreadable */
+    return i ? addr : 0x10000;
+}
+
+/* Clip the hole [start, end) to each window, and append the results to
+ * <holes> unless they are too small, or <holes> is full.
+ */
+static void
+add_hole(uintptr_t start, uintptr_t end,
+         const ljmm_window_t* win, int win_num,
+         ljmm_window_t* holes, int* hole_num) {
+    int i;
+    for (i = 0; i < win_num && *hole_num < LM_MAX_CHUNK; i++) {
+        uintptr_t s = start > win[i].start ? start : win[i].start;
+        uintptr_t e = end < win[i].end ? end : win[i].end;
+        if (s < e && e - s >= HOLE_TOO_SMALL) {
+            holes[*hole_num].start = s;
+            holes[*hole_num].end = e;
+            (*hole_num)++;
+        }
+    }
+}
+
+/* Find the unmapped holes in the windows according to /proc/self/maps, and
+ * return the number of them. The holes are only collected here; reserving
+ * them right away would change the maps being read.
+ */
+static int
+find_holes(const ljmm_window_t* win, int win_num, ljmm_window_t* holes) {
+    int fd = open("/proc/self/maps", O_RDONLY);
+    if (fd < 0)
+        return 0;
+
+    /* Each line starts with "<start>-<end> ", in hex, in ascending order.
+     * The rest of the line is skipped, however long it is. The file is read
+     * with read(2) into a static buffer, as stdio may call malloc().
      */
-    madvise((void*)chunk, avail, MADV_DONTNEED | MADV_DONTDUMP);
+    static char buf[4096];
+    int hole_num = 0;
+    int field = 0; /* 0: <start>, 1: <end>, 2: the rest of the line */
+    uintptr_t lo = 0, hi = 0, prev_end = 0;
+    int len;
+    while ((len = read(fd, buf, sizeof(buf))) > 0) {
+        int i;
+        for (i = 0; i < len; i++) {
+            char c = buf[i];
+            if (field == 2) {
+                if (c == '\n') {
+                    field = 0;
+                    lo = hi = 0;
+                }
+            } else if (c == '-' || c == ' ') {
+                if (++field == 2) {
+                    add_hole(prev_end, lo, win, win_num, holes, &hole_num);
+                    if (hi > prev_end)
+                        prev_end = hi;
+                }
+            } else {
+                int d = c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10;
+                if (field == 0)
+                    lo = lo * 16 + d;
+                else
+                    hi = hi * 16 + d;
+            }
+        }
+    }
+    close(fd);
+
+    add_hole(prev_end, UINTPTR_MAX, win, win_num, holes, &hole_num);
+    return hole_num;
+}
+
+int
+lm_alloc_chunks(const ljmm_opt_t* opt) {
+    if (lm_chunk_num)
+        return lm_chunk_num;
 
-    lm_big_chunk.base = (char*)chunk;
-    lm_big_chunk.size = avail;
-    lm_big_chunk.page_size = page_sz;
-    lm_big_chunk.page_num = avail / page_sz;
+    uintptr_t cur_brk = (uintptr_t)sbrk(0);
+    uintptr_t page_sz = sysconf(_SC_PAGESIZE);
+
+    int win_num = opt->window_num;
+    ljmm_window_t win[LM_MAX_CHUNK];
+    if (win_num <= 0) {
+        /* Harvesting starts from the lowest address mmap() can map at. */
+        win[0].start = opt->harvest_holes ? get_mmap_min_addr() : 0;
+        win[0].end = (opt->mode == LM_USER_MODE) ? SIZE_2GB : SIZE_1GB;
+        win_num = 1;
+    } else if (win_num > LM_MAX_WINDOW) {
+        return 0;
+    } else {
+        int i;
+        for (i = 0; i < win_num; i++)
+            win[i] = opt->windows[i];
+    }
+
+    int i;
+    uintptr_t lo = UINTPTR_MAX, hi = 0;
+    for (i = 0; i < win_num; i++) {
+        if (!win[i].start)
+            win[i].start = cur_brk;
+        if (win[i].start < lo)
+            lo = win[i].start;
+        if (win[i].end > hi)
+            hi = win[i].end;
+    }
+
+    /* The pages are indexed from the lowest chunk through the highest one,
+     * see lm_init_page_alloc(). Nothing is reserved if they could not be.
+     */
+    if (hi > lo && (hi - lo) / page_sz > ((uintptr_t)1 << MAX_ORDER))
+        return 0;
 
-    return &lm_big_chunk;
+    /* With commit-on-allocate, the chunks are inaccessible to start with.
+     * See commit.c.
+     */
+    int prot = PROT_READ | PROT_WRITE;
+    int flags = 0;
+    if (opt->reserve_only) {
+        prot = PROT_NONE;
+        flags = MAP_NORESERVE;
+    }
+
+    /* A hole is reserved as it is, or not at all. */
+    uintptr_t min_sz = MEM_TOO_SMALL;
+    if (opt->harvest_holes) {
+        ljmm_window_t holes[LM_MAX_CHUNK];
+        win_num = find_holes(win, win_num, holes);
+        for (i = 0; i < win_num; i++)
+            win[i] = holes[i];
+
+        min_sz = HOLE_TOO_SMALL;
+        flags |= MAP_FIXED_NOREPLACE;
+    }
+
+    /* The space right above sbrk(0) is left to the heap. The chunk around it
+     * takes the space only on demand, i.e. when it is out of space above.
+     */
+    uintptr_t lazy_end = opt->brk_gap ? cur_brk + opt->brk_gap : 0;
+
+    for (i = 0; i < win_num; i++) {
+        uintptr_t start = win[i].start;
+        uintptr_t end = win[i].end;
+
+        /* A chunk is either entirely below 2G, or entirely above it */
+        uintptr_t mid = end;
+        if (start < SIZE_2GB && end > SIZE_2GB)
+            mid = SIZE_2GB;
+
+        alloc_chunk(start, mid, page_sz, min_sz, flags, prot,
+                    cur_brk >= start && cur_brk < mid ? lazy_end : 0);
+        if (mid != end) {
+            alloc_chunk(mid, end, page_sz, min_sz, flags, prot,
+                        cur_brk >= mid && cur_brk < end ? lazy_end : 0);
+        }
+    }
+
+    for (i = 0; i < lm_chunk_num; i++) {
+        if (lm_chunks[i].low != lm_chunks[i].base)
+            lm_lazy_chunk = lm_chunks + i;
+    }
+
+    return lm_chunk_num;
 }
 
 void
-lm_free_chunk(void) {
-    if (lm_big_chunk.base) {
-        munmap(lm_big_chunk.base, lm_big_chunk.size);
-        bzero(&lm_big_chunk, sizeof(lm_big_chunk));
+lm_free_chunks(void) {
+    int i;
+    for (i = 0; i < lm_chunk_num; i++) {
+        lm_chunk_t* c = lm_chunks + i;
+        munmap(c->low, c->base + c->size - c->low);
     }
+
+    bzero(lm_chunks, sizeof(lm_chunks));
+    lm_chunk_num = 0;
+    lm_lazy_chunk = NULL;
 }
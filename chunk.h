@@ -5,26 +5,77 @@
 #ifdef DEBUG
 #include <stdio.h> /* for FILE */
 #endif
+#include "util.h" /* for likely() */
+#include "lj_mm.h"
 
 /* "Huge" chunk of memmory. Memmory allocations are to carve blocks
  *  from the big chunk.
  */
 typedef struct {
     char* base;          /* the starting address of the big chunk */
+    char* low;           /* [base, low) is not mapped yet, see lm_map_chunk() */
     uint64_t size;       /* page_num * page_size */
     uint32_t page_num;   /* number of pages in the chunk */
     uint32_t page_size;  /* cache of sysconf(_SC_PAGESIZE); */
 } lm_chunk_t;
 
-extern lm_chunk_t lm_big_chunk;
+/* One chunk is reserved in each address window (see ljmm_opt_t::windows),
+ * except for those too crowded to hold a useful chunk, or in each hole of
+ * the windows if ljmm_opt_t::harvest_holes is set. A window across 2G is
+ * divided in two at 2G. The chunks are in the ascending order of address.
+ */
+#define LM_MAX_CHUNK 64
+
+extern lm_chunk_t lm_chunks[LM_MAX_CHUNK];
+extern int lm_chunk_num;
+
+/* The chunk whose lower part, i.e. the brk gap (see ljmm_opt_t::brk_gap),
+ * is mapped on demand; NULL if there is none.
+ */
+extern lm_chunk_t* lm_lazy_chunk;
+
+/* Reserve the chunks, return the number of chunks reserved. */
+int lm_alloc_chunks(const ljmm_opt_t* opt);
+void lm_free_chunks(void);
+
+/* Map the lazy chunk's pages from <addr> up. Return 0 if the space is taken
+ * by someone else, most likely the heap; the lazy chunk is then done with
+ * growing, and lm_lazy_chunk becomes NULL.
+ */
+int lm_grow_chunk(char* addr);
 
-lm_chunk_t* lm_alloc_chunk();
-void lm_free_chunk(void);
+/* Make sure the page at <addr> is mapped. */
+static inline int
+lm_map_chunk(char* addr) {
+    lm_chunk_t* c = lm_lazy_chunk;
+    if (likely(!c || addr >= c->low || addr < c->base))
+        return 1;
+
+    return lm_grow_chunk(addr);
+}
+
+/* Return <addr>, or the lower boundary of the lazy chunk if <addr> is in
+ * its part yet to map, which may well belong to the heap by now. A range
+ * from <addr> is to be clipped to the returned address before it is
+ * madvise()d or remapped.
+ */
+static inline char*
+lm_mapped_start(char* addr) {
+    lm_chunk_t* c = lm_lazy_chunk;
+    if (likely(!c || addr >= c->low || addr < c->base))
+        return addr;
+
+    return c->low;
+}
 
 static inline int lm_in_chunk_range(void* ptr) {
     char* t = (char*) ptr;
-    return t >= lm_big_chunk.base &&
-           (t < lm_big_chunk.base + lm_big_chunk.size);
+    int i;
+    for (i = 0; i < lm_chunk_num; i++) {
+        if (t >= lm_chunks[i].low && t < lm_chunks[i].base + lm_chunks[i].size)
+            return 1;
+    }
+    return 0;
 }
 
 #ifdef DEBUG
@@ -0,0 +1,142 @@
+/* This file is to commit and decommit the pages of the chunks reserved with
+ * PROT_NONE. See commit.h for details.
+ *
+ *  A unit may straddle the boundary of a chunk, or the lower boundary of the
+ * lazy chunk (see lm_map_chunk()). Only the pages mapped by the chunk the
+ * request falls in are committed; such a unit is never flagged, and is
+ * committed again, piece by piece, by each request touching it.
+ */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+#include <sys/mman.h>
+#include <errno.h>
+#include <strings.h> /* for bzero() */
+#include "util.h"
+#include "page_alloc.h"
+#include "commit.h"
+
+lm_commit_t* commit_info = NULL;
+
+int
+cm_init(int page_num, int enable) {
+    if (!enable)
+        return 1;
+
+    int unit_num = (page_num >> COMMIT_ORDER) + 1;
+    lm_commit_t* ci = (lm_commit_t*)MYMALLOC(sizeof(lm_commit_t) + unit_num);
+    if (!ci)
+        return 0;
+
+    ci->committed = (unsigned char*)(ci + 1);
+    ci->unit_num = unit_num;
+    bzero(ci->committed, unit_num);
+    commit_info = ci;
+
+    return 1;
+}
+
+void
+cm_fini(void) {
+    if (commit_info) {
+        MYFREE(commit_info);
+        commit_info = NULL;
+    }
+}
+
+/* Return the chunk holding <addr> */
+static lm_chunk_t*
+find_chunk(char* addr) {
+    int i;
+    for (i = 0; i < lm_chunk_num; i++) {
+        lm_chunk_t* c = lm_chunks + i;
+        if (addr >= c->base && addr < c->base + c->size)
+            return c;
+    }
+
+    ASSERT(0);
+    return NULL;
+}
+
+int
+cm_commit_slow(page_idx_t page, int page_num) {
+    unsigned char* committed = commit_info->committed;
+    int first = page >> COMMIT_ORDER;
+    int last = (page + page_num - 1) >> COMMIT_ORDER;
+
+    /* Fast path: all units are committed already */
+    int u;
+    for (u = first; u <= last && committed[u]; u++)
+        ;
+    if (u > last)
+        return 1;
+
+    char* addr = get_page_addr(page);
+    lm_chunk_t* c = find_chunk(addr);
+    char* lo = c->low;
+    char* hi = c->base + c->size;
+
+    /* Commit the runs of uncommitted units, one mprotect() per run */
+    while (u <= last) {
+        int run_end = u;
+        while (run_end <= last && !committed[run_end])
+            run_end++;
+
+        char* start = get_page_addr(u << COMMIT_ORDER);
+        char* end = get_page_addr(run_end << COMMIT_ORDER);
+        int whole_units = start >= lo && end <= hi;
+        if (start < lo)
+            start = lo;
+        if (end > hi)
+            end = hi;
+
+        if (mprotect(start, end - start, PROT_READ|PROT_WRITE)) {
+            errno = ENOMEM;
+            return 0;
+        }
+
+        if (whole_units) {
+            for (; u < run_end; u++)
+                committed[u] = 1;
+        } else {
+            /* Flag the units entirely within the chunk */
+            for (; u < run_end; u++) {
+                char* us = get_page_addr(u << COMMIT_ORDER);
+                char* ue = get_page_addr((u + 1) << COMMIT_ORDER);
+                committed[u] = us >= lo && ue <= hi;
+            }
+        }
+
+        while (u <= last && committed[u])
+            u++;
+    }
+
+    return 1;
+}
+
+void
+cm_decommit(page_idx_t page, int page_num) {
+    if (likely(!commit_info))
+        return;
+
+    int unit_sz = 1 << COMMIT_ORDER;
+    int first = (page + unit_sz - 1) >> COMMIT_ORDER;
+    int end = (page + page_num) >> COMMIT_ORDER;
+    if (first >= end)
+        return;
+
+    /* Mapping PROT_NONE afresh, rather than mprotect(), gives up the pages
+     * and the commit charge in one go.
+     */
+    char* start = lm_mapped_start(get_page_addr(first << COMMIT_ORDER));
+    char* stop = get_page_addr(end << COMMIT_ORDER);
+    if (start >= stop)
+        return;
+
+    size_t len = stop - start;
+    mmap(start, len, PROT_NONE,
+         MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE|MAP_FIXED, -1, 0);
+    madvise(start, len, MADV_DONTDUMP);
+
+    bzero(commit_info->committed + first, end - first);
+}
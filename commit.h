@@ -0,0 +1,42 @@
+#ifndef _COMMIT_H_
+#define _COMMIT_H_
+
+/* Commit-on-allocate (see ljmm_opt_t::reserve_only). The chunks are then
+ * reserved with PROT_NONE, which costs no commit charge, and the pages are
+ * made accessible as they are handed out, in units of COMMIT_ORDER pages so
+ * as to keep the number of VMAs and mprotect() calls in bounds. A unit is
+ * decommitted when it is purged, i.e. zapped by the block cache.
+ */
+#include "util.h"
+
+#define COMMIT_ORDER 9 /* 2M with 4k page */
+
+typedef struct {
+    unsigned char* committed; /* one flag per unit */
+    int unit_num;
+} lm_commit_t;
+
+extern lm_commit_t* commit_info;
+
+int cm_init(int page_num, int enable);
+void cm_fini(void);
+
+/* Commit the units covering the pages [page, page + page_num). Return 1 on
+ * success, 0 if the system is out of commit charge.
+ */
+int cm_commit_slow(page_idx_t page, int page_num);
+
+static inline int
+cm_commit(page_idx_t page, int page_num) {
+    if (likely(!commit_info))
+        return 1;
+
+    return cm_commit_slow(page, page_num);
+}
+
+/* Decommit the units lying entirely within the pages [page,
+ * page + page_num), which must be free.
+ */
+void cm_decommit(page_idx_t page, int page_num);
+
+#endif /* _COMMIT_H_ */
@@ -0,0 +1,407 @@
+/* This file contains the extent allocator for large requests. See extent.h
+ * for details.
+ */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+#include <sys/mman.h>
+#include <errno.h>
+#include "util.h"
+#include "page_alloc.h"
+#include "extent.h"
+
+lm_extent_t* extent_info = NULL;
+
+int
+ext_init(int order, page_idx_t start, page_idx_t end,
+         const lm_ext_index_t* index, int zap) {
+    lm_extent_t* ei = (lm_extent_t*)MYMALLOC(sizeof(lm_extent_t));
+    if (!ei)
+        return 0;
+
+    if (!rbt_init(&ei->alloc_exts)) {
+        MYFREE(ei);
+        return 0;
+    }
+
+    ei->start = start;
+    ei->end = end;
+    ei->order = order;
+    ei->zap = zap;
+    ei->free_page_num = 0;
+    ei->index = index;
+    extent_info = ei;
+
+    if (!index->init()) {
+        rbt_fini(&ei->alloc_exts);
+        MYFREE(ei);
+        extent_info = NULL;
+        return 0;
+    }
+
+    return 1;
+}
+
+void
+ext_fini(void) {
+    if (extent_info) {
+        extent_info->index->fini();
+        rbt_fini(&extent_info->alloc_exts);
+        MYFREE(extent_info);
+        extent_info = NULL;
+    }
+}
+
+static inline int
+pages_of(size_t sz) {
+    return (sz + alloc_info->page_size - 1) >> alloc_info->page_size_log2;
+}
+
+page_idx_t
+ext_align_up(page_idx_t page, int align_order) {
+    /* The alignment is that of the address, i.e. of the page number */
+    uintptr_t base = (uintptr_t)alloc_info->first_page >>
+                     alloc_info->page_size_log2;
+    uintptr_t mask = ((uintptr_t)1 << align_order) - 1;
+    return ((base + page + mask) & ~mask) - base;
+}
+
+/****************************************************************************
+ *
+ *              The first-fit index
+ *
+ ****************************************************************************
+ */
+static int
+ff_init(void) {
+    int leaf_num = 1;
+    while (leaf_num < extent_info->end - extent_info->start)
+        leaf_num <<= 1;
+
+    extent_info->max_len = (int*)MYCALLOC(2 * leaf_num, sizeof(int));
+    if (!extent_info->max_len)
+        return 0;
+    extent_info->leaf_num = leaf_num;
+
+    if (!rbt_init(&extent_info->free_exts)) {
+        MYFREE(extent_info->max_len);
+        return 0;
+    }
+    return 1;
+}
+
+static void
+ff_fini(void) {
+    rbt_fini(&extent_info->free_exts);
+    MYFREE(extent_info->max_len);
+}
+
+/* Record the free extent <ext> of <len> pages, 0 if there is none any more.
+ * Each inner entry is the maximum of its kids.
+ */
+static void
+ff_set(page_idx_t ext, int len) {
+    int* v = extent_info->max_len;
+    int i = extent_info->leaf_num + ext - extent_info->start;
+    v[i] = len;
+
+    for (i >>= 1; i; i >>= 1) {
+        int l = v[2 * i], r = v[2 * i + 1];
+        int m = l > r ? l : r;
+        if (v[i] == m)
+            break;
+        v[i] = m;
+    }
+}
+
+static void
+ff_insert(page_idx_t ext, int len) {
+    rbt_insert(&extent_info->free_exts, ext, len);
+    ff_set(ext, len);
+}
+
+static void
+ff_remove(page_idx_t ext, int len) {
+    (void)len;
+    rbt_delete(&extent_info->free_exts, ext, NULL);
+    ff_set(ext, 0);
+}
+
+static int
+ff_len_at(page_idx_t page) {
+    intptr_t len;
+    if (rbt_search(&extent_info->free_exts, page, &len) == RBS_FAIL)
+        return 0;
+    return len;
+}
+
+static page_idx_t
+ff_ending_at(page_idx_t end) {
+    page_idx_t prev;
+    intptr_t len;
+    if (rbt_search_le(&extent_info->free_exts, end - 1, &prev, &len) ==
+            RBS_FAIL || prev + len != end) {
+        return -1;
+    }
+    return prev;
+}
+
+static int
+ff_largest(void) {
+    return extent_info->max_len[1];
+}
+
+/* Return the first free extent at or above the leaf <from> of <pages> or
+ * more, as the leaf; -1 if there is none.
+ */
+static int
+ff_find_ge(int from, int pages) {
+    int* v = extent_info->max_len;
+    int leaf_num = extent_info->leaf_num;
+    if (from >= leaf_num)
+        return -1;
+
+    /* Climb up until there is a right sibling having a qualified leaf,
+     * then descend to the leftmost one.
+     */
+    int i = leaf_num + from;
+    if (v[i] < pages) {
+        for (; i > 1 && ((i & 1) || v[i + 1] < pages); i >>= 1)
+            ;
+        if (i == 1)
+            return -1;
+
+        for (i++; i < leaf_num; ) {
+            i <<= 1;
+            if (v[i] < pages)
+                i++;
+        }
+    }
+    return i - leaf_num;
+}
+
+static page_idx_t
+ff_find(int pages, int align_order, int* len) {
+    /* The extents too short once aligned are skipped; with no alignment,
+     * the first one found fits.
+     */
+    int i = 0;
+    while ((i = ff_find_ge(i, pages)) >= 0) {
+        page_idx_t ext = extent_info->start + i;
+        int l = extent_info->max_len[extent_info->leaf_num + i];
+        if (ext_align_up(ext, align_order) + pages <= ext + l) {
+            *len = l;
+            return ext;
+        }
+        i++;
+    }
+
+    return -1;
+}
+
+const lm_ext_index_t ext_first_fit = {
+    "first-fit", ff_init, ff_fini, ff_insert, ff_remove, ff_len_at,
+    ff_ending_at, ff_find, ff_largest
+};
+
+/****************************************************************************
+ *
+ *              Free and allocated extents
+ *
+ ****************************************************************************
+ */
+static inline int
+is_dirty_ext(page_idx_t ext) {
+    return alloc_info->page_info[ext].flags & PF_DIRTY;
+}
+
+/* Index the free extent <ext> of <len> pages, flagging it if <dirty> */
+static void
+insert_free_ext(page_idx_t ext, int len, int dirty) {
+    extent_info->index->insert(ext, len);
+    alloc_info->page_info[ext].flags = dirty ? PF_DIRTY : 0;
+}
+
+static void
+remove_free_ext(page_idx_t ext, int len) {
+    extent_info->index->remove(ext, len);
+    alloc_info->page_info[ext].flags = 0;
+}
+
+/* Add the free pages [start, end), coalescing them with the free extents
+ * right before and after them. They are clean unless <dirty> is set.
+ */
+static void
+add_free_ext(page_idx_t start, page_idx_t end, int dirty) {
+    const lm_ext_index_t* index = extent_info->index;
+    extent_info->free_page_num += end - start;
+    alloc_info->free_page_num += end - start;
+
+    int len = index->len_at(end);
+    if (len) {
+        dirty |= is_dirty_ext(end);
+        remove_free_ext(end, len);
+        end += len;
+    }
+
+    page_idx_t prev = index->ending_at(start);
+    if (prev >= 0) {
+        dirty |= is_dirty_ext(prev);
+        remove_free_ext(prev, start - prev);
+        start = prev;
+    }
+
+    insert_free_ext(start, end - start, dirty);
+}
+
+void
+ext_add_free(page_idx_t start, page_idx_t end) {
+    if (start < end)
+        add_free_ext(start, end, 0);
+}
+
+/* Take the pages [start, end) out of the free extent <ext> of <len> pages.
+ * Return 1 if they may not be all zero, 0 otherwise.
+ */
+static int
+take_free_ext(page_idx_t ext, int len, page_idx_t start, page_idx_t end) {
+    int dirty = is_dirty_ext(ext);
+    remove_free_ext(ext, len);
+    if (ext < start)
+        insert_free_ext(ext, start - ext, dirty);
+    if (end < ext + len)
+        insert_free_ext(end, ext + len - end, dirty);
+
+    extent_info->free_page_num -= end - start;
+    alloc_info->free_page_num -= end - start;
+
+    if (extent_info->zap) {
+        madvise(get_page_addr(start),
+                (size_t)(end - start) << alloc_info->page_size_log2,
+                MADV_DODUMP);
+    }
+    return dirty;
+}
+
+/* Free the pages [start, end) no longer in use, zapping them if the region
+ * is to.
+ */
+static void
+release_pages(page_idx_t start, page_idx_t end) {
+    if (extent_info->zap) {
+        char* addr = get_page_addr(start);
+        size_t len = (size_t)(end - start) << alloc_info->page_size_log2;
+        madvise(addr, len, MADV_DONTNEED);
+        madvise(addr, len, MADV_DONTDUMP);
+        cm_decommit(start, end - start);
+    }
+
+    add_free_ext(start, end, !extent_info->zap);
+}
+
+static void
+add_alloc_ext(page_idx_t page, size_t sz, int locked) {
+    int res = rbt_insert(&extent_info->alloc_exts, page, sz);
+    ASSERT(res);
+    (void)res;
+
+    alloc_info->page_info[page].flags =
+        PF_LEADER | PF_ALLOCATED | (locked ? PF_LOCKED : 0);
+}
+
+static void
+remove_alloc_ext(page_idx_t page) {
+    rbt_delete(&extent_info->alloc_exts, page, NULL);
+    alloc_info->page_info[page].flags = 0;
+}
+
+page_idx_t
+ext_alloc(size_t sz, int align_order, int* dirty) {
+    int pages = pages_of(sz);
+    int len;
+    page_idx_t ext = extent_info->index->find(pages, align_order, &len);
+    if (ext < 0)
+        return -1;
+
+    page_idx_t start = ext_align_up(ext, align_order);
+    if (!cm_commit(start, pages)) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    *dirty = take_free_ext(ext, len, start, start + pages);
+    add_alloc_ext(start, sz, 0);
+    return start;
+}
+
+intptr_t
+ext_size(page_idx_t page) {
+    intptr_t sz;
+    if (rbt_search(&extent_info->alloc_exts, page, &sz) == RBS_FAIL)
+        return -1;
+
+    return sz;
+}
+
+int
+ext_free(page_idx_t page) {
+    intptr_t sz = ext_size(page);
+    return sz >= 0 && ext_unmap(page, sz);
+}
+
+int
+ext_unmap(page_idx_t page, size_t len) {
+    page_idx_t ext;
+    intptr_t sz;
+    if (!len || rbt_search_le(&extent_info->alloc_exts, page, &ext, &sz) ==
+                RBS_FAIL) {
+        return 0;
+    }
+
+    /* The ends in the same page are taken as the same */
+    page_idx_t ext_end = ext + pages_of(sz);
+    page_idx_t end = page + pages_of(len);
+    if (page >= ext_end || end > ext_end)
+        return 0;
+
+    int page_log2 = alloc_info->page_size_log2;
+    int locked = is_locked_blk(alloc_info->page_info + ext);
+    if (locked)
+        munlock(get_page_addr(page), (size_t)(end - page) << page_log2);
+
+    /* The parts before and after the unmapped pages remain allocated. */
+    remove_alloc_ext(ext);
+    if (ext < page)
+        add_alloc_ext(ext, (size_t)(page - ext) << page_log2, locked);
+    if (end < ext_end)
+        add_alloc_ext(end, sz - ((size_t)(end - ext) << page_log2), locked);
+
+    release_pages(page, end);
+    return 1;
+}
+
+int
+ext_resize(page_idx_t page, size_t new_size) {
+    intptr_t sz = ext_size(page);
+    ASSERT(sz >= 0 && new_size);
+
+    int old_pages = pages_of(sz);
+    int new_pages = pages_of(new_size);
+    if (new_pages < old_pages) {
+        size_t len = (size_t)(old_pages - new_pages) <<
+                     alloc_info->page_size_log2;
+        ext_unmap(page + new_pages, len);
+    } else if (new_pages > old_pages) {
+        /* Take the pages right after the extent, if they are free */
+        page_idx_t end = page + old_pages;
+        int len = extent_info->index->len_at(end);
+        if (len < new_pages - old_pages ||
+            !cm_commit(end, new_pages - old_pages)) {
+            return 0;
+        }
+        take_free_ext(end, len, end, page + new_pages);
+    }
+
+    rbt_set_value(&extent_info->alloc_exts, page, new_size);
+    return 1;
+}
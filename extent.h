@@ -0,0 +1,134 @@
+#ifndef _EXTENT_H_
+#define _EXTENT_H_
+
+/* The extent allocator for large requests (see ljmm_opt_t::extent_order).
+ * Rounding a request up to a buddy block wastes up to half of it, which
+ * hurts the most with the largest ones. These requests are instead served
+ * from a dedicated region at the top of the pages below 2G, in the exact
+ * number of pages. The free extents are coalesced with their neighbors as
+ * they are freed, and kept in an index which decides which one an
+ * allocation is carved from:
+ *
+ *   o. first-fit: the free extents in the ascending order of address; the
+ *                 first one big enough is taken. It is found in O(log n)
+ *                 time with a max-augmented tree over the region's pages,
+ *                 as in free_extent.c.
+ *   o. tlsf:      segregated free lists (see tlsf.c), used by
+ *                 LM_ENGINE_TLSF, in which case the region covers all the
+ *                 pages below 2G and serves requests of any size.
+ *
+ *  With the first-fit index, freed extents are zapped, so free extents are
+ * always known to be zero. With TLSF, they are not, which would cost a
+ * system call on each free; a free extent is then flagged PF_DIRTY at its
+ * first page if it may not be all zero, as the buddy blocks are.
+ */
+#include "util.h"
+#include "rbtree.h"
+
+typedef struct {
+    const char* name;
+    int (*init)(void);
+    void (*fini)(void);
+
+    /* Add or remove the free extent of <len> pages at <ext>. No coalescing
+     * is done here.
+     */
+    void (*insert)(page_idx_t ext, int len);
+    void (*remove)(page_idx_t ext, int len);
+
+    /* Return the pages of the free extent starting at <page>, or 0 if
+     * there is none.
+     */
+    int (*len_at)(page_idx_t page);
+
+    /* Return the free extent ending right before <end>, or -1 if there is
+     * none.
+     */
+    page_idx_t (*ending_at)(page_idx_t end);
+
+    /* Return a free extent which <pages> fit in from a page aligned to
+     * 1 << <align_order> pages in address (see ext_align_up()), along with
+     * its length (via <len>), or -1 if there is none.
+     */
+    page_idx_t (*find)(int pages, int align_order, int* len);
+
+    /* Return the pages of the largest free extent */
+    int (*largest)(void);
+} lm_ext_index_t;
+
+extern const lm_ext_index_t ext_first_fit;
+
+typedef struct {
+    page_idx_t start;       /* The region is the pages [start, end) */
+    page_idx_t end;
+    int order;              /* The smallest order of the requests served */
+    int zap;                /* Set if freed extents are zapped */
+    int free_page_num;
+    const lm_ext_index_t* index;
+
+    /* For the first-fit index */
+    rb_tree_t free_exts;    /* first page -> the number of pages */
+    int* max_len;           /* The implicit tree: leaf i is the pages of the
+                             * free extent at start + i, or 0 */
+    int leaf_num;
+
+    rb_tree_t alloc_exts;   /* first page -> the size in bytes */
+} lm_extent_t;
+
+extern lm_extent_t* extent_info;
+
+/* Set up the region [start, end) with the given index; the free pages in it
+ * are added with ext_add_free() afterwards. Return 1 on success, 0
+ * otherwise.
+ */
+int ext_init(int order, page_idx_t start, page_idx_t end,
+             const lm_ext_index_t* index, int zap);
+void ext_fini(void);
+void ext_add_free(page_idx_t start, page_idx_t end);
+
+static inline int
+ext_in_region(page_idx_t page) {
+    return extent_info && page >= extent_info->start &&
+           page < extent_info->end;
+}
+
+/* Return the first page at or above <page> which is aligned to
+ * 1 << <align_order> pages in address.
+ */
+page_idx_t ext_align_up(page_idx_t page, int align_order);
+
+/* Allocate an extent of <sz> bytes starting at a page aligned to
+ * 1 << <align_order> pages in address. Return the first page, or -1 if
+ * there is no room. <*dirty> is set if the extent may not be all zero.
+ */
+page_idx_t ext_alloc(size_t sz, int align_order, int* dirty);
+
+/* Return the size of the extent allocated at <page>, or -1 if there is
+ * none.
+ */
+intptr_t ext_size(page_idx_t page);
+
+/* Free the extent allocated at <page>. Return 1 on success, 0 otherwise. */
+int ext_free(page_idx_t page);
+
+/* Free the <len> bytes from <page>, which may be any part of an allocated
+ * extent. Return 1 on success, 0 otherwise.
+ */
+int ext_unmap(page_idx_t page, size_t len);
+
+/* Resize the extent allocated at <page> to <new_size> bytes in place.
+ * Return 1 on success, 0 if the pages following it are taken.
+ */
+int ext_resize(page_idx_t page, size_t new_size);
+
+static inline int
+ext_largest(void) {
+    return extent_info ? extent_info->index->largest() : 0;
+}
+
+static inline int
+ext_no_alloc(void) {
+    return !extent_info || rbt_is_empty(&extent_info->alloc_exts);
+}
+
+#endif /* _EXTENT_H_ */
@@ -0,0 +1,166 @@
+/* The free-extent index, see free_extent.h for the big picture.
+ *
+ *  The tree is stored in an array of 2 * leaf_num entries: entry 1 is the
+ * root, the kids of entry i are 2i and 2i+1, and the leaves (i.e. the pages)
+ * start at entry leaf_num. An entry takes one byte, as orders are below 32.
+ */
+#include <sys/mman.h>
+#include <stdlib.h>
+#include "util.h"
+#include "page_alloc.h"
+#include "free_extent.h"
+
+typedef struct {
+    signed char* max_order;
+    int leaf_num;   /* power of two, no less than page_num */
+    int page_num;
+} free_extent_t;
+
+static free_extent_t fe;
+
+int
+fe_init(int page_num) {
+    int leaf_num = 1;
+    while (leaf_num < page_num)
+        leaf_num <<= 1;
+
+    signed char* v = (signed char*)MYMALLOC(2 * leaf_num);
+    if (!v)
+        return 0;
+
+    int i;
+    for (i = 0; i < 2 * leaf_num; i++)
+        v[i] = INVALID_ORDER;
+
+    fe.max_order = v;
+    fe.leaf_num = leaf_num;
+    fe.page_num = page_num;
+    return 1;
+}
+
+void
+fe_fini(void) {
+    if (fe.max_order) {
+        MYFREE(fe.max_order);
+        fe.max_order = NULL;
+        fe.leaf_num = fe.page_num = 0;
+    }
+}
+
+void
+fe_set(page_idx_t blk, int order) {
+    ASSERT(blk >= 0 && blk < fe.page_num);
+
+    signed char* v = fe.max_order;
+    int i = fe.leaf_num + blk;
+    v[i] = order;
+
+    /* Propagate upward until the maximum of a subtree does not change */
+    for (i >>= 1; i; i >>= 1) {
+        int l = v[2 * i], r = v[2 * i + 1];
+        int m = l > r ? l : r;
+        if (v[i] == m)
+            break;
+        v[i] = m;
+    }
+}
+
+int
+fe_largest_order(void) {
+    return fe.max_order[1];
+}
+
+/* Return the leftmost (or the rightmost if <rightmost> is set) leaf under the
+ * entry <i> whose order is no less than <min_order>. The subtree must have
+ * such a leaf.
+ */
+static page_idx_t
+descend(int i, int min_order, int rightmost) {
+    signed char* v = fe.max_order;
+    int leaf_num = fe.leaf_num;
+
+    ASSERT(v[i] >= min_order);
+    while (i < leaf_num) {
+        i <<= 1;
+        if (rightmost) {
+            if (v[i + 1] >= min_order)
+                i++;
+        } else if (v[i] < min_order) {
+            i++;
+        }
+    }
+    return i - leaf_num;
+}
+
+page_idx_t
+fe_find_ge(page_idx_t from, int min_order) {
+    signed char* v = fe.max_order;
+    if (from < 0)
+        from = 0;
+
+    if (from >= fe.page_num || v[1] < min_order)
+        return -1;
+
+    int i = fe.leaf_num + from;
+    if (v[i] >= min_order)
+        return from;
+
+    /* Climb up until there is a right sibling having a qualified leaf */
+    for (; i > 1; i >>= 1) {
+        if (!(i & 1) && v[i + 1] >= min_order)
+            return descend(i + 1, min_order, 0);
+    }
+    return -1;
+}
+
+page_idx_t
+fe_find_le(page_idx_t from, int min_order) {
+    signed char* v = fe.max_order;
+    if (from >= fe.page_num)
+        from = fe.page_num - 1;
+
+    if (from < 0 || v[1] < min_order)
+        return -1;
+
+    int i = fe.leaf_num + from;
+    if (v[i] >= min_order)
+        return from;
+
+    /* Climb up until there is a left sibling having a qualified leaf */
+    for (; i > 1; i >>= 1) {
+        if ((i & 1) && v[i - 1] >= min_order)
+            return descend(i - 1, min_order, 1);
+    }
+    return -1;
+}
+
+#ifdef DEBUG
+int
+fe_verify(void) {
+    signed char* v = fe.max_order;
+    lm_page_t* pi = alloc_info->page_info;
+    int i;
+
+    /* The leaves agree with the free-block trees */
+    for (i = 0; i < fe.leaf_num; i++) {
+        int order = INVALID_ORDER;
+        if (i < fe.page_num && is_page_leader(pi + i) &&
+            !is_allocated_blk(pi + i) && !is_quick_blk(pi + i)) {
+            order = pi[i].order;
+            if (!find_block(i, order, NULL))
+                return 0;
+        }
+        if (v[fe.leaf_num + i] != order)
+            return 0;
+    }
+
+    /* Each inner entry is the maximum of its kids */
+    for (i = fe.leaf_num - 1; i >= 1; i--) {
+        int l = v[2 * i], r = v[2 * i + 1];
+        if (v[i] != (l > r ? l : r))
+            return 0;
+    }
+
+    return 1;
+}
+#endif
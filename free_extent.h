@@ -0,0 +1,49 @@
+#ifndef _FREE_EXTENT_H_
+#define _FREE_EXTENT_H_
+
+/* The free-extent index: an address-ordered view of the free blocks of the
+ * buddy allocator, augmented with the maximum order of each subtree, such
+ * that following queries take O(log page_num) time, no matter how many free
+ * blocks there are:
+ *   o. the order of the largest free block (O(1) in fact),
+ *   o. the first free block at or above a given page whose order is no
+ *      less than a given order, and
+ *   o. likewise, the last such block at or below a given page.
+ *
+ *  It is a complete binary tree over the pages (padded to a power of two),
+ * stored implicitly in an array: leaf i is the order of the free block
+ * starting at page i, or INVALID_ORDER if there is none; each inner node
+ * is the maximum of its kids. The free-block trees (free_blks[]) remain the
+ * authority; the index is kept in sync by add_free_block() and
+ * remove_free_block().
+ */
+#include "util.h"
+
+int fe_init(int page_num);
+void fe_fini(void);
+
+/* Record that the free block <blk> has the given order; INVALID_ORDER means
+ * the block is no longer free.
+ */
+void fe_set(page_idx_t blk, int order);
+
+/* Return the order of the largest free block, or INVALID_ORDER if there is
+ * no free block at all.
+ */
+int fe_largest_order(void);
+
+/* Return the first free block starting at or above <from>, and of order no
+ * less than <min_order>; -1 if there is none.
+ */
+page_idx_t fe_find_ge(page_idx_t from, int min_order);
+
+/* Return the last free block starting at or below <from>, and of order no
+ * less than <min_order>; -1 if there is none.
+ */
+page_idx_t fe_find_le(page_idx_t from, int min_order);
+
+#ifdef DEBUG
+int fe_verify(void);
+#endif
+
+#endif /* _FREE_EXTENT_H_ */
@@ -2,6 +2,7 @@
 #define _LJ_MM_H_
 
 #include <stdlib.h> /* for size_t */
+#include <stdint.h> /* for uintptr_t */
 #include <stdio.h>  /* for FILE* */
 
 #ifdef __cplusplus
@@ -23,9 +24,65 @@ typedef enum {
      */
     LM_PREFER_SYS = 3,
 
+    /* Like LM_PREFER_USER, until the chunks are mostly taken, from then on
+     * like LM_PREFER_SYS, unless mmap(2) keeps failing or is getting slow.
+     * The switching is reported by lm_get_mode_stat().
+     */
+    LM_ADAPTIVE = 4,
+
     LM_DEFAULT = LM_USER_MODE
 } ljmm_mode_t;
 
+/* Placement policies, i.e. which free block an allocation is carved from.
+ * See placement.c for details.
+ */
+typedef enum {
+    /* The smallest block big enough; the lowest one among them. */
+    LM_PLACE_LOWEST = 0,
+
+    /* Small blocks from the bottom, large blocks from the top. */
+    LM_PLACE_TWO_SIDED = 1,
+
+    /* Small, medium and large blocks gather around the bottom, the middle
+     * and the top of the chunk respectively.
+     */
+    LM_PLACE_SEGREGATED = 2,
+
+    /* The first block big enough above the previous allocation. */
+    LM_PLACE_NEXT_FIT = 3,
+
+    /* The highest block big enough, carved from its top, so allocations
+     * grow downward, away from the heap.
+     */
+    LM_PLACE_TOP_DOWN = 4,
+
+    LM_PLACE_DEFAULT = LM_PLACE_LOWEST
+} ljmm_placement_t;
+
+/* Page allocators, see ljmm_opt_t::engine */
+typedef enum {
+    /* Buddy blocks, placed by the placement policy */
+    LM_ENGINE_BUDDY = 0,
+
+    /* Two-Level Segregated Fit: the exact number of pages, from free lists
+     * segregated by size, so that an allocation or a free takes a bounded
+     * number of steps. See tlsf.c for details.
+     */
+    LM_ENGINE_TLSF = 1,
+
+    LM_ENGINE_DEFAULT = LM_ENGINE_BUDDY
+} ljmm_engine_t;
+
+/* An address window [start, end) to reserve a chunk in. A zero <start>
+ * stands for the current program break, i.e. sbrk(0).
+ */
+typedef struct {
+    uintptr_t start;
+    uintptr_t end;
+} ljmm_window_t;
+
+#define LM_MAX_WINDOW 4
+
 /* Additional options, primiarilly for debugging purpose */
 typedef struct {
     ljmm_mode_t mode;
@@ -42,8 +99,89 @@ typedef struct {
     /* Tweak block-cache, currently not enabled */
     int enable_block_cache;
     int blk_cache_in_page;
+
+    /* The placement policy, and the order (in pages) from which on a
+     * request is considered large by the policy.
+     */
+    ljmm_placement_t placement;
+    int large_order;
+
+    /* The address windows to reserve chunks in. If <window_num> is 0, the
+     * default applies: [sbrk(0), 2G) in LM_USER_MODE, [sbrk(0), 1G) in other
+     * modes. A window above 2G, e.g. [2G, 4G), serves the requests made with
+     * LM_MAP_4G only, so the space below 2G is saved for MAP_32BIT. From
+     * the lowest start through the highest end, the windows span no more
+     * than 2^20 pages (4G with 4K pages); lm_init2() fails otherwise.
+     */
+    int window_num;
+    ljmm_window_t windows[LM_MAX_WINDOW];
+
+    /* If set, every unmapped hole in the windows (see /proc/self/maps) is
+     * reserved as a chunk of its own, rather than one chunk per window. In
+     * this case, the default window starts from mmap_min_addr, so that
+     * the holes below the executable are used as well.
+     */
+    int harvest_holes;
+
+    /* If non-zero, as many bytes right above sbrk(0) are left to the heap,
+     * i.e. the chunk around sbrk(0) does not take them until it runs out of
+     * space above; its lower boundary then grows downward on demand. Best
+     * used with LM_PLACE_TOP_DOWN.
+     */
+    size_t brk_gap;
+
+    /* If set, the chunks are reserved with PROT_NONE and MAP_NORESERVE, and
+     * the pages are committed (made accessible) as they are allocated, and
+     * decommitted as the block cache purges them. This is for the hosts
+     * with strict overcommit (vm.overcommit_memory=2), where reserving 2G
+     * readable and writable would be charged in full. Note that the brk gap
+     * is committed as it is mapped.
+     */
+    int reserve_only;
+
+    /* If non-zero, the requests of this order (in pages) or above are
+     * served in the exact number of pages, rather than in buddy blocks, by
+     * the extent allocator. It manages a region of <extent_size> bytes at
+     * the top of the pages below 2G (or of all the pages if none is below
+     * 2G); by default, a quarter of them. The requests fall back to the
+     * buddy blocks when the region runs out of space.
+     */
+    int extent_order;
+    size_t extent_size;
+
+    /* The page allocator. With LM_ENGINE_TLSF, the pages below 2G (or all
+     * the pages if none is below 2G) are managed by TLSF, and those above
+     * 2G remain buddy blocks; <placement>, <extent_order> and <extent_size>
+     * do not apply to the former.
+     */
+    ljmm_engine_t engine;
+
+    /* The buddy blocks of the orders below 8 (in pages) are not merged with
+     * their buddies as they are freed, but held in a quick-list per order,
+     * up to this many (at most 16) each, and handed out as they are to the
+     * next requests of the same order. They are merged only if an
+     * allocation would fail otherwise. 0 disables the quick-lists, as does
+     * a positive <dbg_alloc_page_num>.
+     */
+    int quick_list_len;
+
+    /* If set (the default), a free block taken for a smaller request is
+     * split lazily: only the part allocated is split off, and the rest of
+     * the block is carved from, from the lower end, by the requests that
+     * follow, as long as the placement would take it anyway. The free
+     * blocks a split would leave are added only as the carving skips them,
+     * or the block is needed otherwise. It applies to LM_PLACE_LOWEST
+     * alone, and not with a positive <dbg_alloc_page_num>.
+     */
+    int lazy_split;
 } ljmm_opt_t;
 
+/* lm_mmap() flag, in lieu of MAP_32BIT: the mapping needs to reside below 4G
+ * rather than below 2G. It is served from the chunks above 2G if there are
+ * any, and from those below 2G otherwise.
+ */
+#define LM_MAP_4G 0x1000000
+
 /* All exported symbols are prefixed with ljmm_ to reduce the chance of
  * conflicting with applications being benchmarked.
  */
@@ -52,12 +190,22 @@ typedef struct {
 #define lm_init2        ljmm_init2
 #define lm_fini         ljmm_fini
 #define lm_mmap         ljmm_mmap
+#define lm_mmap_ex      ljmm_mmap_ex
+#define lm_mmap_aligned ljmm_mmap_aligned
 #define lm_munmap       ljmm_munmap
 #define lm_mremap       ljmm_mremap
 #define lm_malloc       ljmm_malloc
+#define lm_calloc       ljmm_calloc
 #define lm_free         ljmm_free
 #define lm_get_status   ljmm_get_status
 #define lm_free_status  ljmm_free_status
+#define lm_largest_free ljmm_largest_free
+#define lm_set_pressure_callback ljmm_set_pressure_callback
+#define lm_get_mode_stat ljmm_get_mode_stat
+#define lm_get_buddy_stat ljmm_get_buddy_stat
+#define lm_get_profile  ljmm_get_profile
+#define lm_reset_profile ljmm_reset_profile
+#define lm_dump_profile ljmm_dump_profile
 
 #ifdef BUILDING_LIB
     #define LJMM_EXPORT __attribute__ ((visibility ("protected")))
@@ -77,6 +225,22 @@ void lm_fini(void) LJMM_EXPORT;
 void *lm_mmap(void *addr, size_t length, int prot, int flags,
               int fd, off_t offset) LJMM_EXPORT;
 
+/* Same as lm_mmap(), and in addition, <*zeroed> (if not NULL) is set if the
+ * mapping is known to be all zero, as a fresh mmap(2) mapping is, or cleared
+ * if it may hold the data of a previous mapping.
+ */
+void *lm_mmap_ex(void *addr, size_t length, int prot, int flags,
+                 int fd, off_t offset, int* zeroed) LJMM_EXPORT;
+
+/* Map <length> bytes of anonymous, private, read-write memory at an address
+ * that is a multiple of <alignment>, a power of 2. <flags> are those of
+ * lm_mmap(), MAP_32BIT or LM_MAP_4G included. The block is carved from a
+ * free block that is aligned already, so there is no padding to waste; an
+ * alignment above the largest block fails with EINVAL. Unmap it with
+ * lm_munmap() as usual.
+ */
+void *lm_mmap_aligned(size_t length, size_t alignment, int flags) LJMM_EXPORT;
+
 int lm_munmap(void *addr, size_t length) LJMM_EXPORT;
 void* lm_mremap(void* old_addr, size_t old_size, size_t new_size, int flags) LJMM_EXPORT;
 
@@ -84,6 +248,41 @@ void* lm_mremap(void* old_addr, size_t old_size, size_t new_size, int flags) LJM
 void* lm_malloc(size_t sz) LJMM_EXPORT;
 int lm_free(void* mem) LJMM_EXPORT;
 
+/* Like lm_malloc(), but the block is zero-filled. Only the blocks which may
+ * hold stale data are actually cleared.
+ */
+void* lm_calloc(size_t sz) LJMM_EXPORT;
+
+/* Return the size of the largest block lm_malloc() can allocate right now,
+ * or 0 if the user-mode allocator is exhausted or not initialized. It takes
+ * constant time, so it is cheap enough to check the headroom before each
+ * allocation. With LM_ENGINE_TLSF, a block of the size returned can be
+ * allocated, but the largest one may be up to 1/16 bigger.
+ */
+size_t lm_largest_free(void) LJMM_EXPORT;
+
+/* Low-memory notifications of the user-mode allocator */
+typedef enum {
+    LM_PRESSURE_LOW,    /* The largest free block is below the threshold */
+    LM_PRESSURE_FAIL,   /* An allocation is about to fail */
+} ljmm_pressure_t;
+
+/* <size> is that of the allocation which runs into the pressure. */
+typedef void (*ljmm_pressure_cb_t)(ljmm_pressure_t level, size_t size,
+                                   void* ud);
+
+/* Have <cb> called with <ud> under memory pressure; NULL <cb> removes the
+ * callback. Before an allocation fails, <cb> is called with
+ * LM_PRESSURE_FAIL, and the allocation is retried once it returns, so that
+ * the host can turn the failure into a pause by freeing memory, say, with a
+ * full GC cycle. LM_PRESSURE_LOW is reported after an allocation leaves the
+ * largest free block (see lm_largest_free()) below <threshold> bytes, and
+ * is not reported again until the largest block is back to <threshold>.
+ * <cb> may allocate and free memory, but is not called recursively.
+ */
+void lm_set_pressure_callback(ljmm_pressure_cb_t cb, void* ud,
+                              size_t threshold) LJMM_EXPORT;
+
 /* Testing/Debugging Support */
 typedef struct {
     int page_idx;
@@ -97,17 +296,93 @@ typedef struct {
     int free_blk_num;
     int alloc_blk_num;
     int idx_to_id;
-    block_info_t* free_blk_info;
-    block_info_t* alloc_blk_info;
+    block_info_t* free_blk_info;    /* by order, then by page_idx */
+    block_info_t* alloc_blk_info;   /* by page_idx */
 } lm_status_t;
 
+/* The blocks as they are: lm_get_status() leaves the allocator's state
+ * alone, so the free blocks in the quick-lists and at the frontier (see
+ * ljmm_opt_t) are reported unmerged.
+ */
 const lm_status_t* lm_get_status(void) LJMM_EXPORT;
 void lm_free_status(lm_status_t*) LJMM_EXPORT;
 
+/* The mappings made with mmap(2) in the modes other than LM_USER_MODE, and
+ * the state of LM_ADAPTIVE. The latency is a moving average, in the units
+ * of lm_get_profile().
+ */
+typedef struct {
+    int prefer_sys;             /* LM_ADAPTIVE tries mmap(2) first */
+    unsigned long switch_num;   /* LM_ADAPTIVE changed its preference */
+    unsigned long sys_map_num;  /* The mmap(2) mappings alive */
+    size_t sys_map_bytes;
+    unsigned long sys_fail_num; /* mmap(2) failed */
+    unsigned long neg_hit_num;  /* mmap(2) skipped after a recent failure */
+    unsigned long long sys_cost;  /* mmap(2) */
+} ljmm_mode_stat_t;
+
+const ljmm_mode_stat_t* lm_get_mode_stat(void) LJMM_EXPORT;
+
+/* The churn of the buddy allocator, see ljmm_opt_t::quick_list_len and
+ * ljmm_opt_t::lazy_split.
+ */
+typedef struct {
+    unsigned long split_num;    /* A free block is split into halves */
+    unsigned long merge_num;    /* A free block is merged with its buddy */
+    unsigned long quick_hit_num;  /* An allocation is served by a quick-list */
+    unsigned long quick_flush_num;/* The quick-lists are merged on demand */
+    unsigned long lazy_carve_num; /* An allocation is carved from the rest of
+                                   * a block split lazily */
+} ljmm_buddy_stat_t;
+
+const ljmm_buddy_stat_t* lm_get_buddy_stat(void) LJMM_EXPORT;
+
 #ifdef DEBUG
 void dump_page_alloc(FILE*) LJMM_EXPORT;
 #endif
 
+/* Latency histograms, available if the lib is built with -DLJMM_PROFILE.
+ * Latencies are measured in cycles on x86, and in nanoseconds elsewhere.
+ */
+typedef enum {
+    /* Exported functions */
+    LM_PROF_MMAP,
+    LM_PROF_MUNMAP,
+    LM_PROF_MREMAP,
+    LM_PROF_MALLOC,
+    LM_PROF_FREE,
+
+    /* Internal phases */
+    LM_PROF_TREE_OP,        /* rbt_insert(), rbt_delete() */
+    LM_PROF_TREE_RESIZE,    /* growing the rb-tree's node storage */
+    LM_PROF_SPLIT,          /* splitting a free block on allocation */
+    LM_PROF_MERGE,          /* coalescing buddies on deallocation */
+    LM_PROF_BC_EVICT,       /* evicting a block from the block-cache */
+    LM_PROF_MADVISE,
+
+    LM_PROF_NUM
+} lm_prof_id_t;
+
+/* Bucket i counts the latencies in [2^i, 2^(i+1)). */
+#define LM_PROF_BUCKET_NUM 48
+
+typedef struct {
+    unsigned long long count;
+    unsigned long long total;
+    unsigned long long max;
+    unsigned long long buckets[LM_PROF_BUCKET_NUM];
+} lm_prof_hist_t;
+
+typedef struct {
+    lm_prof_hist_t hist[LM_PROF_NUM];
+} lm_profile_t;
+
+#ifdef LJMM_PROFILE
+const lm_profile_t* lm_get_profile(void) LJMM_EXPORT;
+void lm_reset_profile(void) LJMM_EXPORT;
+void lm_dump_profile(FILE*) LJMM_EXPORT;
+#endif
+
 #ifdef __cplusplus
 }
 #endif
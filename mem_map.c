@@ -1,15 +1,19 @@
 /* This file contains the implementation to following exported functions:
- *   lm_mmap(), lm_munmap(), lm_mremap(), lm_malloc(), lm_free().
+ *   lm_mmap(), lm_mmap_aligned(), lm_munmap(), lm_mremap(), lm_malloc(),
+ *   lm_free().
  */
 #ifndef _GNU_SOURCE
     #define _GNU_SOURCE
 #endif
 #include <sys/mman.h>
 #include <errno.h>
+#include <unistd.h> /* for sysconf() */
 #include <string.h> /* for memcpy() */
 #include "page_alloc.h"
 #include "rbtree.h"
 #include "lj_mm.h"
+#include "profile.h"
+#include "sys_map.h"
 
 /* Forward Decl */
 static int lm_unmap_helper(void* addr, size_t um_size);
@@ -22,70 +26,249 @@ lm_init_mm_opt(ljmm_opt_t* opt) {
     opt->dbg_alloc_page_num = -1;
     opt->enable_block_cache = 0;
     opt->blk_cache_in_page = 0;
+    opt->placement = LM_PLACE_DEFAULT;
+    opt->large_order = 8; /* i.e. 1M with 4k page */
+    opt->window_num = 0;
+    opt->harvest_holes = 0;
+    opt->brk_gap = 0;
+    opt->reserve_only = 0;
+    opt->extent_order = 0;
+    opt->extent_size = 0;
+    opt->engine = LM_ENGINE_DEFAULT;
+    opt->quick_list_len = 4;
+    opt->lazy_split = 1;
 }
 
-/* For allocating "big" blocks (about one page in size, or across multiple
- * pages). The return value is page-aligned.
+/* Allocate a block from the free blocks starting in the pages [lo, hi).
+ * Return NULL if there is none big enough. The block is aligned to
+ * <alignment>, a power of 2, if it is above the page size. <*dirty> is set
+ * if the block may not be all zero.
  */
-void*
-lm_malloc(size_t sz) {
-    errno = 0;
-    if (!alloc_info) {
-        lm_init();
-        if (!alloc_info)
-            return NULL;
-    }
-
+static void*
+alloc_in_range(size_t sz, size_t alignment, page_idx_t lo, page_idx_t hi,
+               int* dirty) {
     /* Determine the order of allocation request */
     int req_order = ceil_log2_int32(sz);
     req_order -= alloc_info->page_size_log2;
     if (req_order < 0)
         req_order = 0;
 
-    int max_order = alloc_info->max_order;
-    if (req_order > max_order) {
+    /* A block is aligned to its own size; only a bigger alignment needs a
+     * block picked for it.
+     */
+    int align_order = 0;
+    if (alignment > (size_t)alloc_info->page_size)
+        align_order = __builtin_ctzl(alignment) - alloc_info->page_size_log2;
+
+    /* Large requests, or any with LM_ENGINE_TLSF, are served by the extent
+     * allocator while its region has room.
+     */
+    if (extent_info && req_order >= extent_info->order &&
+        extent_info->start >= lo && extent_info->end <= hi) {
+        page_idx_t ext = ext_alloc(sz, align_order, dirty);
+        if (ext >= 0)
+            return get_page_addr(ext);
+    }
+
+    if (align_order > alloc_info->addr_align_order) {
+        errno = EINVAL;
+        return 0;
+    }
+
+    /* A block of the very order freed recently is reused as it is. */
+    if (req_order < QL_ORDER_NUM && align_order <= req_order) {
+        page_idx_t blk = ql_pop(req_order, lo, hi);
+        if (blk >= 0) {
+            *dirty = 1;
+            (void)add_alloc_block(blk, sz, req_order);
+            return get_page_addr(blk);
+        }
+    }
+
+    /* Failing that, the request is carved from the rest of the block split
+     * lazily, if the placement would pick it anyway.
+     */
+    int lazy_split = alloc_info->lazy_split && align_order <= req_order;
+    if (lazy_split) {
+        page_idx_t blk = fr_carve(req_order, lo, hi, dirty);
+        if (blk >= 0) {
+            (void)add_alloc_block(blk, sz, req_order);
+            return get_page_addr(blk);
+        }
+    } else {
+        /* lm_pick_aligned() sees the free blocks only, not the frontier. */
+        fr_flush();
+    }
+
+    /* Bail out early if no free block is big enough */
+    if (req_order > fe_largest_order() || lo >= hi) {
         errno = ENOMEM;
         return 0;
     }
 
-    rb_tree_t* free_blks = alloc_info->free_blks;
+    int blk_order, upper;
+    page_idx_t blk_idx;
+    while (1) {
+        if (align_order > req_order) {
+            blk_idx = lm_pick_aligned(req_order, align_order, lo, hi,
+                                      &blk_order);
+            upper = 0;
+        } else {
+            blk_idx = alloc_info->placement->pick(req_order, lo, hi,
+                                                  &blk_order, &upper);
+        }
+        if (blk_idx == -1) {
+            errno = ENOMEM;
+            return NULL;
+        }
 
-    int i, blk_order = -1;
-    page_idx_t blk_idx = -1;
+        /* The part to carve may be in the brk gap, which is yet to map. */
+        page_idx_t carve = blk_idx;
+        if (upper)
+            carve += (1 << blk_order) - (1 << req_order);
 
-    /* Find the smallest available block big enough to accommodate the
-     * allocation request.
-     */
-    for (i = req_order; i <= max_order; i++) {
-        rb_tree_t* rbt = free_blks + i;
-        if (!rbt_is_empty(rbt)) {
-            blk_idx = rbt_get_min(rbt);
-            blk_order = i;
+        lm_chunk_t* lazy = lm_lazy_chunk;
+        if (likely(lm_map_chunk(get_page_addr(carve))))
             break;
-        }
+
+        /* The heap has taken the gap; give up the rest of it for good. */
+        retire_free_pages(page_addr_to_idx(lazy->base),
+                          page_addr_to_idx(lazy->low));
     }
 
-    if (blk_idx == -1)
+    if (!cm_commit(upper ? blk_idx + (1 << blk_order) - (1 << req_order)
+                         : blk_idx, 1 << req_order)) {
+        errno = ENOMEM;
         return NULL;
+    }
+
+    *dirty = is_dirty_blk(alloc_info->page_info + blk_idx);
+
+    /* The free block may be too big. If this is the case, split it until it
+     * tightly fits the allocation request, lazily if it may.
+     */
+    if (lazy_split && !upper && blk_order > req_order &&
+        alloc_info->fr_blk < 0) {
+        blk_idx = lazy_split_free_block(blk_idx, blk_order, req_order);
+    } else {
+        blk_idx = split_free_block(blk_idx, blk_order, req_order, upper);
+    }
+    (void)add_alloc_block(blk_idx, sz, req_order);
+    return get_page_addr(blk_idx);
+}
 
-    remove_free_block(blk_idx, blk_order, 0);
+/* Allocate a block below 2G, or below 4G if <below_4g> is set, in which case
+ * the chunks above 2G are tried first. See alloc_in_range() for <alignment>
+ * and <dirty>.
+ */
+static void*
+alloc_below_4g(size_t sz, size_t alignment, int below_4g, int* dirty) {
+    if (below_4g) {
+        void* p = alloc_in_range(sz, alignment, alloc_info->low_limit,
+                                 alloc_info->page_num, dirty);
+        if (p)
+            return p;
+        errno = 0;
+    }
+
+    void* p = alloc_in_range(sz, alignment, 0, alloc_info->low_limit, dirty);
 
-    /* The free block may be too big. If this is the case, keep splitting
-     * the block until it tightly fit the allocation request.
+    /* The blocks held in the quick-lists may merge into one big enough, and
+     * those at the frontier are seen by any placement once split off.
      */
-    int bo = blk_order;
-    while (bo > req_order) {
-        bo --;
-        int split_block = blk_idx + (1 << bo);
-        add_free_block(split_block, bo);
+    if (!p && errno == ENOMEM && (ql_flush() || fr_flush())) {
+        errno = 0;
+        p = alloc_below_4g(sz, alignment, below_4g, dirty);
+    }
+    return p;
+}
+
+/* See lm_set_pressure_callback() */
+static ljmm_pressure_cb_t pressure_cb;
+static void* pressure_ud;
+static size_t pressure_threshold;
+static int pressure_low;    /* The largest free block is below the threshold */
+static int in_pressure_cb;
+
+void
+lm_set_pressure_callback(ljmm_pressure_cb_t cb, void* ud, size_t threshold) {
+    pressure_cb = cb;
+    pressure_ud = ud;
+    pressure_threshold = threshold;
+    pressure_low = 0;
+}
+
+static void
+report_pressure(ljmm_pressure_t level, size_t sz) {
+    int saved_errno = errno;
+    in_pressure_cb = 1;
+    pressure_cb(level, sz, pressure_ud);
+    in_pressure_cb = 0;
+    errno = saved_errno;
+}
+
+/* Same as alloc_below_4g(), with the low-memory state reported to the
+ * pressure callback, if any.
+ */
+static void*
+malloc_helper(size_t sz, size_t alignment, int below_4g, int* dirty) {
+    errno = 0;
+    if (!alloc_info) {
+        lm_init();
+        if (!alloc_info)
+            return NULL;
+    }
+
+    void* p = alloc_below_4g(sz, alignment, below_4g, dirty);
+    if (likely(!pressure_cb) || in_pressure_cb)
+        return p;
+
+    /* The host may well free enough memory, say, with a full GC cycle. */
+    int failed = !p && errno == ENOMEM;
+    if (failed) {
+        report_pressure(LM_PRESSURE_FAIL, sz);
+        errno = 0;
+        p = alloc_below_4g(sz, alignment, below_4g, dirty);
     }
 
-    (void)add_alloc_block(blk_idx, sz, bo);
-    return alloc_info->first_page + (blk_idx << alloc_info->page_size_log2);
+    /* LM_PRESSURE_LOW is reported once, until the pressure is relieved. A
+     * failure just reported implies it.
+     */
+    int low = lm_largest_free() < pressure_threshold;
+    if (low && !pressure_low && !failed)
+        report_pressure(LM_PRESSURE_LOW, sz);
+    pressure_low = low;
+
+    return p;
+}
+
+/* For allocating "big" blocks (about one page in size, or across multiple
+ * pages). The return value is page-aligned, and below 2G.
+ */
+void*
+lm_malloc(size_t sz) {
+    LM_PROF_SCOPE(LM_PROF_MALLOC);
+
+    int dirty;
+    return malloc_helper(sz, 0, 0, &dirty);
+}
+
+void*
+lm_calloc(size_t sz) {
+    LM_PROF_SCOPE(LM_PROF_MALLOC);
+
+    int dirty;
+    void* p = malloc_helper(sz, 0, 0, &dirty);
+    if (p && dirty)
+        memset(p, 0, sz);
+
+    return p;
 }
 
 int
 lm_free(void* mem) {
+    LM_PROF_SCOPE(LM_PROF_FREE);
+
     if (unlikely (!alloc_info))
         return 0;
 
@@ -104,6 +287,9 @@ lm_free(void* mem) {
     if (unlikely(page_idx >= page_num))
         return 0;
 
+    if (ext_in_region(page_idx))
+        return ext_free(page_idx);
+
     lm_page_t* pi = alloc_info->page_info;
     lm_page_t* page = pi + page_idx;
 
@@ -117,6 +303,15 @@ lm_free(void* mem) {
     return free_block(page_idx);
 }
 
+/* mlock() the newly allocated block at <p>, and flag it so that the pages
+ * are unlocked as they are unmapped.
+ */
+static void
+lock_block(char* p, size_t len) {
+    if (!mlock(p, len))
+        set_locked_blk(alloc_info->page_info + page_addr_to_idx(p));
+}
+
 /*****************************************************************************
  *
  *      Implementation of lm_mremap()
@@ -124,6 +319,54 @@ lm_free(void* mem) {
  *****************************************************************************
  */
 
+/* Move the block at <old_addr> to a new block of <new_size> bytes. */
+static void*
+move_block(void* old_addr, size_t old_size, size_t new_size) {
+    page_idx_t page_idx = page_addr_to_idx(old_addr);
+    int locked = is_locked_blk(alloc_info->page_info + page_idx);
+
+    /* Stay on the same side of 2G as the old block */
+    int dirty;
+    char* p = malloc_helper(new_size, 0, page_idx >= alloc_info->low_limit,
+                            &dirty);
+    if (!p) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memcpy(p, old_addr, old_size);
+    if (locked)
+        lock_block(p, new_size);
+    lm_free(old_addr);
+    return p;
+}
+
+/* The part of lm_mremap_helper() for the extents, see extent.h */
+static void*
+ext_mremap_helper(void* old_addr, size_t old_size, size_t new_size,
+                  int flags) {
+    page_idx_t page_idx = page_addr_to_idx(old_addr);
+    if (ext_size(page_idx) != (intptr_t)old_size || !new_size) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    int locked = is_locked_blk(alloc_info->page_info + page_idx);
+    size_t page_mask = alloc_info->page_size - 1;
+    size_t old_len = (old_size + page_mask) & ~page_mask;
+    size_t new_len = (new_size + page_mask) & ~page_mask;
+    if (ext_resize(page_idx, new_size)) {
+        if (locked && new_len > old_len)
+            mlock((char*)old_addr + old_len, new_len - old_len);
+        return old_addr;
+    }
+
+    if (flags & MREMAP_MAYMOVE)
+        return move_block(old_addr, old_size, new_size);
+
+    errno = ENOMEM;
+    return NULL;
+}
+
 /* lm_mremap() herlper. Return NULL instead of MAP_FAILED in case it was not
  * successful. It also tries to set errno if fails.
  */
@@ -145,6 +388,9 @@ lm_mremap_helper(void* old_addr, size_t old_size, size_t new_size, int flags) {
 
     int page_sz_log2 = alloc_info->page_size_log2;
     int page_idx = ofst >> page_sz_log2;
+    if (ext_in_region(page_idx))
+        return ext_mremap_helper(old_addr, old_size, new_size, flags);
+
     intptr_t size_verify;
     rb_tree_t* rbt = &alloc_info->alloc_blks;
     if (!rbt_search(rbt, page_idx, &size_verify) || size_verify != old_size) {
@@ -159,7 +405,7 @@ lm_mremap_helper(void* old_addr, size_t old_size, size_t new_size, int flags) {
      *      mapping pages.
      */
     if (old_page_num > new_page_num) {
-        char* unmap_start = old_addr + (new_page_num << page_sz_log2);
+        char* unmap_start = old_addr + ((size_t)new_page_num << page_sz_log2);
         size_t unmap_len = old_size - (((size_t)new_page_num) << page_sz_log2);
         if (lm_unmap_helper(unmap_start, unmap_len)) {
             rbt_set_value(rbt, page_idx, new_size);
@@ -172,27 +418,28 @@ lm_mremap_helper(void* old_addr, size_t old_size, size_t new_size, int flags) {
     /* case 2: Expand the existing allocated block by adding more pages. */
     if (old_page_num < new_page_num) {
         int order = alloc_info->page_info[page_idx].order;
+        int locked = is_locked_blk(alloc_info->page_info + page_idx);
+        char* old_end = old_addr + ((size_t)old_page_num << page_sz_log2);
+        size_t grow_len = (size_t)(new_page_num - old_page_num) << page_sz_log2;
+
         /* Block is big enough to accommodate the old-size byte.*/
         if (new_page_num < (1<<order)) {
             rbt_set_value(rbt, page_idx, new_size);
+            if (locked)
+                mlock(old_end, grow_len);
             return old_addr;
         }
 
         /* Try to merge with the buddy block */
-        if (extend_alloc_block(page_idx, new_size))
+        if (extend_alloc_block(page_idx, new_size)) {
+            if (locked)
+                mlock(old_end, grow_len);
             return old_addr;
-
-        if (flags & MREMAP_MAYMOVE) {
-            char* p = lm_malloc(new_size);
-            if (!p) {
-                errno = ENOMEM;
-                return NULL;
-            }
-            memcpy(p, old_addr, old_size);
-            lm_free(old_addr);
-            return p;
         }
 
+        if (flags & MREMAP_MAYMOVE)
+            return move_block(old_addr, old_size, new_size);
+
         errno = EINVAL;
         return NULL;
     }
@@ -209,8 +456,10 @@ lm_mremap_helper(void* old_addr, size_t old_size, size_t new_size, int flags) {
 
 void*
 lm_mremap(void* old_addr, size_t old_size, size_t new_size, int flags) {
+    LM_PROF_SCOPE(LM_PROF_MREMAP);
+
     if (!lm_in_chunk_range(old_addr)) {
-        return mremap(old_addr, old_size, new_size, flags);
+        return sm_mremap(old_addr, old_size, new_size, flags);
     }
 
     void* res = lm_mremap_helper(old_addr, old_size, new_size, flags);
@@ -230,8 +479,16 @@ typedef struct {
     int um_page_idx;    /* The index of the 1st page to be unmapped*/
     int um_end_idx;
     size_t m_size;      /* The mmap size in byte.*/
+    int locked;         /* The mapped block is mlock()ed */
 } unmap_info_t;
 
+/* munlock() the pages [start, end) */
+static void
+unlock_pages(page_idx_t start, page_idx_t end) {
+    munlock(get_page_addr(start),
+            (size_t)(end - start) << alloc_info->page_size_log2);
+}
+
 static int
 unmap_lower_part(const unmap_info_t* ui) {
     int order       = ui->order;
@@ -244,7 +501,7 @@ unmap_lower_part(const unmap_info_t* ui) {
     int split = 0;
 
     /* Step 1: Try to deallocate leading free blocks */
-    while(1) {
+    while(new_ord > 0) {
         int first_valid_page = um_end_idx + 1;
         int half_blk_ord = new_ord - 1;
 
@@ -265,6 +522,9 @@ unmap_lower_part(const unmap_info_t* ui) {
     if (!split)
         return 0;
 
+    if (ui->locked)
+        unlock_pages(m_page_idx, um_end_idx + 1);
+
     remove_alloc_block(m_page_idx);
 
     /* Step 2: Try the shrink the trailing block */
@@ -282,8 +542,11 @@ unmap_lower_part(const unmap_info_t* ui) {
     }
 
     size_t new_map_sz = ui->m_size;
-    new_map_sz -= ((new_page_idx - m_page_idx) << alloc_info->page_size_log2);
+    new_map_sz -= (size_t)(new_page_idx - m_page_idx) <<
+                  alloc_info->page_size_log2;
     add_alloc_block(new_page_idx, new_map_sz, new_ord);
+    if (ui->locked)
+        set_locked_blk(alloc_info->page_info + new_page_idx);
 
     return 1;
 }
@@ -303,8 +566,12 @@ unmap_higher_part(const unmap_info_t* ui) {
     }
 
     if (split) {
-        int new_sz;
-        new_sz = (um_page_idx - m_page_idx) << alloc_info->page_size_log2;
+        if (ui->locked)
+            unlock_pages(um_page_idx, ui->um_end_idx + 1);
+
+        size_t new_sz;
+        new_sz = (size_t)(um_page_idx - m_page_idx) <<
+                 alloc_info->page_size_log2;
         migrade_alloc_block(m_page_idx, order, new_ord, new_sz);
     }
 
@@ -326,6 +593,8 @@ lm_unmap_helper(void* addr, size_t um_size) {
 
     /* The index of the first page of the area to be unmapped. */
     long um_page_idx = ofst >> log2_int32(page_sz);
+    if (ext_in_region(um_page_idx))
+        return ext_unmap(um_page_idx, um_size);
 
     /* step 2: Find the previously mmapped blk which cover the unmapped area.*/
     intptr_t m_size;
@@ -371,6 +640,7 @@ lm_unmap_helper(void* addr, size_t um_size) {
     ui.um_page_idx = um_page_idx;
     ui.um_end_idx = um_end_idx;
     ui.m_size = m_size;
+    ui.locked = is_locked_blk(alloc_info->page_info + m_page_idx);
 
     /* case 1: unmap lower portion */
     if (m_page_idx == um_page_idx)
@@ -386,12 +656,14 @@ lm_unmap_helper(void* addr, size_t um_size) {
 
 int
 lm_munmap(void* addr, size_t length) {
+    LM_PROF_SCOPE(LM_PROF_MUNMAP);
+
     /* Step 1: see if the addr is allocated via mmap(2). If so, we need to
      *  unmap it with munmap(2).
      */
     if (!lm_in_chunk_range(addr)) {
         if (ljmm_mode != LM_USER_MODE)
-            return munmap(addr, length);
+            return sm_munmap(addr, length);
 
         errno = EINVAL;
         return -1;
@@ -419,39 +691,170 @@ lm_munmap(void* addr, size_t length) {
  *
  *****************************************************************************
  */
+#ifndef MADV_POPULATE_WRITE
+    #define MADV_POPULATE_WRITE 23
+#endif
+
+/* Fault in the pages of [p, p + len) for write, so that the first touch does
+ * not fault on the request path.
+ */
+static void
+populate_pages(char* p, size_t len) {
+    if (!madvise(p, len, MADV_POPULATE_WRITE))
+        return;
+
+    /* The kernel predates MADV_POPULATE_WRITE (5.14). Write to each page,
+     * keeping its content.
+     */
+    size_t page_sz = alloc_info->page_size;
+    volatile char* v = p;
+    size_t i;
+    for (i = 0; i < len; i += page_sz)
+        v[i] = v[i];
+}
+
+/* Return 1 if lm_mmap() is to try mmap(2) before the user-mode allocator */
+static int
+prefer_sys_mode(void) {
+    switch (ljmm_mode) {
+    case LM_SYS_MODE:
+    case LM_PREFER_SYS:
+        return 1;
+    case LM_ADAPTIVE:
+        return sm_prefer_sys();
+    default:
+        return 0;
+    }
+}
+
+/* The user-mode part of lm_mmap_ex() and lm_mmap_aligned(). Return NULL if
+ * the request cannot be served.
+ */
+static void*
+user_mmap(size_t length, size_t alignment, int flags, int* zeroed) {
+    int dirty;
+    char* p = malloc_helper(length, alignment, !(flags & MAP_32BIT), &dirty);
+    if (!p)
+        return NULL;
+
+    if (zeroed)
+        *zeroed = !dirty;
+
+    /* As with mmap(2), both are best effort. MAP_NORESERVE needs no action:
+     * the chunk is either charged already, or committed on allocation (see
+     * commit.c).
+     */
+    if (flags & MAP_LOCKED)
+        lock_block(p, length);
+    else if (flags & MAP_POPULATE)
+        populate_pages(p, length);
+    return p;
+}
+
 void*
 lm_mmap(void *addr, size_t length, int prot, int flags,
         int fd, off_t offset) {
+    return lm_mmap_ex(addr, length, prot, flags, fd, offset, NULL);
+}
+
+void*
+lm_mmap_ex(void *addr, size_t length, int prot, int flags,
+           int fd, off_t offset, int* zeroed) {
+    LM_PROF_SCOPE(LM_PROF_MMAP);
+
+    /* Fresh mappings of mmap(2) are zero-filled */
+    if (zeroed)
+        *zeroed = 1;
 
     if (addr /* we completely ignore hint */ ||
         fd != -1 /* Only support anonymous mapp */ ||
-        !(flags & MAP_32BIT) /* Otherwise, directly use mmap(2) */ ||
+        /* Otherwise, directly use mmap(2) */
+        !(flags & (MAP_32BIT | LM_MAP_4G)) ||
         !length ||
         (flags & MAP_FIXED) /* not suppoted*/) {
         errno = EINVAL;
         return MAP_FAILED;
     }
 
+    /* mmap(2) has no notion of 4G; the best it can do is 2G. */
+    int sys_flags = (flags & ~LM_MAP_4G) | MAP_32BIT;
+
     void *p = NULL;
-    if (ljmm_mode == LM_PREFER_SYS || ljmm_mode == LM_SYS_MODE) {
-        p = mmap(addr, length, prot, flags, fd, offset);
+    int prefer_sys = prefer_sys_mode();
+    if (prefer_sys) {
+        p = sm_mmap(length, prot, sys_flags, ljmm_mode != LM_SYS_MODE);
         if (p != MAP_FAILED || ljmm_mode == LM_SYS_MODE)
             return p;
     }
 
     /* deal with user-mode/prefer-user-mode */
-    p = lm_malloc(length);
-    if (p != MAP_FAILED)
+    p = user_mmap(length, 0, flags, zeroed);
+    if (p)
         return p;
 
-    if (ljmm_mode != LM_USER_MODE) {
-        ASSERT(ljmm_mode == LM_PREFER_USER);
-        return mmap(addr, length, prot, flags, fd, offset);
-    }
+    if (ljmm_mode != LM_USER_MODE && !prefer_sys)
+        return sm_mmap(length, prot, sys_flags, 0);
 
     return  MAP_FAILED;
 }
 
+/* mmap(2) aligns to the page size only. Map <alignment> more than needed,
+ * and trim both ends.
+ */
+static void*
+sys_mmap_aligned(size_t length, size_t alignment, int flags, int fallback) {
+    size_t page_sz = sysconf(_SC_PAGESIZE);
+    int prot = PROT_READ | PROT_WRITE;
+    length = (length + page_sz - 1) & ~(page_sz - 1);
+    if (alignment <= page_sz)
+        return sm_mmap(length, prot, flags, fallback);
+
+    size_t map_len = length + alignment - page_sz;
+    char* p = sm_mmap(map_len, prot, flags, fallback);
+    if (p == MAP_FAILED)
+        return p;
+
+    char* q = (char*)(((uintptr_t)p + alignment - 1) & ~(alignment - 1));
+    if (q != p)
+        sm_munmap(p, q - p);
+    if (q + length != p + map_len)
+        sm_munmap(q + length, p + map_len - (q + length));
+    return q;
+}
+
+void*
+lm_mmap_aligned(size_t length, size_t alignment, int flags) {
+    LM_PROF_SCOPE(LM_PROF_MMAP);
+
+    if (!length || (alignment & (alignment - 1)) ||
+        !(flags & (MAP_32BIT | LM_MAP_4G)) ||
+        (flags & (MAP_FIXED | MAP_SHARED))) {
+        errno = EINVAL;
+        return MAP_FAILED;
+    }
+
+    int sys_flags = (flags & ~LM_MAP_4G) |
+                    MAP_32BIT | MAP_PRIVATE | MAP_ANONYMOUS;
+
+    void *p = NULL;
+    int prefer_sys = prefer_sys_mode();
+    if (prefer_sys) {
+        p = sys_mmap_aligned(length, alignment, sys_flags,
+                             ljmm_mode != LM_SYS_MODE);
+        if (p != MAP_FAILED || ljmm_mode == LM_SYS_MODE)
+            return p;
+    }
+
+    p = user_mmap(length, alignment, flags, NULL);
+    if (p)
+        return p;
+
+    if (ljmm_mode != LM_USER_MODE && !prefer_sys)
+        return sys_mmap_aligned(length, alignment, sys_flags, 0);
+
+    return MAP_FAILED;
+}
+
 /*****************************************************************************
  *
  *      Init and Fini
@@ -468,11 +871,12 @@ fini_helper(int ignore_alloc_blk) {
     if (finalized)
         return;
 
-    int no_alloc_blk = no_alloc_blocks();
+    int no_alloc_blk = no_alloc_blocks() && ext_no_alloc();
     lm_fini_page_alloc();
+    sm_fini();
 
     if (no_alloc_blk || ignore_alloc_blk)
-        lm_free_chunk();
+        lm_free_chunks();
 
     finalized = 1;
 }
@@ -496,13 +900,13 @@ lm_fini2(void) {
 
 int
 lm_init2(ljmm_opt_t* opt) {
-    lm_chunk_t* chunk;
-    if ((chunk = lm_alloc_chunk(opt->mode))) {
-        if (lm_init_page_alloc(chunk, opt)) {
+    if (lm_alloc_chunks(opt)) {
+        if (lm_init_page_alloc(lm_chunks, lm_chunk_num, opt)) {
             ljmm_mode = opt->mode;
             finalized = 0;
             return 1;
         }
+        lm_free_chunks();
     } else {
         /* Look like we run out of (0, 1 GB] space, we have to resort
          * to mmap(2).
@@ -2,21 +2,100 @@
 #include <stdint.h> /* for intptr_t */
 #include <unistd.h>
 #include <errno.h>
-#include <string.h> /* for memcpy() */
+#include <string.h> /* for memcpy(), memset() */
+#include <stdlib.h> /* for qsort() */
 #include "rbtree.h"
 #include "util.h"
 #include "lj_mm.h"
 #include "chunk.h"
 #include "page_alloc.h"
 #include "block_cache.h"
+#include "free_extent.h"
+#include "commit.h"
+#include "tlsf.h"
+#include "profile.h"
 
 /* Forward Decl */
 lm_alloc_t* alloc_info = NULL;
 
+static ljmm_buddy_stat_t buddy_stat;
+
+static void fr_split_to(page_idx_t page);
+static void ql_remove(page_idx_t blk, int order);
+
+/* Add the pages [start, end) to the buddy system, as a sequence of free
+ * blocks each of which is as big as its alignment and the range permit.
+ * The blocks are clean unless <dirty> is set.
+ */
+static void
+add_free_pages(page_idx_t start, page_idx_t end, int dirty) {
+    while (start < end) {
+        int order = __builtin_ctz(page_idx_to_id(start));
+        if (order > alloc_info->max_order)
+            order = alloc_info->max_order;
+        while ((1 << order) > end - start)
+            order--;
+
+        add_free_block(start, order);
+        if (!dirty)
+            reset_dirty_blk(alloc_info->page_info + start);
+        start += 1 << order;
+    }
+}
+
+/* Set up the extent allocator's region (see ljmm_opt_t::extent_order):
+ * <extent_size> bytes at the top of the pages below 2G, or of all the pages
+ * if none is below 2G, clear of the lazy chunk's part yet to map. With
+ * LM_ENGINE_TLSF, the region is all of these pages instead.
+ */
+static int
+init_extent(const ljmm_opt_t* mm_opt) {
+    page_idx_t end = alloc_info->low_limit;
+    if (!end)
+        end = alloc_info->page_num;
+
+    int tlsf = mm_opt->engine == LM_ENGINE_TLSF;
+    page_idx_t start = tlsf ? 0 : end - end / 4;
+    if (!tlsf && mm_opt->extent_size) {
+        size_t pages = mm_opt->extent_size >> alloc_info->page_size_log2;
+        start = pages < (size_t)end ? end - (page_idx_t)pages : 0;
+    }
+
+    lm_chunk_t* lazy = lm_lazy_chunk;
+    if (lazy && lazy->low != lazy->base) {
+        page_idx_t low = page_addr_to_idx(lazy->low);
+        if (start < low)
+            start = low;
+    }
+
+    if (tlsf)
+        return ext_init(0, start, end, &ext_tlsf, 0);
+    return ext_init(mm_opt->extent_order, start, end, &ext_first_fit, 1);
+}
+
+/* Add the pages [start, end) of a chunk to the buddy system, but those in
+ * the extent allocator's region to the extent allocator.
+ */
+static void
+add_chunk_pages(page_idx_t start, page_idx_t end) {
+    if (extent_info) {
+        page_idx_t s = start > extent_info->start ? start : extent_info->start;
+        page_idx_t e = end < extent_info->end ? end : extent_info->end;
+        if (s < e) {
+            add_free_pages(start, s, 0);
+            ext_add_free(s, e);
+            add_free_pages(e, end, 0);
+            return;
+        }
+    }
+
+    add_free_pages(start, end, 0);
+}
+
 /* Initialize the page allocator, return 1 on success, 0 otherwise. */
 int
-lm_init_page_alloc(lm_chunk_t* chunk, ljmm_opt_t* mm_opt) {
-    if (!chunk) {
+lm_init_page_alloc(lm_chunk_t* chunks, int chunk_num, ljmm_opt_t* mm_opt) {
+    if (!chunks || chunk_num <= 0) {
         /* Trunk is not yet allocated */
         return 0;
     }
@@ -26,7 +105,17 @@ lm_init_page_alloc(lm_chunk_t* chunk, ljmm_opt_t* mm_opt) {
         return 1;
     }
 
-    int page_num = chunk->page_num;
+    /* The pages are indexed from the first chunk through the last one. The
+     * holes in between are indexed as well, but never become free.
+     */
+    int page_size_log2 = log2_int32(chunks->page_size);
+    lm_chunk_t* last = chunks + chunk_num - 1;
+    uintptr_t span = (uintptr_t)(last->base + last->size - chunks->base);
+    span >>= page_size_log2;
+    if (span > ((uintptr_t)1 << MAX_ORDER))
+        return 0;
+
+    int page_num = span;
     if (unlikely(mm_opt != NULL)) {
         int pn = mm_opt->dbg_alloc_page_num;
         if (((pn > 0) && (pn > page_num)) || !pn)
@@ -41,6 +130,18 @@ lm_init_page_alloc(lm_chunk_t* chunk, ljmm_opt_t* mm_opt) {
         }
     }
 
+    const lm_placement_t* placement = lm_get_placement(LM_PLACE_DEFAULT);
+    int large_order = 8;
+    if (mm_opt) {
+        placement = lm_get_placement(mm_opt->placement);
+        large_order = mm_opt->large_order;
+        if (!placement || large_order < 0 ||
+            (mm_opt->engine != LM_ENGINE_BUDDY &&
+             mm_opt->engine != LM_ENGINE_TLSF)) {
+            return 0;
+        }
+    }
+
     int alloc_sz = sizeof(lm_alloc_t) +
                    sizeof(lm_page_t) * (page_num + 1);
 
@@ -50,10 +151,50 @@ lm_init_page_alloc(lm_chunk_t* chunk, ljmm_opt_t* mm_opt) {
         return 0;
     }
 
-    alloc_info->first_page = chunk->base;
+    if (!fe_init(page_num) ||
+        !cm_init(page_num, mm_opt && mm_opt->reserve_only)) {
+        fe_fini();
+        MYFREE(alloc_info);
+        alloc_info = NULL;
+        errno = ENOMEM;
+        return 0;
+    }
+
+    alloc_info->first_page = chunks->base;
     alloc_info->page_num   = page_num;
-    alloc_info->page_size  = chunk->page_size;
-    alloc_info->page_size_log2 = log2_int32(chunk->page_size);
+    alloc_info->page_size  = chunks->page_size;
+    alloc_info->page_size_log2 = page_size_log2;
+    alloc_info->placement = placement;
+    alloc_info->large_order = large_order;
+    alloc_info->next_fit = 0;
+    alloc_info->free_page_num = 0;
+
+    /* The quick-lists would blur the debugging layout. */
+    int quick_len = 4;
+    if (mm_opt) {
+        quick_len = mm_opt->quick_list_len;
+        if (mm_opt->dbg_alloc_page_num > 0 || quick_len < 0)
+            quick_len = 0;
+        else if (quick_len > QL_MAX_LEN)
+            quick_len = QL_MAX_LEN;
+    }
+    alloc_info->quick_len = quick_len;
+    memset(alloc_info->quick_num, 0, sizeof(alloc_info->quick_num));
+
+    /* So would lazy splitting. */
+    alloc_info->lazy_split = placement->lazy_split &&
+                             (!mm_opt || (mm_opt->lazy_split &&
+                                          mm_opt->dbg_alloc_page_num <= 0));
+    alloc_info->fr_blk = -1;
+
+    /* The pages at or above 2G are not handed out for MAP_32BIT. */
+    uintptr_t below_2g = (uintptr_t)0x80000000 - (uintptr_t)chunks->base;
+    if ((uintptr_t)chunks->base >= 0x80000000)
+        alloc_info->low_limit = 0;
+    else if ((below_2g >> page_size_log2) < (uintptr_t)page_num)
+        alloc_info->low_limit = below_2g >> page_size_log2;
+    else
+        alloc_info->low_limit = page_num;
 
     /* Init the page-info */
     char* p =  (char*)(alloc_info + 1);
@@ -68,11 +209,11 @@ lm_init_page_alloc(lm_chunk_t* chunk, ljmm_opt_t* mm_opt) {
         pi[i].flags = 0;
     }
 
-    /* Init the buddy allocator */
+    /* Init the buddy allocator. The free-block trees do not need values. */
     int e;
     rb_tree_t* free_blks = &alloc_info->free_blks[0];
     for (i = 0, e = MAX_ORDER; i < e; i++)
-        rbt_init(&free_blks[i]);
+        rbt_init_set(&free_blks[i]);
     rbt_init(&alloc_info->alloc_blks);
 
     /* Determine the max order */
@@ -84,6 +225,8 @@ lm_init_page_alloc(lm_chunk_t* chunk, ljmm_opt_t* mm_opt) {
         if (bitmask & page_num)
             break;
     }
+    if (max_order >= MAX_ORDER)
+        max_order = MAX_ORDER - 1;
     alloc_info->max_order = max_order;
 
     /* So, the ID of biggest block's first page is "1 << order". e.g.
@@ -94,22 +237,51 @@ lm_init_page_alloc(lm_chunk_t* chunk, ljmm_opt_t* mm_opt) {
      *    alloc_info->idx_2_id_adj == 5 == page_id(*) - page_idx(*)
      */
     int idx_2_id_adj = (1 << max_order) - (page_num & ((1 << max_order) - 1));
+
+    /* The debugging layout above is independent of where the chunks are.
+     * Otherwise, the IDs follow the addresses, so that a block is aligned in
+     * address to its own size, which lm_mmap_aligned() relies on. In the
+     * above example, if the chunk starts at page 0x1003 (in address), the
+     * blocks contain 1, 4, 4 and 2 pages, and their IDs are 11, 12, 16, 20.
+     */
+    uintptr_t base_pg = (uintptr_t)chunks->base >> page_size_log2;
+    if (!mm_opt || mm_opt->dbg_alloc_page_num <= 0) {
+        idx_2_id_adj = (1 << max_order) +
+                       (int)(base_pg & ((1 << max_order) - 1));
+    }
     alloc_info->idx_2_id_adj = idx_2_id_adj;
 
-    /* Divide the chunk into blocks, smaller block first. Smaller blocks
-     * are likely allocated and deallocated frequently. Therefore, they are
-     * better off residing closer to data segment.
+    /* Blocks of this order or below are aligned in address to their size */
+    int align_order = max_order;
+    uintptr_t skew = (base_pg - idx_2_id_adj) & ((1 << max_order) - 1);
+    if (skew)
+        align_order = __builtin_ctzl(skew);
+    alloc_info->addr_align_order = align_order;
+
+    if (mm_opt &&
+        (mm_opt->engine == LM_ENGINE_TLSF || mm_opt->extent_order > 0) &&
+        !init_extent(mm_opt)) {
+        lm_fini_page_alloc();
+        errno = ENOMEM;
+        return 0;
+    }
+
+    /* Divide the chunks into blocks, smaller block first. With the default
+     * placement, smaller blocks are likely allocated and deallocated
+     * frequently. Therefore, they are better off residing closer to data
+     * segment. No block straddles 2G.
      */
-    int page_idx = 0;
-    int order = 0;
-    for (bitmask = 1, order = 0;
-         bitmask != 0;
-         bitmask = bitmask << 1, order++) {
-        if (page_num & bitmask) {
-            add_free_block(page_idx, order);
-            page_idx += (1 << order);
-        }
+    page_idx_t low_limit = alloc_info->low_limit;
+    for (i = 0; i < chunk_num; i++) {
+        page_idx_t start = (chunks[i].base - chunks->base) >> page_size_log2;
+        page_idx_t end = start + chunks[i].page_num;
+        if (end > page_num)
+            end = page_num;
+
+        add_chunk_pages(start, end < low_limit ? end : low_limit);
+        add_chunk_pages(start > low_limit ? start : low_limit, end);
     }
+    alloc_info->usable_page_num = alloc_info->free_page_num;
 
     /*init the block cache */
     bc_init();
@@ -126,6 +298,10 @@ lm_fini_page_alloc(void) {
             rbt_fini(free_blks + i);
 
         rbt_fini(&alloc_info->alloc_blks);
+        fe_fini();
+        cm_fini();
+        ext_fini();
+        memset(&buddy_stat, 0, sizeof(buddy_stat));
 
         MYFREE(alloc_info);
         alloc_info = 0;
@@ -161,6 +337,7 @@ extend_alloc_block(page_idx_t block_idx, size_t new_sz) {
      */
     int succ = 0;
     int ord;
+    int low_limit = alloc_info->low_limit;
     for (ord = order; ord <= alloc_info->max_order; ord++) {
         if (min_page_num <= (1 << ord)) {
             succ = 1;
@@ -168,12 +345,27 @@ extend_alloc_block(page_idx_t block_idx, size_t new_sz) {
         }
 
         page_id_t buddy_id = blk_id ^ (1 << ord);
-        if (buddy_id < blk_id) {
+        if (buddy_id < blk_id || ord == alloc_info->max_order) {
             /* The buddy block must reside at higher address. */
             break;
         }
 
-        int buddy_idx = page_id_to_idx(buddy_id);
+        int buddy_idx = buddy_id - alloc_info->idx_2_id_adj;
+        if (buddy_idx >= alloc_info->page_num ||
+            (block_idx < low_limit && buddy_idx >= low_limit)) {
+            /* Beyond the last page, or across 2G */
+            break;
+        }
+
+        /* The buddy may be yet to split off the frontier, or be held in a
+         * quick-list.
+         */
+        fr_split_to(buddy_idx);
+        lm_page_t* buddy = alloc_info->page_info + buddy_idx;
+        if (is_page_leader(buddy) && is_quick_blk(buddy) &&
+            buddy->order == ord) {
+            ql_remove(buddy_idx, ord);
+        }
         if (!rbt_search(&alloc_info->free_blks[ord], buddy_idx, NULL)) {
             /* bail out if the buddy is not available */
             break;
@@ -188,6 +380,10 @@ extend_alloc_block(page_idx_t block_idx, size_t new_sz) {
     if (!succ || ord == order)
         return 0;
 
+    /* The pages joining the block may be yet to commit */
+    if (!cm_commit(block_idx + (1 << order), (1 << ord) - (1 << order)))
+        return 0;
+
     /* Step 2: The previous step is merely a 'dry-run' of extension. This
      *  step is to perform real transformation.
      */
@@ -204,56 +400,432 @@ extend_alloc_block(page_idx_t block_idx, size_t new_sz) {
     return 1;
 }
 
-/* Free the block whose first page (aka block leader) is specified
- * by "page_idx". return 1 on success and 0 otherwise.
+page_idx_t
+split_free_block(page_idx_t blk, int blk_order, int req_order, int upper) {
+    lm_page_t* pi = alloc_info->page_info;
+    int dirty = is_dirty_blk(pi + blk);
+    remove_free_block(blk, blk_order, 0);
+
+    LM_PROF_BEGIN(split_start);
+    int bo = blk_order;
+    while (bo > req_order) {
+        bo--;
+        page_idx_t rest = upper ? blk : blk + (1 << bo);
+        add_free_block(rest, bo);
+        buddy_stat.split_num++;
+        if (!dirty)
+            reset_dirty_blk(pi + rest);
+        if (upper)
+            blk += 1 << bo;
+    }
+    LM_PROF_END(LM_PROF_SPLIT, split_start);
+
+    return blk;
+}
+
+page_idx_t
+lazy_split_free_block(page_idx_t blk, int blk_order, int req_order) {
+    ASSERT(alloc_info->fr_blk < 0 && blk_order > req_order);
+    lm_page_t* page = alloc_info->page_info + blk;
+    int dirty = is_dirty_blk(page);
+    remove_free_block(blk, blk_order, 0);
+    page->flags = PF_LEADER;
+
+    alloc_info->fr_blk = blk;
+    alloc_info->fr_order = blk_order;
+    alloc_info->fr_ofst = 1 << req_order;
+    alloc_info->fr_dirty = dirty;
+    alloc_info->free_page_num += (1 << blk_order) - (1 << req_order);
+    return blk;
+}
+
+/* Add the block at the lower end of the frontier to the free blocks */
+static void
+fr_split_one(void) {
+    int ofst = alloc_info->fr_ofst;
+    int order = __builtin_ctz(ofst);
+    page_idx_t blk = alloc_info->fr_blk + ofst;
+
+    alloc_info->page_info[blk].flags = 0;
+    alloc_info->free_page_num -= 1 << order;
+    add_free_block(blk, order);
+    if (!alloc_info->fr_dirty)
+        reset_dirty_blk(alloc_info->page_info + blk);
+
+    alloc_info->fr_ofst = ofst + (1 << order);
+    buddy_stat.split_num++;
+}
+
+/* Split the frontier up to, and including, the block at <page>, if the
+ * frontier has it.
  */
+static void
+fr_split_to(page_idx_t page) {
+    page_idx_t fr = alloc_info->fr_blk;
+    int size = 1 << alloc_info->fr_order;
+    if (fr < 0 || page < fr + alloc_info->fr_ofst || page >= fr + size)
+        return;
+
+    while (alloc_info->fr_ofst <= page - fr)
+        fr_split_one();
+    if (alloc_info->fr_ofst == size)
+        alloc_info->fr_blk = -1;
+}
+
+page_idx_t
+fr_carve(int order, page_idx_t lo, page_idx_t hi, int* dirty) {
+    page_idx_t fr = alloc_info->fr_blk;
+    if (fr < lo || fr >= hi)
+        return -1;
+
+    /* The frontier ends at the end of the block, so its first block of
+     * <order> or above is where the lower end is aligned to <order>.
+     */
+    int size = 1 << alloc_info->fr_order;
+    int mask = (1 << order) - 1;
+    int ofst = (alloc_info->fr_ofst + mask) & ~mask;
+    if (ofst >= size) {
+        fr_flush();
+        return -1;
+    }
+
+    /* That block is what the placement policy would pick, unless there is
+     * a free block of a lower order, or one of its order below it.
+     */
+    int top = __builtin_ctz(ofst);
+    int o;
+    for (o = order; o <= top; o++) {
+        page_idx_t blk;
+        rb_tree_t* rbt = alloc_info->free_blks + o;
+        if (rbt_search_ge(rbt, lo, &blk, NULL) != RBS_FAIL &&
+            blk < (o < top ? hi : fr + ofst)) {
+            return -1;
+        }
+    }
+
+    while (alloc_info->fr_ofst < ofst)
+        fr_split_one();
+
+    page_idx_t blk = fr + ofst;
+    if (!cm_commit(blk, 1 << order)) {
+        fr_flush();
+        return -1;
+    }
+
+    alloc_info->page_info[blk].flags = PF_LEADER;
+    alloc_info->free_page_num -= 1 << order;
+    alloc_info->fr_ofst += 1 << order;
+    if (alloc_info->fr_ofst == size)
+        alloc_info->fr_blk = -1;
+
+    buddy_stat.lazy_carve_num++;
+    *dirty = alloc_info->fr_dirty;
+    return blk;
+}
+
 int
-free_block(page_idx_t page_idx) {
-    (void)remove_alloc_block(page_idx);
+fr_flush(void) {
+    if (alloc_info->fr_blk < 0)
+        return 0;
+
+    /* None of these blocks has a free buddy: that of the first one would
+     * have rejoined the frontier, and the others' contain those before.
+     */
+    while (alloc_info->fr_ofst < (1 << alloc_info->fr_order))
+        fr_split_one();
+
+    alloc_info->fr_blk = -1;
+    return 1;
+}
+
+/* If the free block <*blk> of <*order> ends right at the frontier, have it
+ * rejoin the frontier, along with the free buddies below in turn. Return 1
+ * if so, 0 otherwise. If the frontier is back to the whole block, it is no
+ * longer the frontier, but the free block <*blk> of <*order> to merge, and
+ * 0 is returned as well.
+ */
+static int
+fr_rejoin(page_idx_t* blk, int* order) {
+    page_idx_t fr = alloc_info->fr_blk;
+    if (fr < 0 || *blk < fr ||
+        *blk + (1 << *order) != fr + alloc_info->fr_ofst) {
+        return 0;
+    }
 
     lm_page_t* pi = alloc_info->page_info;
-    lm_page_t* page = pi + page_idx;
-    int order = page->order;
-    ASSERT (find_block(page_idx, order, NULL) == 0);
+    int ofst = alloc_info->fr_ofst - (1 << *order);
+    pi[*blk].flags = 0;
+    alloc_info->free_page_num += 1 << *order;
+
+    while (ofst) {
+        int o = __builtin_ctz(ofst);
+        page_idx_t buddy = fr + ofst - (1 << o);
+        lm_page_t* p = pi + buddy;
+        if (p->order != o || !is_page_leader(p) || is_allocated_blk(p) ||
+            is_quick_blk(p)) {
+            break;
+        }
+
+        remove_free_block(buddy, o, 0);
+        p->flags = 0;
+        alloc_info->free_page_num += 1 << o;
+        buddy_stat.merge_num++;
+        ofst -= 1 << o;
+    }
 
-    /* Consolidate adjacent buddies */
+    /* The pages rejoining it were handed out. */
+    alloc_info->fr_dirty = 1;
+    alloc_info->fr_ofst = ofst;
+    if (ofst)
+        return 1;
+
+    alloc_info->fr_blk = -1;
+    alloc_info->free_page_num -= 1 << alloc_info->fr_order;
+    *blk = fr;
+    *order = alloc_info->fr_order;
+    return 0;
+}
+
+/* Add the free block <page_idx> of <order> to the buddy system, merging it
+ * with its buddy as long as the buddy is free, or having it rejoin the
+ * frontier (see fr_rejoin()).
+ */
+static void
+merge_free_block(page_idx_t page_idx, int order) {
+    lm_page_t* pi = alloc_info->page_info;
     int page_num = alloc_info->page_num;
-    page_id_t page_id = page_idx_to_id(page_idx);
+    int low_limit = alloc_info->low_limit;
+    page_id_t page_id;
     int min_page_id = alloc_info->idx_2_id_adj;
-    while (1) {
+    LM_PROF_BEGIN(merge_start);
+    int rejoined;
+    while (!(rejoined = fr_rejoin(&page_idx, &order)) &&
+           order < alloc_info->max_order) {
+        page_id = page_idx_to_id(page_idx);
         page_id_t buddy_id = page_id ^ (1<<order);
         if (buddy_id < min_page_id)
             break;
 
-        page_idx_t buddy_idx = page_id_to_idx(buddy_id);
+        /* Blocks below 2G are not merged with those above it. */
+        page_idx_t buddy_idx = buddy_id - min_page_id;
+        if ((page_idx < low_limit) != (buddy_idx < low_limit))
+            break;
+
         if (buddy_idx >= page_num ||
             pi[buddy_idx].order != order ||
             !is_page_leader(pi + buddy_idx) ||
-            is_allocated_blk(pi + buddy_idx)) {
+            is_allocated_blk(pi + buddy_idx) ||
+            is_quick_blk(pi + buddy_idx)) {
             break;
         }
         remove_free_block(buddy_idx, order, 0);
-        reset_page_leader(alloc_info->page_info + buddy_idx);
-
-        page_id = page_id < buddy_id ? page_id : buddy_id;
+        buddy_stat.merge_num++;
+
+        /* The upper half is no longer a leader. It may be the block itself,
+         * which is flagged as a free leader if it comes from a quick-list.
+         */
+        if (page_id < buddy_id) {
+            reset_page_leader(pi + buddy_idx);
+        } else {
+            reset_page_leader(pi + page_idx);
+            page_idx = buddy_idx;
+        }
         order++;
     }
+    LM_PROF_END(LM_PROF_MERGE, merge_start);
+
+    if (!rejoined)
+        add_free_block(page_idx, order);
+}
+
+/* Put the block just freed into the quick-list of its order, unmerged.
+ * Return 1 on success, 0 if the quick-list is full.
+ */
+static int
+ql_push(page_idx_t blk, int order) {
+    int n = alloc_info->quick_num[order];
+    if (n >= alloc_info->quick_len)
+        return 0;
 
-    add_free_block(page_id_to_idx(page_id), order);
+    alloc_info->quick[order][n] = blk;
+    alloc_info->quick_num[order] = n + 1;
+    alloc_info->page_info[blk].flags = PF_LEADER | PF_QUICK | PF_DIRTY;
+    alloc_info->free_page_num += 1 << order;
     return 1;
 }
 
+page_idx_t
+ql_pop(int order, page_idx_t lo, page_idx_t hi) {
+    page_idx_t* ql = alloc_info->quick[order];
+    int n = alloc_info->quick_num[order];
+    int i;
+    for (i = n - 1; i >= 0; i--) {
+        page_idx_t blk = ql[i];
+        if (blk < lo || blk >= hi)
+            continue;
+
+        for (; i < n - 1; i++)
+            ql[i] = ql[i + 1];
+        alloc_info->quick_num[order] = n - 1;
+
+        alloc_info->page_info[blk].flags = PF_LEADER;
+        alloc_info->free_page_num -= 1 << order;
+        buddy_stat.quick_hit_num++;
+        return blk;
+    }
+
+    return -1;
+}
+
+/* Take the block <blk> of <order> out of its quick-list, and add it to the
+ * free blocks as it is, e.g. for its buddy to grow into.
+ */
+static void
+ql_remove(page_idx_t blk, int order) {
+    page_idx_t* ql = alloc_info->quick[order];
+    int i, n = alloc_info->quick_num[order];
+    for (i = 0; i < n && ql[i] != blk; i++)
+        ;
+    ASSERT(i < n);
+
+    for (; i < n - 1; i++)
+        ql[i] = ql[i + 1];
+    alloc_info->quick_num[order] = n - 1;
+
+    alloc_info->page_info[blk].flags = PF_LEADER;
+    alloc_info->free_page_num -= 1 << order;
+    add_free_block(blk, order);
+}
+
+int
+ql_flush(void) {
+    int order, flushed = 0;
+    for (order = 0; order < QL_ORDER_NUM; order++) {
+        int i, n = alloc_info->quick_num[order];
+        for (i = 0; i < n; i++) {
+            page_idx_t blk = alloc_info->quick[order][i];
+            alloc_info->page_info[blk].flags = PF_LEADER | PF_DIRTY;
+            alloc_info->free_page_num -= 1 << order;
+            merge_free_block(blk, order);
+        }
+        alloc_info->quick_num[order] = 0;
+        flushed |= n;
+    }
+
+    if (flushed)
+        buddy_stat.quick_flush_num++;
+    return flushed != 0;
+}
+
+/* Free the block whose first page (aka block leader) is specified
+ * by "page_idx". return 1 on success and 0 otherwise.
+ */
+int
+free_block(page_idx_t page_idx) {
+    (void)remove_alloc_block(page_idx);
+
+    lm_page_t* page = alloc_info->page_info + page_idx;
+    int order = page->order;
+    ASSERT (find_block(page_idx, order, NULL) == 0);
+
+    if (unlikely(is_locked_blk(page))) {
+        munlock(get_page_addr(page_idx),
+                ((size_t)1 << order) << alloc_info->page_size_log2);
+    }
+
+    if (order < QL_ORDER_NUM && ql_push(page_idx, order))
+        return 1;
+
+    merge_free_block(page_idx, order);
+    return 1;
+}
+
+void
+retire_free_pages(page_idx_t start, page_idx_t end) {
+    fr_flush();
+
+    int free_page_num = alloc_info->free_page_num;
+    int order;
+    for (order = 0; order <= alloc_info->max_order; order++) {
+        rb_tree_t* rbt = alloc_info->free_blks + order;
+        page_idx_t blk;
+        while (rbt_search_ge(rbt, start, &blk, NULL) != RBS_FAIL &&
+               blk < end) {
+            int dirty = is_dirty_blk(alloc_info->page_info + blk);
+            remove_free_block(blk, order, 0);
+            reset_page_leader(alloc_info->page_info + blk);
+            alloc_info->page_info[blk].order = INVALID_ORDER;
+
+            if (blk + (1 << order) > end)
+                add_free_pages(end, blk + (1 << order), dirty);
+        }
+    }
+
+    alloc_info->usable_page_num -= free_page_num - alloc_info->free_page_num;
+}
+
 /**************************************************************************
  *
  *       Debugging Support & Misc "cold" functions
  *
  **************************************************************************
  */
+size_t
+lm_largest_free(void) {
+    if (!alloc_info)
+        return 0;
+
+    size_t largest = 0;
+    int order = fe_largest_order();
+    if (order != INVALID_ORDER)
+        largest = (size_t)1 << order;
+
+    /* The blocks in the quick-lists are free too, though small */
+    for (order = QL_ORDER_NUM - 1; order >= 0; order--) {
+        if (alloc_info->quick_num[order]) {
+            if (((size_t)1 << order) > largest)
+                largest = (size_t)1 << order;
+            break;
+        }
+    }
+
+    /* The frontier's biggest block is the one at the end of it */
+    if (alloc_info->fr_blk >= 0) {
+        int fr_pages = (1 << alloc_info->fr_order) - alloc_info->fr_ofst;
+        size_t fr_largest = (size_t)1 << log2_int32(fr_pages);
+        if (fr_largest > largest)
+            largest = fr_largest;
+    }
+
+    if ((size_t)ext_largest() > largest)
+        largest = ext_largest();
+
+    return largest << alloc_info->page_size_log2;
+}
+
+const ljmm_buddy_stat_t*
+lm_get_buddy_stat(void) {
+    return &buddy_stat;
+}
+
+/* Order the free blocks by order, then by page_idx */
+static int
+cmp_free_blk_info(const void* p1, const void* p2) {
+    const block_info_t* b1 = (const block_info_t*)p1;
+    const block_info_t* b2 = (const block_info_t*)p2;
+    if (b1->order != b2->order)
+        return b1->order - b2->order;
+    return b1->page_idx - b2->page_idx;
+}
+
 const lm_status_t*
 lm_get_status(void) {
     if (!alloc_info)
         return NULL;
 
+    ASSERT(fe_verify());
+    ASSERT(!extent_info || extent_info->index != &ext_tlsf || tlsf_verify());
+
     lm_status_t* s = (lm_status_t *)MYMALLOC(sizeof(lm_status_t));
     s->first_page = alloc_info->first_page;
     s->page_num = alloc_info->page_num;
@@ -275,10 +847,10 @@ lm_get_status(void) {
         for (iter = rbt_iter_begin(rbt), iter_e = rbt_iter_end(rbt);
              iter != iter_e;
              iter = rbt_iter_inc(rbt, iter)) {
-            rb_node_t* blk = rbt_iter_deref(iter);
-            ai[idx].page_idx = blk->key;
-            ai[idx].size = blk->value;
-            ai[idx].order = alloc_info->page_info[blk->key].order;
+            int blk = rbt_iter_key(rbt, iter);
+            ai[idx].page_idx = blk;
+            ai[idx].size = rbt_iter_value(rbt, iter);
+            ai[idx].order = alloc_info->page_info[blk].order;
             idx++;
         }
 
@@ -286,12 +858,24 @@ lm_get_status(void) {
         s->alloc_blk_num = idx;
     }
 
-    /* Populate free block info */
+    /* Populate free block info: those in the free-block trees, in the
+     * quick-lists, and at the frontier, as they are.
+     */
     int free_blk_num = 0;
     int i, e;
     for (i = 0, e = alloc_info->max_order; i <= e; i++) {
         free_blk_num += rbt_size(alloc_info->free_blks + i);
     }
+    for (i = 0; i < QL_ORDER_NUM; i++)
+        free_blk_num += alloc_info->quick_num[i];
+
+    int fr_size = 1 << alloc_info->fr_order;
+    if (alloc_info->fr_blk >= 0) {
+        int x;
+        for (x = alloc_info->fr_ofst; x < fr_size; x += 1 << __builtin_ctz(x))
+            free_blk_num++;
+    }
+
     if (free_blk_num) {
         block_info_t* fi;
         fi = (block_info_t*)MYMALLOC(sizeof(block_info_t) * free_blk_num);
@@ -305,15 +889,37 @@ lm_get_status(void) {
             for (iter = rbt_iter_begin(rbt), iter_e = rbt_iter_end(rbt);
                  iter != iter_e;
                  iter = rbt_iter_inc(rbt, iter)) {
-                rb_node_t* nd = rbt_iter_deref(iter);
-                fi[idx].page_idx = nd->key;
-                fi[idx].order = alloc_info->page_info[nd->key].order;
+                int blk = rbt_iter_key(rbt, iter);
+                fi[idx].page_idx = blk;
+                fi[idx].order = alloc_info->page_info[blk].order;
+                fi[idx].size = (1 << fi[idx].order) << page_size_log2;
+                idx++;
+            }
+        }
+
+        for (i = 0; i < QL_ORDER_NUM; i++) {
+            int j;
+            for (j = 0; j < alloc_info->quick_num[i]; j++) {
+                fi[idx].page_idx = alloc_info->quick[i][j];
+                fi[idx].order = i;
+                fi[idx].size = (1 << i) << page_size_log2;
+                idx++;
+            }
+        }
+
+        if (alloc_info->fr_blk >= 0) {
+            int x;
+            for (x = alloc_info->fr_ofst; x < fr_size;
+                 x += 1 << __builtin_ctz(x)) {
+                fi[idx].page_idx = alloc_info->fr_blk + x;
+                fi[idx].order = __builtin_ctz(x);
                 fi[idx].size = (1 << fi[idx].order) << page_size_log2;
                 idx++;
             }
         }
         ASSERT(idx == free_blk_num);
 
+        qsort(fi, idx, sizeof(block_info_t), cmp_free_blk_info);
         s->free_blk_info = fi;
         s->free_blk_num = idx;
     }
@@ -345,8 +951,9 @@ dump_page_alloc(FILE* f) {
     }
 
     /* dump the buddy system */
-    fprintf (f, "Buddy system: max-order=%d, id - idx = %d\n",
-             alloc_info->max_order, alloc_info->idx_2_id_adj);
+    fprintf (f, "Buddy system: max-order=%d, id - idx = %d, placement=%s\n",
+             alloc_info->max_order, alloc_info->idx_2_id_adj,
+             alloc_info->placement->name);
 
     int i, e;
     char* page_start_addr = alloc_info->first_page;
@@ -364,16 +971,32 @@ dump_page_alloc(FILE* f) {
                 iter_e = rbt_iter_end(free_blks);
              iter != iter_e;
              iter = rbt_iter_inc(free_blks, iter)) {
-            rb_node_t* node = rbt_iter_deref(iter);
-            page_idx_t page_idx = node->key;
-            char* addr = page_start_addr + (page_idx << page_sz_log);
+            page_idx_t page_idx = rbt_iter_key(free_blks, iter);
+            char* addr = page_start_addr + ((size_t)page_idx << page_sz_log);
             fprintf(f, "pg_idx:%d (%p, len=%d), ", page_idx,
-                    addr, (int)node->value);
+                    addr, (int)rbt_iter_value(free_blks, iter));
             verify_order(page_idx, i);
         }
         fputs("\n", f);
     }
 
+    for (i = 0; i < QL_ORDER_NUM; i++) {
+        int j, n = alloc_info->quick_num[i];
+        if (!n)
+            continue;
+
+        fprintf(f, "Quick-list of order %d: ", i);
+        for (j = 0; j < n; j++)
+            fprintf(f, "pg_idx:%d, ", alloc_info->quick[i][j]);
+        fputs("\n", f);
+    }
+
+    if (alloc_info->fr_blk >= 0) {
+        fprintf(f, "Frontier: pg_idx:%d, order=%d, pages [%d, %d) split off\n",
+                alloc_info->fr_blk, alloc_info->fr_order, alloc_info->fr_blk,
+                alloc_info->fr_blk + alloc_info->fr_ofst);
+    }
+
     fprintf(f, "\nAllocated blocks:\n");
     {
         rb_tree_t* rbt = &alloc_info->alloc_blks;
@@ -382,10 +1005,10 @@ dump_page_alloc(FILE* f) {
         for (iter = rbt_iter_begin(rbt), iter_e = rbt_iter_end(rbt);
              iter != iter_e;
              iter = rbt_iter_inc(rbt, iter)) {
-            rb_node_t* nd = rbt_iter_deref(iter);
-            int blk = nd->key;
+            int blk = rbt_iter_key(rbt, iter);
             fprintf(f, "%3d: pg_idx:%d, size:%ld, order = %d\n",
-                    idx, blk, nd->value, alloc_info->page_info[blk].order);
+                    idx, blk, rbt_iter_value(rbt, iter),
+                    alloc_info->page_info[blk].order);
             idx++;
         }
     }
@@ -6,6 +6,11 @@
 #include "chunk.h" /* for lm_chunk_t */
 #include "lj_mm.h"
 #include "block_cache.h"
+#include "free_extent.h"
+#include "placement.h"
+#include "commit.h"
+#include "extent.h"
+#include "profile.h"
 
 /**************************************************************************
  *
@@ -21,7 +26,10 @@ typedef struct {
 typedef enum {
     PF_LEADER    = (1 << 0), /* set if it's the first page of a block */
     PF_ALLOCATED = (1 << 1), /* set if it's "leader" of a allocated block */
-    PF_LAST      = PF_ALLOCATED,
+    PF_LOCKED    = (1 << 2), /* set if the allocated block is mlock()ed */
+    PF_DIRTY     = (1 << 3), /* set if the free block may not be all zero */
+    PF_QUICK     = (1 << 4), /* set if the free block is in a quick-list */
+    PF_LAST      = PF_QUICK,
 } page_flag_t;
 
 static inline int
@@ -56,9 +64,50 @@ reset_allocated_blk(lm_page_t* p) {
     p->flags &= ~PF_ALLOCATED;
 }
 
+static inline int
+is_locked_blk(lm_page_t* p) {
+    return p->flags & PF_LOCKED;
+}
+
+static inline void
+set_locked_blk(lm_page_t* p) {
+    ASSERT(is_allocated_blk(p));
+    p->flags |= PF_LOCKED;
+}
+
+/* A free block is "clean", i.e. known to be all zero, if it has never been
+ * handed out since it was reserved, or if it has been zapped since. The state
+ * is passed on to the parts as the block is split; merging with a dirty block
+ * makes it dirty.
+ */
+static inline int
+is_dirty_blk(lm_page_t* p) {
+    return p->flags & PF_DIRTY;
+}
+
+static inline void
+reset_dirty_blk(lm_page_t* p) {
+    ASSERT(is_page_leader(p) && !is_allocated_blk(p));
+    p->flags &= ~PF_DIRTY;
+}
+
+/* A block in a quick-list is free, but is neither in the free-block trees
+ * nor merged with its buddy; see ql_push().
+ */
+static inline int
+is_quick_blk(lm_page_t* p) {
+    return p->flags & PF_QUICK;
+}
+
 /* We could have up to 1M pages (4G/4k). Hence 20 */ #define MAX_ORDER 20
 #define INVALID_ORDER (-1)
 
+/* The orders below QL_ORDER_NUM have quick-lists, each of which holds up to
+ * QL_MAX_LEN blocks; see ljmm_opt_t::quick_list_len.
+ */
+#define QL_ORDER_NUM 8
+#define QL_MAX_LEN 16
+
 /**************************************************************************
  *
  *              Buddy Allocation
@@ -72,10 +121,28 @@ typedef struct {
     rb_tree_t free_blks[MAX_ORDER];
     rb_tree_t alloc_blks;
     int max_order;
-    int page_num;       /* This many pages in total */
+    const lm_placement_t* placement;
+    int large_order;    /* see ljmm_opt_t::large_order */
+    page_idx_t next_fit;/* where the next-fit policy resumes */
+    page_idx_t low_limit;/* The first page at or above 2G, or page_num */
+    int page_num;       /* This many pages in total, holes between chunks
+                         * included */
+    int usable_page_num;/* The pages that can be allocated, i.e. those free
+                         * on init, less the retired ones */
+    int free_page_num;  /* The pages in the free blocks */
     int page_size;      /* The size of page in byte, normally 4k*/
     int page_size_log2; /* log2(page_size)*/
     int idx_2_id_adj;
+    int addr_align_order; /* A block of this order or below is aligned in
+                           * address to its size */
+    int quick_len;      /* The bound of each quick-list, 0 if disabled */
+    int quick_num[QL_ORDER_NUM];
+    page_idx_t quick[QL_ORDER_NUM][QL_MAX_LEN]; /* the oldest first */
+    int lazy_split;     /* Set if blocks are split lazily */
+    page_idx_t fr_blk;  /* The block split lazily, or -1; see fr_carve() */
+    int fr_order;
+    int fr_ofst;        /* The frontier starts this many pages into it */
+    int fr_dirty;       /* Set if the frontier may not be all zero */
 } lm_alloc_t;
 
 extern lm_alloc_t* alloc_info;
@@ -95,7 +162,12 @@ page_id_to_idx(page_id_t id) {
 
 static inline char*
 get_page_addr(page_idx_t pg) {
-    return alloc_info->first_page + (pg << alloc_info->page_size_log2);
+    return alloc_info->first_page + ((size_t)pg << alloc_info->page_size_log2);
+}
+
+static inline page_idx_t
+page_addr_to_idx(char* addr) {
+    return (addr - alloc_info->first_page) >> alloc_info->page_size_log2;
 }
 
 static inline int
@@ -123,11 +195,15 @@ remove_free_block(page_idx_t block, int order, int zap_pages) {
 #endif
 
     bc_remove_block(block, order, zap_pages);
+    fe_set(block, INVALID_ORDER);
+    alloc_info->free_page_num -= 1 << order;
 
     return rbt_delete(&alloc_info->free_blks[order], block, NULL);
 }
 
-/* Add the free block of the given "order" to the buddy system */
+/* Add the free block of the given "order" to the buddy system. The block is
+ * taken as dirty; see reset_dirty_blk().
+ */
 static inline int
 add_free_block(page_idx_t block, int order) {
     lm_page_t* page = alloc_info->page_info + block;
@@ -138,11 +214,60 @@ add_free_block(page_idx_t block, int order) {
     page->order = order;
     set_page_leader(page);
     reset_allocated_blk(page);
+    page->flags = (page->flags & ~PF_LOCKED) | PF_DIRTY;
 
     bc_add_blk(block, order);
+    fe_set(block, order);
+    alloc_info->free_page_num += 1 << order;
     return rbt_insert(&alloc_info->free_blks[order], block, 0);
 }
 
+/* Remove the free block <blk> of <blk_order>, and split it down to
+ * <req_order>: the lower (or the upper if <upper> is set) part is returned,
+ * and the rest is added back to the free blocks, as clean as <blk> was. The
+ * returned block is expected to be allocated by the caller.
+ */
+page_idx_t split_free_block(page_idx_t blk, int blk_order, int req_order,
+                            int upper);
+
+/* Lazy splitting (see ljmm_opt_t::lazy_split): rather than splitting
+ * a free block down to the order of the request at once, which adds a free
+ * block for each order in between, lazy_split_free_block() splits off the
+ * part allocated alone. The rest of the block, the "frontier", is in none
+ * of the free-block trees; it stands for the free blocks a split would have
+ * left, from the lower end, each as big as its alignment permits.
+ *
+ *  fr_carve() takes the following allocations from the lower end of the
+ * frontier, adding the blocks skipped for alignment to the free blocks. A
+ * block freed right below the frontier rejoins it, as do the free buddies
+ * below it in turn, and once the frontier is back to the whole block, the
+ * block is merged as usual. fr_flush() splits the frontier into the free
+ * blocks it stands for. There is one frontier at a time, and none of its
+ * pages is a leader.
+ */
+
+/* Like split_free_block() from the lower end, but the rest of <blk> becomes
+ * the frontier. There must be no frontier already.
+ */
+page_idx_t lazy_split_free_block(page_idx_t blk, int blk_order,
+                                 int req_order);
+
+/* Carve a block of <order> from the frontier, unless LM_PLACE_LOWEST would
+ * pick a free block in the pages [lo, hi) instead, i.e. one of a lower
+ * order than the frontier's block the request fits in, or one of the same
+ * order lower in address. Return it, or -1 if it is not carved; the
+ * frontier is flushed if it is in the pages but cannot serve the request,
+ * as it would be in the way of the placement policy. One outside the pages
+ * is left alone. The block is committed, and expected to be allocated by
+ * the caller; <*dirty> is set if it may not be all zero.
+ */
+page_idx_t fr_carve(int order, page_idx_t lo, page_idx_t hi, int* dirty);
+
+/* Split the frontier into the free blocks it stands for. Return 1 if there
+ * is one, 0 otherwise.
+ */
+int fr_flush(void);
+
 /* The extend given the exiting allocated block such that it could accommodate
  * at least new_sz bytes.
  */
@@ -159,9 +284,11 @@ add_alloc_block(page_idx_t block, intptr_t sz, int order) {
     set_allocated_blk(pg);
 
     bc_remove_block(block, order, 0);
-    madvise(alloc_info->first_page + block,
-            (1 << order) << alloc_info->page_size_log2,
+    LM_PROF_BEGIN(madv_start);
+    madvise(get_page_addr(block),
+            ((size_t)1 << order) << alloc_info->page_size_log2,
             MADV_DODUMP);
+    LM_PROF_END(LM_PROF_MADVISE, madv_start);
 
     return res;
 }
@@ -193,8 +320,24 @@ migrade_alloc_block(page_idx_t block, int ord_was, int ord_is, size_t new_map_sz
 
 int free_block(page_idx_t page_idx);
 
+/* Take the most recently freed block of <order> starting in the pages
+ * [lo, hi) out of its quick-list, and return it, or -1 if there is none.
+ * The block is dirty, and expected to be allocated by the caller.
+ */
+page_idx_t ql_pop(int order, page_idx_t lo, page_idx_t hi);
+
+/* Merge all the blocks in the quick-lists into the buddy system. Return 1
+ * if there is any, 0 otherwise.
+ */
+int ql_flush(void);
+
+/* Take the free pages in [start, end) out of the buddy system for good. A
+ * free block straddling <end> keeps its part above <end>.
+ */
+void retire_free_pages(page_idx_t start, page_idx_t end);
+
 /* Init & Fini */
-int lm_init_page_alloc(lm_chunk_t* chunk, ljmm_opt_t* mm_opt);
+int lm_init_page_alloc(lm_chunk_t* chunks, int chunk_num, ljmm_opt_t* mm_opt);
 void lm_fini_page_alloc(void);
 
 /* Misc */
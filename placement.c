@@ -0,0 +1,195 @@
+/* This file contains the placement policies of the page allocator. They
+ * differ only in the free block an allocation is carved from; splitting the
+ * block and bookkeeping are done by lm_malloc() alike.
+ *
+ *   o. lowest:     the smallest order that has free blocks, and the lowest
+ *                  block of that order.
+ *   o. two-sided:  like "lowest" for the requests below the large order;
+ *                  large requests are carved from the top of the highest
+ *                  block big enough, so small and large blocks grow from
+ *                  the opposite ends of the chunk, and do not mingle.
+ *   o. segregated: the requests are divided into three size classes, each
+ *                  of which has an anchor: the bottom, the middle and the
+ *                  top of the chunk. A request takes the smallest order
+ *                  that has free blocks, and the block of that order closest
+ *                  to its class's anchor, carved from the side facing the
+ *                  anchor.
+ *   o. next-fit:   the first block big enough at or above the end of the
+ *                  previous allocation, wrapping around at the top.
+ *   o. top-down:   the highest block big enough, carved from its upper end;
+ *                  the allocations grow downward from the top of the chunk.
+ *
+ * "Bottom" and "top" are those of the range of pages the request is confined
+ * to, i.e. the pages below 2G or those above it.
+ */
+#include <sys/mman.h>
+#include "util.h"
+#include "page_alloc.h"
+#include "free_extent.h"
+#include "placement.h"
+
+/* Return the lowest free block of <order> in [lo, hi), or -1 if there is
+ * none.
+ */
+static page_idx_t
+lowest_of_order(int order, page_idx_t lo, page_idx_t hi) {
+    rb_tree_t* rbt = alloc_info->free_blks + order;
+    if (rbt_is_empty(rbt))
+        return -1;
+
+    page_idx_t blk;
+    if (lo == 0)
+        blk = rbt_get_min(rbt);
+    else if (rbt_search_ge(rbt, lo, &blk, NULL) == RBS_FAIL)
+        return -1;
+
+    return blk < hi ? blk : -1;
+}
+
+static page_idx_t
+lowest_pick(int req_order, page_idx_t lo, page_idx_t hi,
+            int* blk_order, int* upper) {
+    int i, e;
+    for (i = req_order, e = alloc_info->max_order; i <= e; i++) {
+        page_idx_t blk = lowest_of_order(i, lo, hi);
+        if (blk >= 0) {
+            *blk_order = i;
+            *upper = 0;
+            return blk;
+        }
+    }
+    return -1;
+}
+
+static page_idx_t
+top_down_pick(int req_order, page_idx_t lo, page_idx_t hi,
+              int* blk_order, int* upper) {
+    page_idx_t blk = fe_find_le(hi - 1, req_order);
+    if (blk < lo)
+        return -1;
+
+    *blk_order = alloc_info->page_info[blk].order;
+    *upper = 1;
+    return blk;
+}
+
+static page_idx_t
+two_sided_pick(int req_order, page_idx_t lo, page_idx_t hi,
+               int* blk_order, int* upper) {
+    if (req_order < alloc_info->large_order)
+        return lowest_pick(req_order, lo, hi, blk_order, upper);
+
+    return top_down_pick(req_order, lo, hi, blk_order, upper);
+}
+
+static page_idx_t
+segregated_pick(int req_order, page_idx_t lo, page_idx_t hi,
+                int* blk_order, int* upper) {
+    int large = alloc_info->large_order;
+    page_idx_t anchor;
+    if (req_order < large / 2)
+        anchor = lo;
+    else if (req_order < large)
+        anchor = lo + (hi - lo) / 2;
+    else
+        anchor = hi;
+
+    int order, e;
+    for (order = req_order, e = alloc_info->max_order; order <= e; order++) {
+        rb_tree_t* rbt = alloc_info->free_blks + order;
+        if (rbt_is_empty(rbt))
+            continue;
+
+        /* The closest blocks of the order on both sides of the anchor */
+        page_idx_t below, above;
+        int has_below = rbt_search_le(rbt, anchor, &below, NULL) != RBS_FAIL &&
+                        below >= lo;
+        int has_above = rbt_search_ge(rbt, anchor, &above, NULL) != RBS_FAIL &&
+                        above < hi;
+        if (!has_below && !has_above)
+            continue;
+
+        *blk_order = order;
+        if (has_below &&
+            (!has_above || anchor - (below + (1 << order)) < above - anchor)) {
+            *upper = 1;
+            return below;
+        }
+
+        *upper = 0;
+        return above;
+    }
+
+    return -1;
+}
+
+static page_idx_t
+next_fit_pick(int req_order, page_idx_t lo, page_idx_t hi,
+              int* blk_order, int* upper) {
+    page_idx_t from = alloc_info->next_fit;
+    if (from < lo || from >= hi)
+        from = lo;
+
+    page_idx_t blk = fe_find_ge(from, req_order);
+    if ((blk < 0 || blk >= hi) && from != lo)
+        blk = fe_find_ge(lo, req_order);
+    if (blk < 0 || blk >= hi)
+        return -1;
+
+    *blk_order = alloc_info->page_info[blk].order;
+    *upper = 0;
+    alloc_info->next_fit = blk + (1 << req_order);
+    return blk;
+}
+
+page_idx_t
+lm_pick_aligned(int req_order, int align_order, page_idx_t lo, page_idx_t hi,
+                int* blk_order) {
+    /* A block smaller than the alignment qualifies only if it starts at an
+     * aligned page; skip to the next aligned page from each misaligned one.
+     */
+    int align = 1 << align_order;
+    int order, e = alloc_info->max_order;
+    for (order = req_order; order < align_order && order <= e; order++) {
+        rb_tree_t* rbt = alloc_info->free_blks + order;
+        if (rbt_is_empty(rbt))
+            continue;
+
+        page_idx_t blk = lo;
+        while (rbt_search_ge(rbt, blk, &blk, NULL) != RBS_FAIL && blk < hi) {
+            int misalign = page_idx_to_id(blk) & (align - 1);
+            if (!misalign) {
+                *blk_order = order;
+                return blk;
+            }
+            blk += align - misalign;
+        }
+    }
+
+    /* Whereas any bigger block starts at an aligned page */
+    for (order = align_order; order <= e; order++) {
+        page_idx_t blk = lowest_of_order(order, lo, hi);
+        if (blk >= 0) {
+            *blk_order = order;
+            return blk;
+        }
+    }
+
+    return -1;
+}
+
+static const lm_placement_t placements[] = {
+    { "lowest",     lowest_pick, 1 },       /* LM_PLACE_LOWEST */
+    { "two-sided",  two_sided_pick, 0 },    /* LM_PLACE_TWO_SIDED */
+    { "segregated", segregated_pick, 0 },   /* LM_PLACE_SEGREGATED */
+    { "next-fit",   next_fit_pick, 0 },     /* LM_PLACE_NEXT_FIT */
+    { "top-down",   top_down_pick, 0 },     /* LM_PLACE_TOP_DOWN */
+};
+
+const lm_placement_t*
+lm_get_placement(ljmm_placement_t kind) {
+    if ((unsigned)kind >= sizeof(placements) / sizeof(placements[0]))
+        return NULL;
+
+    return placements + kind;
+}
@@ -0,0 +1,41 @@
+#ifndef _PLACEMENT_H_
+#define _PLACEMENT_H_
+
+/* Placement policies of the page allocator, i.e. which free block an
+ * allocation is carved from. The policy is chosen with ljmm_opt_t::placement
+ * (see lj_mm.h); lm_malloc() calls its pick() for each allocation.
+ */
+#include "util.h"
+#include "lj_mm.h"
+
+typedef struct {
+    const char* name;
+
+    /* Choose a free block of order no less than <req_order> which starts in
+     * the pages [lo, hi), and return it along with its order (via
+     * <blk_order>), or -1 if there is none. If <upper> is set on return, the
+     * allocation is carved from the upper end of the block, otherwise from
+     * the lower end. No free block straddles <lo> or <hi>.
+     */
+    page_idx_t (*pick)(int req_order, page_idx_t lo, page_idx_t hi,
+                       int* blk_order, int* upper);
+
+    /* Set if the rest of the blocks picked may be split lazily (see
+     * ljmm_opt_t::lazy_split), i.e. if pick() goes by the order first and
+     * the address next, and carves from the lower end, so that fr_carve()
+     * can tell when it would take the rest.
+     */
+    int lazy_split;
+} lm_placement_t;
+
+/* Like pick(), but the block starts at a page whose ID is a multiple of
+ * 1 << <align_order>, which is no less than <req_order>; the allocation is
+ * carved from its lower end. The placement policy is not consulted.
+ */
+page_idx_t lm_pick_aligned(int req_order, int align_order,
+                           page_idx_t lo, page_idx_t hi, int* blk_order);
+
+/* Return the policy of the given kind, or NULL if <kind> is unknown */
+const lm_placement_t* lm_get_placement(ljmm_placement_t kind);
+
+#endif /* _PLACEMENT_H_ */
@@ -0,0 +1,116 @@
+/* Latency histograms, see profile.h for details. */
+#ifdef LJMM_PROFILE
+
+#include <stdio.h>
+#include <string.h>
+#include "profile.h"
+
+static lm_profile_t profile;
+
+static const char* prof_name[LM_PROF_NUM] = {
+    "lm_mmap",
+    "lm_munmap",
+    "lm_mremap",
+    "lm_malloc",
+    "lm_free",
+    "tree-op",
+    "tree-resize",
+    "split",
+    "merge",
+    "bc-evict",
+    "madvise",
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+    #define PROF_UNIT "cycles"
+#else
+    #define PROF_UNIT "ns"
+#endif
+
+void
+lm_prof_record(lm_prof_id_t id, uint64_t elapse) {
+    lm_prof_hist_t* h = profile.hist + id;
+
+    /* Bucket i counts the latencies in [2^i, 2^(i+1)), bucket 0 also
+     * takes 0.
+     */
+    int bucket = elapse ? 63 - __builtin_clzll(elapse) : 0;
+    if (bucket >= LM_PROF_BUCKET_NUM)
+        bucket = LM_PROF_BUCKET_NUM - 1;
+
+    h->buckets[bucket]++;
+    h->count++;
+    h->total += elapse;
+    if (elapse > h->max)
+        h->max = elapse;
+}
+
+const lm_profile_t*
+lm_get_profile(void) {
+    return &profile;
+}
+
+void
+lm_reset_profile(void) {
+    memset(&profile, 0, sizeof(profile));
+}
+
+/* Return the upper bound of the bucket where the given percentile falls. */
+static unsigned long long
+percentile(const lm_prof_hist_t* h, double pct) {
+    unsigned long long target = (unsigned long long)(h->count * pct / 100);
+    unsigned long long acc = 0;
+    int i;
+    for (i = 0; i < LM_PROF_BUCKET_NUM; i++) {
+        acc += h->buckets[i];
+        if (acc > target)
+            break;
+    }
+
+    if (i >= LM_PROF_BUCKET_NUM - 1)
+        return h->max;
+    return 2ull << i;
+}
+
+void
+lm_dump_profile(FILE* f) {
+    fprintf(f, "%-12s %10s %10s %10s %10s %10s %12s  (" PROF_UNIT ")\n",
+            "", "count", "mean", "p50<=", "p99<=", "p99.9<=", "max");
+
+    int id;
+    for (id = 0; id < LM_PROF_NUM; id++) {
+        const lm_prof_hist_t* h = profile.hist + id;
+        if (!h->count)
+            continue;
+
+        fprintf(f, "%-12s %10llu %10.0f %10llu %10llu %10llu %12llu\n",
+                prof_name[id], h->count, (double)h->total / h->count,
+                percentile(h, 50), percentile(h, 99), percentile(h, 99.9),
+                h->max);
+    }
+
+    /* The distribution of the tail: the non-empty buckets above p99 */
+    for (id = 0; id < LM_PROF_NUM; id++) {
+        const lm_prof_hist_t* h = profile.hist + id;
+        if (!h->count)
+            continue;
+
+        unsigned long long p99 = percentile(h, 99);
+        int i, first = 1;
+        for (i = 0; i < LM_PROF_BUCKET_NUM; i++) {
+            if (!h->buckets[i] || (2ull << i) <= p99)
+                continue;
+
+            if (first) {
+                fprintf(f, "%-12s tail:", prof_name[id]);
+                first = 0;
+            }
+            fprintf(f, " [2^%d]=%llu", i, h->buckets[i]);
+        }
+        if (!first)
+            fputc('\n', f);
+    }
+    fflush(f);
+}
+
+#endif /* LJMM_PROFILE */
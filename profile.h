@@ -0,0 +1,68 @@
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+/* Latency histograms of the exported functions and of some internal phases,
+ * compiled in only if LJMM_PROFILE is defined (e.g. "make PROFILE=1").
+ * Otherwise, all the macros below expand to nothing.
+ *
+ *  Usage:
+ *   - To time an entire function, put LM_PROF_SCOPE(id) at the very
+ *     beginning of the function body. The latency is recorded when the
+ *     function returns, whichever return statement is taken.
+ *
+ *   - To time a piece of code:
+ *        LM_PROF_BEGIN(t);
+ *        ... code ...
+ *        LM_PROF_END(LM_PROF_MADVISE, t);
+ *
+ *  The histograms are retrieved via lm_get_profile()/lm_dump_profile().
+ */
+#include <stdint.h>
+#include <time.h>
+#include "lj_mm.h"
+
+/* Return the current time in profiling units, i.e. cycles on x86, and
+ * nanoseconds elsewhere. It is available regardless of LJMM_PROFILE, as
+ * LM_ADAPTIVE times mmap(2) as well.
+ */
+static inline uint64_t
+lm_prof_now(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+#ifdef LJMM_PROFILE
+
+void lm_prof_record(lm_prof_id_t id, uint64_t elapse);
+
+typedef struct {
+    lm_prof_id_t id;
+    uint64_t start;
+} lm_prof_scope_t;
+
+static inline void
+lm_prof_scope_end(lm_prof_scope_t* scope) {
+    lm_prof_record(scope->id, lm_prof_now() - scope->start);
+}
+
+#define LM_PROF_SCOPE(id) \
+    lm_prof_scope_t __lm_prof_scope \
+        __attribute__((cleanup(lm_prof_scope_end))) = { (id), lm_prof_now() }
+
+#define LM_PROF_BEGIN(v)        uint64_t v = lm_prof_now()
+#define LM_PROF_END(id, v)      lm_prof_record((id), lm_prof_now() - (v))
+
+#else
+
+#define LM_PROF_SCOPE(id)       ((void)0)
+#define LM_PROF_BEGIN(v)        ((void)0)
+#define LM_PROF_END(id, v)      ((void)0)
+
+#endif /* LJMM_PROFILE */
+
+#endif /* _PROFILE_H_ */
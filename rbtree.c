@@ -3,6 +3,10 @@
 #include <stdlib.h>
 #include "rbtree.h"
 #include "util.h"
+#include "profile.h"
+
+/* The RB-tree, unless the B+-tree (btree.c) is selected by LJMM_BTREE. */
+#ifndef LJMM_BTREE
 
 #define INVALID_IDX     (-1)
 #define SENTINEL_IDX    0
@@ -11,49 +15,219 @@
 
 #define SWAP(a, b) { typeof(a) t = a; a = b; b = t; }
 
+/* Shorthand of the node of the given index; "rbt" must be in scope. */
+#define NODE(idx)   rbt_node(rbt, (idx))
+
+/****************************************************************************
+ *
+ *                  Node layout
+ *
+ ****************************************************************************
+ */
+
+/* The color is kept in the least significant bit of "parent_color", and the
+ * index of the parent in the remaining bits. The index may be INVALID_IDX,
+ * hence the multiplication and the arithmetic shift.
+ */
+static inline int
+node_parent(const rb_node_t* nd) {
+    return nd->parent_color >> 1;
+}
+
+static inline int
+node_color(const rb_node_t* nd) {
+    return nd->parent_color & 1;
+}
+
+static inline void
+set_parent_color(rb_node_t* nd, int parent, int color) {
+    nd->parent_color = parent * 2 | color;
+}
+
+static inline void
+set_parent(rb_node_t* nd, int parent) {
+    set_parent_color(nd, parent, node_color(nd));
+}
+
+static inline void
+set_color(rb_node_t* nd, int color) {
+    nd->parent_color = (nd->parent_color & ~1) | color;
+}
+
+/****************************************************************************
+ *
+ *                  Segment management
+ *
+ ****************************************************************************
+ */
+
+/* The number of nodes the allocated segments can hold */
+static inline int
+rbt_capacity(const rb_tree_t* rbt) {
+    return rbt->seg_num << RB_SEG_LOG2;
+}
+
+static inline int
+rbt_has_value(const rb_tree_t* rbt) {
+    return rbt->val_segs != NULL;
+}
+
+/* Double the capacity of the directory. Return 1 on success, 0 otherwise. */
+static int
+rbt_grow_dir(rb_tree_t* rbt) {
+    int cap = rbt->seg_cap * 2;
+    rb_node_t** segs;
+    segs = (rb_node_t**)MYREALLOC(rbt->segs, cap * sizeof(rb_node_t*));
+    if (!segs)
+        return 0;
+    rbt->segs = segs;
+
+    if (rbt_has_value(rbt)) {
+        intptr_t** vals;
+        vals = (intptr_t**)MYREALLOC(rbt->val_segs, cap * sizeof(intptr_t*));
+        if (!vals)
+            return 0;
+        rbt->val_segs = vals;
+    }
+
+    rbt->seg_cap = cap;
+    return 1;
+}
+
+/* Allocate one more segment. Return 1 on success, 0 otherwise. */
+static int
+rbt_add_seg(rb_tree_t* rbt) {
+    int seg = rbt->seg_num;
+    if (seg == rbt->seg_cap && !rbt_grow_dir(rbt))
+        return 0;
+
+    LM_PROF_BEGIN(resize_start);
+    rb_node_t* nodes = (rb_node_t*)MYMALLOC(RB_SEG_SZ * sizeof(rb_node_t));
+    if (!nodes)
+        return 0;
+
+    if (rbt_has_value(rbt)) {
+        intptr_t* vals = (intptr_t*)MYMALLOC(RB_SEG_SZ * sizeof(intptr_t));
+        if (!vals) {
+            MYFREE((void*)nodes);
+            return 0;
+        }
+        rbt->val_segs[seg] = vals;
+    }
+    LM_PROF_END(LM_PROF_TREE_RESIZE, resize_start);
+
+    rbt->segs[seg] = nodes;
+    rbt->seg_num++;
+    return 1;
+}
+
+/* Free the last segment */
+static void
+rbt_free_seg(rb_tree_t* rbt) {
+    int seg = --rbt->seg_num;
+    MYFREE((void*)rbt->segs[seg]);
+    if (rbt_has_value(rbt))
+        MYFREE((void*)rbt->val_segs[seg]);
+}
+
+/* Free the last segment once the tree shrinks to half a segment below it.
+ * An emptied segment is hence kept, and reused, as long as the tree stays
+ * around a segment boundary, rather than being freed and allocated again
+ * and again.
+ */
+static void
+rbt_try_shrink(rb_tree_t* rbt) {
+    while (rbt->seg_num > 1 &&
+           rbt->node_num <= rbt_capacity(rbt) - RB_SEG_SZ * 3 / 2) {
+        rbt_free_seg(rbt);
+    }
+}
+
 /****************************************************************************
  *
  *                  Constructors & Destructors
  *
  ****************************************************************************
  */
-int
-rbt_init(rb_tree_t* rbt) {
-    rbt->capacity = 16;
-    rbt->tree = (rb_node_t*)MYMALLOC(rbt->capacity * sizeof(rb_node_t));
-    if (rbt->tree == 0)
+static int
+rbt_init_helper(rb_tree_t* rbt, int is_set) {
+    rbt->seg_num = 0;
+    rbt->seg_cap = 4;
+    rbt->segs = (rb_node_t**)MYMALLOC(rbt->seg_cap * sizeof(rb_node_t*));
+    rbt->val_segs = NULL;
+    if (!rbt->segs)
+        return 0;
+
+    if (!is_set) {
+        rbt->val_segs =
+            (intptr_t**)MYMALLOC(rbt->seg_cap * sizeof(intptr_t*));
+        if (!rbt->val_segs) {
+            MYFREE((void*)rbt->segs);
+            return 0;
+        }
+    }
+
+    if (!rbt_add_seg(rbt)) {
+        MYFREE((void*)rbt->segs);
+        MYFREE((void*)rbt->val_segs);
         return 0;
+    }
 
     rbt->root = SENTINEL_IDX;
     rbt->node_num = 1; /* sentinel */
 
     /* Init the sentinel */
-    rb_node_t* s = rbt->tree;
-    s->left = s->right = s->parent = INVALID_IDX;
-    s->color = RB_BLACK;
+    rb_node_t* s = NODE(SENTINEL_IDX);
+    s->left = s->right = INVALID_IDX;
+    set_parent_color(s, INVALID_IDX, RB_BLACK);
 
     return 1;
 }
 
+int
+rbt_init(rb_tree_t* rbt) {
+    return rbt_init_helper(rbt, 0);
+}
+
+int
+rbt_init_set(rb_tree_t* rbt) {
+    return rbt_init_helper(rbt, 1);
+}
+
 void
 rbt_fini(rb_tree_t* rbt) {
-    if (rbt && rbt->tree) {
-        MYFREE((void*)rbt->tree);
-        rbt->tree = 0;
-        rbt->capacity = rbt->node_num = 0;
+    if (rbt && rbt->segs) {
+        while (rbt->seg_num)
+            rbt_free_seg(rbt);
+        MYFREE((void*)rbt->segs);
+        MYFREE((void*)rbt->val_segs);
+        rbt->segs = NULL;
+        rbt->val_segs = NULL;
+        rbt->seg_cap = rbt->node_num = 0;
         rbt->root = INVALID_IDX;
     }
 }
 
-rb_tree_t*
-rbt_create(void) {
+static rb_tree_t*
+rbt_create_helper(int is_set) {
     rb_tree_t* rbt = (rb_tree_t*)MYMALLOC(sizeof(rb_tree_t));
-    if (rbt && rbt_init(rbt))
+    if (rbt && rbt_init_helper(rbt, is_set))
         return rbt;
 
+    MYFREE((void*)rbt);
     return NULL;
 }
 
+rb_tree_t*
+rbt_create(void) {
+    return rbt_create_helper(0);
+}
+
+rb_tree_t*
+rbt_create_set(void) {
+    return rbt_create_helper(1);
+}
+
 void
 rbt_destroy(rb_tree_t* rbt) {
     if (rbt) {
@@ -90,26 +264,24 @@ update_kid(rb_node_t* dad, int kid_was, int kid_is) {
 }
 
 static void
-rbt_left_rotate(rb_tree_t* rbt, rb_node_t* node) {
-    rb_node_t* nd_vect = rbt->tree;
-
-    int node_idx = node - nd_vect;
+rbt_left_rotate(rb_tree_t* rbt, int node_idx) {
+    rb_node_t* node = NODE(node_idx);
     int kid_idx = node->right;
-    int par_idx = node->parent;
+    int par_idx = node_parent(node);
 
-    rb_node_t* kid = nd_vect + kid_idx;
+    rb_node_t* kid = NODE(kid_idx);
     if (kid->left != INVALID_IDX) {
-        nd_vect[kid->left].parent = node_idx;
+        set_parent(NODE(kid->left), node_idx);
     }
 
     node->right = kid->left;
-    node->parent = kid_idx;
+    set_parent(node, kid_idx);
 
     kid->left = node_idx;
-    kid->parent = par_idx;
+    set_parent(kid, par_idx);
 
     if (par_idx != INVALID_IDX) {
-        rb_node_t* dad = nd_vect + par_idx;
+        rb_node_t* dad = NODE(par_idx);
         if (dad->left == node_idx)
             dad->left = kid_idx;
         else {
@@ -122,25 +294,23 @@ rbt_left_rotate(rb_tree_t* rbt, rb_node_t* node) {
 }
 
 static void
-rbt_right_rotate(rb_tree_t* rbt, rb_node_t* node) {
-    rb_node_t* nd_vect = rbt->tree;
-
-    int node_idx = node - nd_vect;
+rbt_right_rotate(rb_tree_t* rbt, int node_idx) {
+    rb_node_t* node = NODE(node_idx);
     int kid_idx = node->left;
-    int par_idx = node->parent;
+    int par_idx = node_parent(node);
 
-    rb_node_t* kid = nd_vect + kid_idx;
+    rb_node_t* kid = NODE(kid_idx);
     if (kid->right != INVALID_IDX) {
-        nd_vect[kid->right].parent = node_idx;
+        set_parent(NODE(kid->right), node_idx);
     }
     node->left = kid->right;
-    node->parent = kid_idx;
+    set_parent(node, kid_idx);
 
     kid->right = node_idx;
-    kid->parent = par_idx;
+    set_parent(kid, par_idx);
 
     if (par_idx != INVALID_IDX) {
-        rb_node_t* dad = nd_vect + par_idx;
+        rb_node_t* dad = NODE(par_idx);
         if (dad->left == node_idx)
             dad->left = kid_idx;
         else {
@@ -152,22 +322,6 @@ rbt_right_rotate(rb_tree_t* rbt, rb_node_t* node) {
     }
 }
 
-/* Try to shrink the node vector */
-static int
-rbt_try_shrink(rb_tree_t* rbt) {
-    if (rbt->capacity < 2*rbt->node_num ||
-        rbt->capacity < 32)
-        return 1;
-
-    int cap = rbt->node_num * 3 / 2;
-    rbt->tree = (rb_node_t*)MYREALLOC(rbt->tree, cap * sizeof(rb_node_t));
-    if (rbt->tree == 0)
-        return 0;
-
-    rbt->capacity = cap;
-    return 1;
-}
-
 /****************************************************************************
  *
  *              Binary-search-tree operations
@@ -180,17 +334,15 @@ rbt_try_shrink(rb_tree_t* rbt) {
  */
 inline static int
 bst_search(rb_tree_t* rbt, int key) {
-    rb_node_t* nd_vect = rbt->tree;
-    rb_node_t* sentinel = rbt->tree;
-
-    rb_node_t* cur = nd_vect + rbt->root;
-    while (cur != sentinel) {
-        if (less_than(cur, key))
-            cur = nd_vect + cur->left;
-        else if (greater_than(cur, key))
-            cur = nd_vect + cur->right;
+    int cur = rbt->root;
+    while (cur != SENTINEL_IDX) {
+        rb_node_t* nd = NODE(cur);
+        if (less_than(nd, key))
+            cur = nd->left;
+        else if (greater_than(nd, key))
+            cur = nd->right;
         else
-            return cur - nd_vect;
+            return cur;
     }
 
     return INVALID_IDX;
@@ -205,20 +357,9 @@ bst_search(rb_tree_t* rbt, int key) {
  */
 static int
 bst_insert(rb_tree_t* t, int key, intptr_t value) {
-    rb_node_t* nodes = t->tree;
-
-    /* Resize the vector if necessary */
-    if (t->capacity <= t->node_num) {
-        int cap = t->node_num * 3/2;
-        if (cap <= 16)
-            cap = 16;
-
-        nodes = t->tree = (rb_node_t*)MYREALLOC(nodes, cap * sizeof(rb_node_t));
-        t->capacity = cap;
-
-        if (!nodes)
-            return INVALID_IDX;
-    }
+    /* Add a segment if necessary */
+    if (rbt_capacity(t) <= t->node_num && !rbt_add_seg(t))
+        return INVALID_IDX;
 
     /* The tree is empty */
     if (unlikely(t->root == SENTINEL_IDX)) {
@@ -226,12 +367,12 @@ bst_insert(rb_tree_t* t, int key, intptr_t value) {
         t->root = root_id;
         t->node_num = 2;
 
-        rb_node_t* root = nodes + root_id;
+        rb_node_t* root = rbt_node(t, root_id);
         root->key       = key;
-        root->value     = value;
         root->left      = root->right = SENTINEL_IDX;
-        root->parent    = INVALID_IDX;
-        root->color     = RB_BLACK;
+        set_parent_color(root, INVALID_IDX, RB_BLACK);
+        if (rbt_has_value(t))
+            *rbt_value(t, root_id) = value;
 
         return root_id;
     }
@@ -239,16 +380,17 @@ bst_insert(rb_tree_t* t, int key, intptr_t value) {
     /* Insert the value in the tree. Care must be taken to avoid inserting a
      * value which is already in the tree.
      */
+    int prev_idx = SENTINEL_IDX;
     rb_node_t* prev = 0;
-    rb_node_t* cur = nodes + t->root;
-    rb_node_t* sentinel = nodes;
-
-    while (cur != sentinel) {
-        prev = cur;
-        if (less_than(cur, key))
-            cur = nodes + cur->left;
-        else if (greater_than(cur, key))
-            cur = nodes + cur->right;
+    int cur = t->root;
+
+    while (cur != SENTINEL_IDX) {
+        prev_idx = cur;
+        prev = rbt_node(t, cur);
+        if (less_than(prev, key))
+            cur = prev->left;
+        else if (greater_than(prev, key))
+            cur = prev->right;
         else {
             /* the value is already in the tree */
             return INVALID_IDX;
@@ -256,12 +398,12 @@ bst_insert(rb_tree_t* t, int key, intptr_t value) {
     }
 
     int new_nd_idx = t->node_num++;
-    rb_node_t* new_nd = nodes + new_nd_idx;
+    rb_node_t* new_nd = rbt_node(t, new_nd_idx);
     new_nd->key = key;
-    new_nd->value = value;
-    new_nd->parent = prev - nodes;
     new_nd->left = new_nd->right = SENTINEL_IDX;
-    new_nd->color = RB_RED;
+    set_parent_color(new_nd, prev_idx, RB_RED);
+    if (rbt_has_value(t))
+        *rbt_value(t, new_nd_idx) = value;
 
     if (less_than(prev, key))
         prev->left = new_nd_idx;
@@ -285,7 +427,7 @@ rbt_search(rb_tree_t* rbt, int key, intptr_t* value) {
     int nd_idx = bst_search(rbt, key);
     if (nd_idx != INVALID_IDX) {
         if (value)
-            *value = rbt->tree[nd_idx].value;
+            *value = rbt_has_value(rbt) ? *rbt_value(rbt, nd_idx) : 0;
         return RBS_EXACT;
     }
     return RBS_FAIL;
@@ -297,24 +439,21 @@ rbt_search_variant(rb_tree_t* rbt, int key, int* res_key, intptr_t* res_value,
     if (unlikely(rbt_is_empty(rbt)))
         return RBS_FAIL;
 
-    rb_node_t* nd_vect = rbt->tree;
-    rb_node_t* sentinel = rbt->tree;
-
-    rb_node_t* cur = nd_vect + rbt->root;
-
-    rb_node_t* last_left, *last_right;
-    last_left = last_right = NULL;
+    int cur = rbt->root;
+    int last_left, last_right;
+    last_left = last_right = INVALID_IDX;
 
     RBS_RESULT res = RBS_FAIL;
-    rb_node_t* res_elemt = NULL;
+    int res_elemt = INVALID_IDX;
 
-    while (cur != sentinel) {
-        if (less_than(cur, key)) {
+    while (cur != SENTINEL_IDX) {
+        rb_node_t* nd = NODE(cur);
+        if (less_than(nd, key)) {
             last_left = cur;
-            cur = nd_vect + cur->left;
-        } else if (greater_than(cur, key)) {
+            cur = nd->left;
+        } else if (greater_than(nd, key)) {
             last_right = cur;
-            cur = nd_vect + cur->right;
+            cur = nd->right;
         } else {
             res = RBS_EXACT;
             res_elemt = cur;
@@ -324,11 +463,11 @@ rbt_search_variant(rb_tree_t* rbt, int key, int* res_key, intptr_t* res_value,
 
     if (res == RBS_FAIL) {
         if (le) {
-            if (last_right) {
+            if (last_right != INVALID_IDX) {
                 res_elemt = last_right;
                 res = RBS_LESS;
             }
-        } else if (last_left) {
+        } else if (last_left != INVALID_IDX) {
             res_elemt = last_left;
             res = RBS_GREATER;
         }
@@ -336,10 +475,10 @@ rbt_search_variant(rb_tree_t* rbt, int key, int* res_key, intptr_t* res_value,
 
     if (res != RBS_FAIL) {
         if (res_key)
-            *res_key = res_elemt->key;
+            *res_key = NODE(res_elemt)->key;
 
         if (res_value)
-            *res_value = res_elemt->value;
+            *res_value = rbt_has_value(rbt) ? *rbt_value(rbt, res_elemt) : 0;
     }
 
     return res;
@@ -349,18 +488,21 @@ int
 rbt_get_min(rb_tree_t* rbt) {
     ASSERT(!rbt_is_empty(rbt));
 
-    rb_node_t* nd_vect = rbt->tree;
-    rb_node_t* root = nd_vect + rbt->root;
-    rb_node_t* node = 0;
-    if (root->left != SENTINEL_IDX)
-        node = nd_vect + root->left;
-    else if (root->right != SENTINEL_IDX)
-        node = nd_vect + root->right;
-    else
-        node = root;
-
+    rb_node_t* node = NODE(rbt->root);
     while (node->left != SENTINEL_IDX) {
-        node = nd_vect + node->left;
+        node = NODE(node->left);
+    }
+
+    return node->key;
+}
+
+int
+rbt_get_max(rb_tree_t* rbt) {
+    ASSERT(!rbt_is_empty(rbt));
+
+    rb_node_t* node = NODE(rbt->root);
+    while (node->right != SENTINEL_IDX) {
+        node = NODE(node->right);
     }
 
     return node->key;
@@ -368,51 +510,109 @@ rbt_get_min(rb_tree_t* rbt) {
 
 int
 rbt_set_value(rb_tree_t* rbt, int key, intptr_t value) {
-    if (unlikely(rbt_is_empty(rbt)))
+    if (unlikely(rbt_is_empty(rbt) || !rbt_has_value(rbt)))
         return 0;
 
     int nd_idx = bst_search(rbt, key);
     if (nd_idx != INVALID_IDX) {
-        rbt->tree[nd_idx].value = value;
+        *rbt_value(rbt, nd_idx) = value;
         return 1;
     }
     return 0;
 }
 
+rb_iter_t
+rbt_iter_first(rb_tree_t* rbt) {
+    int idx = rbt->root;
+    if (idx == SENTINEL_IDX)
+        return idx;
+
+    while (NODE(idx)->left != SENTINEL_IDX)
+        idx = NODE(idx)->left;
+    return idx;
+}
+
+/* Return the in-order successor of the node, or the sentinel if it is the
+ * last one.
+ */
+rb_iter_t
+rbt_iter_next(rb_tree_t* rbt, rb_iter_t iter) {
+    rb_node_t* nd = NODE(iter);
+    if (nd->right != SENTINEL_IDX) {
+        iter = nd->right;
+        while (NODE(iter)->left != SENTINEL_IDX)
+            iter = NODE(iter)->left;
+        return iter;
+    }
+
+    /* Climb up until coming from a left kid */
+    int dad = node_parent(nd);
+    while (dad != INVALID_IDX && NODE(dad)->right == iter) {
+        iter = dad;
+        dad = node_parent(NODE(dad));
+    }
+
+    return dad == INVALID_IDX ? SENTINEL_IDX : dad;
+}
+
+rb_iter_t
+rbt_iter_seek(rb_tree_t* rbt, int key) {
+    int res = SENTINEL_IDX;
+
+    int cur = rbt->root;
+    while (cur != SENTINEL_IDX) {
+        rb_node_t* nd = NODE(cur);
+        if (less_than(nd, key)) {
+            res = cur;
+            cur = nd->left;
+        } else if (greater_than(nd, key)) {
+            cur = nd->right;
+        } else {
+            return cur;
+        }
+    }
+
+    return res;
+}
+
 int
 rbt_insert(rb_tree_t* rbt, int key, intptr_t value) {
+    LM_PROF_SCOPE(LM_PROF_TREE_OP);
+
     /* step 1: insert the key/val pair into the binary-search-tree */
-    int nd_idx = bst_insert(rbt, key, value);
-    if (nd_idx == INVALID_IDX)
+    int cur = bst_insert(rbt, key, value);
+    if (cur == INVALID_IDX)
         return 0;
 
     /* step 2: Perform color fix up */
-    rb_node_t* nd_vect = rbt->tree;
-    rb_node_t* cur = nd_vect + nd_idx;
-
-    while (cur->parent != INVALID_IDX && nd_vect[cur->parent].color == RB_RED) {
-        rb_node_t* dad = nd_vect + cur->parent;
-        rb_node_t* grandpar = nd_vect + dad->parent;
-
-        if (nd_vect + grandpar->left == dad) {
-            rb_node_t* uncle = nd_vect + grandpar->right;
+    while (node_parent(NODE(cur)) != INVALID_IDX &&
+           node_color(NODE(node_parent(NODE(cur)))) == RB_RED) {
+        int dad_idx = node_parent(NODE(cur));
+        rb_node_t* dad = NODE(dad_idx);
+        int grandpar_idx = node_parent(dad);
+        rb_node_t* grandpar = NODE(grandpar_idx);
+
+        if (grandpar->left == dad_idx) {
+            rb_node_t* uncle = NODE(grandpar->right);
             /* case 1: Both parent and uncle are in red. Just flip the color
              * of parent, uncle and grand-parent.
              */
-            if (uncle->color == RB_RED) {
-                grandpar->color = RB_RED;
-                dad->color = uncle->color = RB_BLACK;
-                cur = grandpar;
+            if (node_color(uncle) == RB_RED) {
+                set_color(grandpar, RB_RED);
+                set_color(dad, RB_BLACK);
+                set_color(uncle, RB_BLACK);
+                cur = grandpar_idx;
                 continue;
             }
 
             /* case 2: Parent and uncle's color are different (i.e. parent in
              * red, uncle in black), and "cur" is parent's *RIGHT* kid.
              */
-            if (dad->right + nd_vect == cur) {
+            if (dad->right == cur) {
                 /* left rotate around parent */
-                rbt_left_rotate(rbt, dad);
-                SWAP(cur, dad);
+                rbt_left_rotate(rbt, dad_idx);
+                SWAP(cur, dad_idx);
+                dad = NODE(dad_idx);
 
                 /* Fall through to case 3 */
             }
@@ -420,20 +620,21 @@ rbt_insert(rb_tree_t* rbt, int key, intptr_t value) {
             /* case 3: The condition is the same as case 2, except that 'cur'
              *  is the *LEFT* kid of the parent.
              */
-            rbt_right_rotate(rbt, grandpar);
-            dad->color = RB_BLACK;
-            grandpar->color = RB_RED;
+            rbt_right_rotate(rbt, grandpar_idx);
+            set_color(dad, RB_BLACK);
+            set_color(grandpar, RB_RED);
 
             break; /* we are done, almost*/
         } else {
-            rb_node_t* uncle = nd_vect + grandpar->left;
+            rb_node_t* uncle = NODE(grandpar->left);
             /* case 1': Both parent and uncle are in red. Just flip the color
              * of parent, uncle and grand-parent.
              */
-            if (uncle->color == RB_RED) {
-                grandpar->color = RB_RED;
-                dad->color = uncle->color = RB_BLACK;
-                cur = grandpar;
+            if (node_color(uncle) == RB_RED) {
+                set_color(grandpar, RB_RED);
+                set_color(dad, RB_BLACK);
+                set_color(uncle, RB_BLACK);
+                cur = grandpar_idx;
                 continue;
             }
 
@@ -441,88 +642,89 @@ rbt_insert(rb_tree_t* rbt, int key, intptr_t value) {
             /* case 2': Parent and uncle's color are different (i.e. parent in
              * red, uncle in black), and "cur" is parent's *LEFT* kid.
              */
-            if (dad->left + nd_vect == cur) {
+            if (dad->left == cur) {
                 /* left rotate around parent */
-                rbt_right_rotate(rbt, dad);
-                SWAP(cur, dad);
+                rbt_right_rotate(rbt, dad_idx);
+                SWAP(cur, dad_idx);
+                dad = NODE(dad_idx);
                 /* Fall through to case 3 */
             }
 
             /* case 3: The condition is the same as case 2, except that 'cur'
              *  is the *RIGHT* kid of the parent.
              */
-            rbt_left_rotate(rbt, grandpar);
-            dad->color = RB_BLACK;
-            grandpar->color = RB_RED;
+            rbt_left_rotate(rbt, grandpar_idx);
+            set_color(dad, RB_BLACK);
+            set_color(grandpar, RB_RED);
 
             break;
         }
     }
 
     /* make sure the root is in black */
-    nd_vect[rbt->root].color = RB_BLACK;
+    set_color(NODE(rbt->root), RB_BLACK);
 
     return 1;
 }
 
 static void
 rbt_delete_fixup(rb_tree_t* rbt, int node_idx) {
-    rb_node_t* nd_vect = rbt->tree;
-    while (node_idx != rbt->root && nd_vect[node_idx].color == RB_BLACK) {
-        rb_node_t* node = nd_vect + node_idx;
-        rb_node_t* dad = nd_vect + node->parent;
+    while (node_idx != rbt->root && node_color(NODE(node_idx)) == RB_BLACK) {
+        rb_node_t* node = NODE(node_idx);
+        int dad_idx = node_parent(node);
+        rb_node_t* dad = NODE(dad_idx);
 
         if (dad->left == node_idx) {
             int sibling_idx = dad->right;
-            rb_node_t* sibling = nd_vect + sibling_idx;
+            rb_node_t* sibling = NODE(sibling_idx);
 
             /* case 1: sibling is in red color. Rotate around dad. */
-            if (sibling->color == RB_RED) {
-                sibling->color = RB_BLACK;
-                dad->color = RB_RED;
-                rbt_left_rotate(rbt, dad);
+            if (node_color(sibling) == RB_RED) {
+                set_color(sibling, RB_BLACK);
+                set_color(dad, RB_RED);
+                rbt_left_rotate(rbt, dad_idx);
 
                 /* Both "current" node and its parent remain unchanged, but
                  * sibling is changed.
                  */
                 sibling_idx = dad->right;
-                sibling = nd_vect + sibling_idx;
+                sibling = NODE(sibling_idx);
             }
 
-            ASSERT(sibling->color == RB_BLACK);
-            rb_node_t* slk = nd_vect + sibling->left;
-            rb_node_t* srk = nd_vect + sibling->right;
+            ASSERT(node_color(sibling) == RB_BLACK);
+            rb_node_t* slk = NODE(sibling->left);
+            rb_node_t* srk = NODE(sibling->right);
 
-            if (slk->color == RB_BLACK && srk->color == RB_BLACK) {
+            if (node_color(slk) == RB_BLACK && node_color(srk) == RB_BLACK) {
                 /* case 2: sibling's both kids are in black. Set sibling's
                  * color to be red.
                  */
-                sibling->color = RB_RED;
-                node_idx = dad - nd_vect;
+                set_color(sibling, RB_RED);
+                node_idx = dad_idx;
             } else {
-                if (srk->color == RB_BLACK) {
+                if (node_color(srk) == RB_BLACK) {
                     /* case 3: sibling's right kid is in black, while the left
                      * kid in in red.
                      */
-                    slk->color = RB_BLACK;
-                    sibling->color = RB_RED;
-                    rbt_right_rotate(rbt, sibling);
+                    set_color(slk, RB_BLACK);
+                    set_color(sibling, RB_RED);
+                    rbt_right_rotate(rbt, sibling_idx);
 
                     sibling = slk;
-                    sibling_idx = sibling - nd_vect;
+                    sibling_idx = dad->right;
                 }
 
                 /* case 4: sibling's right kid is in red */
-                rbt_left_rotate(rbt, dad);
+                rbt_left_rotate(rbt, dad_idx);
 
                 /* Now dad is still dad, sibling become grand-parent. Propagate
                  * dad's color to grandpar.
                  */
-                sibling->color = dad->color;
+                set_color(sibling, node_color(dad));
 
                 /* dad and new uncle are in black */
-                dad->color = RB_BLACK;
-                nd_vect[sibling->right].color = RB_BLACK;
+                set_color(dad, RB_BLACK);
+                set_color(NODE(sibling->right), RB_BLACK);
 
                 break;
             }
@@ -530,55 +732,55 @@ rbt_delete_fixup(rb_tree_t* rbt, int node_idx) {
 
         } else {
             int sibling_idx = dad->left;
-            rb_node_t* sibling = nd_vect + sibling_idx;
+            rb_node_t* sibling = NODE(sibling_idx);
 
             /* case 1': sibling is in red color. Rotate around dad. */
-            if (sibling->color == RB_RED) {
-                sibling->color = RB_BLACK;
-                dad->color = RB_RED;
-                rbt_right_rotate(rbt, dad);
+            if (node_color(sibling) == RB_RED) {
+                set_color(sibling, RB_BLACK);
+                set_color(dad, RB_RED);
+                rbt_right_rotate(rbt, dad_idx);
 
                 /* Both "current" node and its parent remain unchanged, but
                  * sibling is changed.
                  */
                 sibling_idx = dad->left;
-                sibling = nd_vect + sibling_idx;
+                sibling = NODE(sibling_idx);
             }
 
-            ASSERT(sibling->color == RB_BLACK);
-            rb_node_t* slk = nd_vect + sibling->right;
-            rb_node_t* srk = nd_vect + sibling->left;
+            ASSERT(node_color(sibling) == RB_BLACK);
+            rb_node_t* slk = NODE(sibling->right);
+            rb_node_t* srk = NODE(sibling->left);
 
-            if (slk->color == RB_BLACK && srk->color == RB_BLACK) {
+            if (node_color(slk) == RB_BLACK && node_color(srk) == RB_BLACK) {
                 /* case 2': sibling's both kids are in black. Set sibling's
                  * color to be red.
                  */
-                sibling->color = RB_RED;
-                node_idx = dad - nd_vect;
+                set_color(sibling, RB_RED);
+                node_idx = dad_idx;
             } else {
-                if (srk->color == RB_BLACK) {
+                if (node_color(srk) == RB_BLACK) {
                     /* case 3': sibling's left kid is in black, while the right
                      * kid in in red.
                      */
-                    slk->color = RB_BLACK;
-                    sibling->color = RB_RED;
-                    rbt_left_rotate(rbt, sibling);
+                    set_color(slk, RB_BLACK);
+                    set_color(sibling, RB_RED);
+                    rbt_left_rotate(rbt, sibling_idx);
 
                     sibling = slk;
-                    sibling_idx = sibling - nd_vect;
+                    sibling_idx = dad->left;
                 }
 
                 /* case 4': sibling's left kid is in red */
-                rbt_right_rotate(rbt, dad);
+                rbt_right_rotate(rbt, dad_idx);
 
                 /* Now dad is still dad, sibling become grand-parent. Propagate
                  * dad's color to grandpar.
                  */
-                sibling->color = dad->color;
+                set_color(sibling, node_color(dad));
 
                 /* dad and new uncle are in black */
-                dad->color = RB_BLACK;
-                nd_vect[sibling->left].color = RB_BLACK;
+                set_color(dad, RB_BLACK);
+                set_color(NODE(sibling->left), RB_BLACK);
 
                 break;
             }
@@ -586,57 +788,58 @@ rbt_delete_fixup(rb_tree_t* rbt, int node_idx) {
         }
     }
 
-    nd_vect[node_idx].color = RB_BLACK;
+    set_color(NODE(node_idx), RB_BLACK);
 }
 
 int
 rbt_delete(rb_tree_t* rbt, int key, intptr_t* val) {
+    LM_PROF_SCOPE(LM_PROF_TREE_OP);
+
     /* step 1: find the element to be deleted */
     int nd_idx = bst_search(rbt, key);
     if (nd_idx == INVALID_IDX)
         return 0;
 
+    int has_value = rbt_has_value(rbt);
     if (val)
-        *val = rbt->tree[nd_idx].value;
+        *val = has_value ? *rbt_value(rbt, nd_idx) : 0;
 
     /* step 2: delete the element as we normally do with a binary-search tree */
-    rb_node_t* nd_vect = rbt->tree;
-    rb_node_t* node = nd_vect + nd_idx; /* the node being deleted*/
+    rb_node_t* node = NODE(nd_idx); /* the node being deleted*/
 
     int splice_out_idx;
     if (node->left == SENTINEL_IDX || node->right == SENTINEL_IDX) {
         splice_out_idx = nd_idx;
     } else {
         /* Get the successor of the node corrponding to nd_idx */
-        rb_node_t* succ = nd_vect + node->right;
-        while (succ->left != SENTINEL_IDX)
-            succ = nd_vect + succ->left;
-
-        splice_out_idx = succ - nd_vect;
+        splice_out_idx = node->right;
+        while (NODE(splice_out_idx)->left != SENTINEL_IDX)
+            splice_out_idx = NODE(splice_out_idx)->left;
     }
 
-    rb_node_t* splice_out = nd_vect + splice_out_idx;
+    rb_node_t* splice_out = NODE(splice_out_idx);
 
     int so_kid_idx = (splice_out->left != SENTINEL_IDX) ?
                       splice_out->left : splice_out->right;
 
-    rb_node_t* so_kid = nd_vect + so_kid_idx;
+    rb_node_t* so_kid = NODE(so_kid_idx);
 
-    if (splice_out->parent != INVALID_IDX) {
-        update_kid(nd_vect + splice_out->parent, splice_out_idx/*was*/, so_kid_idx);
+    if (node_parent(splice_out) != INVALID_IDX) {
+        update_kid(NODE(node_parent(splice_out)), splice_out_idx/*was*/, so_kid_idx);
     } else {
         ASSERT(rbt->root == splice_out_idx);
         rbt->root = so_kid_idx;
     }
-    so_kid->parent = splice_out->parent;
+    set_parent(so_kid, node_parent(splice_out));
 
     if (splice_out_idx != nd_idx) {
-        nd_vect[nd_idx].key = splice_out->key;
-        nd_vect[nd_idx].value = splice_out->value;
+        node->key = splice_out->key;
+        if (has_value)
+            *rbt_value(rbt, nd_idx) = *rbt_value(rbt, splice_out_idx);
     }
 
     /* step 3: color fix up */
-    if (splice_out->color == RB_BLACK) {
+    if (node_color(splice_out) == RB_BLACK) {
         rbt_delete_fixup(rbt, so_kid_idx);
     }
 
@@ -650,21 +853,95 @@ rbt_delete(rb_tree_t* rbt, int key, intptr_t* val) {
      */
     if (splice_out_idx + 1 != rbt->node_num) {
         int last_idx = rbt->node_num - 1;
-        rb_node_t* last = nd_vect + last_idx;
+        rb_node_t* last = NODE(last_idx);
         *splice_out = *last;
-        if (last->parent != INVALID_IDX) {
-            update_kid(nd_vect + last->parent, last_idx, splice_out_idx);
+        if (has_value)
+            *rbt_value(rbt, splice_out_idx) = *rbt_value(rbt, last_idx);
+        if (node_parent(last) != INVALID_IDX) {
+            update_kid(NODE(node_parent(last)), last_idx, splice_out_idx);
         } else {
             ASSERT(rbt->root == last_idx);
             rbt->root = splice_out_idx;
         }
-        nd_vect[last->left].parent = splice_out_idx;
-        nd_vect[last->right].parent = splice_out_idx;
+        set_parent(NODE(last->left), splice_out_idx);
+        set_parent(NODE(last->right), splice_out_idx);
     }
 
     rbt->node_num--;
-    nd_vect[rbt->root].color = RB_BLACK;
-    return rbt_try_shrink(rbt);
+    set_color(NODE(rbt->root), RB_BLACK);
+    rbt_try_shrink(rbt);
+    return 1;
+}
+
+/****************************************************************************
+ *
+ *              Bulk construction
+ *
+ ****************************************************************************
+ */
+
+/* Helper of rbt_build_sorted(). Link the nodes [lo, hi] into a balanced
+ * subtree rooted at their midpoint, and return the index of the root.
+ *
+ * Since the sizes of the two halves differ by at most one, all levels but
+ * the deepest one are full. Hence painting the nodes at the deepest level
+ * (i.e. at depth <red_depth>) red and all others black yields a valid
+ * RB-tree.
+ */
+static int
+build_subtree(rb_tree_t* rbt, int lo, int hi, int parent, int depth,
+              int red_depth) {
+    if (lo > hi)
+        return SENTINEL_IDX;
+
+    int mid = lo + (hi - lo) / 2;
+    rb_node_t* nd = NODE(mid);
+    set_parent_color(nd, parent, (depth == red_depth) ? RB_RED : RB_BLACK);
+    nd->left = build_subtree(rbt, lo, mid - 1, mid, depth + 1, red_depth);
+    nd->right = build_subtree(rbt, mid + 1, hi, mid, depth + 1, red_depth);
+
+    return mid;
+}
+
+int
+rbt_build_sorted(rb_tree_t* rbt, const int* keys, const intptr_t* vals,
+                 int n) {
+    if (!rbt_is_empty(rbt) || n < 0)
+        return 0;
+
+    int i;
+    for (i = 1; i < n; i++) {
+        if (keys[i - 1] >= keys[i])
+            return 0;
+    }
+
+    if (n == 0)
+        return 1;
+
+    /* Allocate all the segments at once */
+    while (rbt_capacity(rbt) < n + 1) {
+        if (!rbt_add_seg(rbt)) {
+            rbt_try_shrink(rbt);
+            return 0;
+        }
+    }
+
+    /* The nodes are laid out in ascending order of their keys, right after
+     * the sentinel.
+     */
+    for (i = 0; i < n; i++)
+        NODE(i + 1)->key = keys[i];
+
+    if (rbt_has_value(rbt)) {
+        for (i = 0; i < n; i++)
+            *rbt_value(rbt, i + 1) = vals ? vals[i] : 0;
+    }
+
+    rbt->root = build_subtree(rbt, 1, n, INVALID_IDX, 0, log2_int32(n));
+    rbt->node_num = n + 1;
+    set_color(NODE(rbt->root), RB_BLACK);
+
+    return 1;
 }
 
 /*****************************************************************************
@@ -687,7 +964,7 @@ rbt_create_manually(rb_valcolor_t* node_info, int len) {
             rbt_destroy(rbt);
             return NULL;
         }
-        rbt->tree[nd_idx].color = node_info[i].color;
+        set_color(NODE(nd_idx), node_info[i].color);
     }
 
     return rbt;
@@ -696,22 +973,31 @@ rbt_create_manually(rb_valcolor_t* node_info, int len) {
 int
 rbt_verify(rb_tree_t* rbt) {
     /* step 1: Make sure the internal data structure are consistent.*/
-    if (rbt->node_num > rbt->capacity)
+    if (rbt->node_num > rbt_capacity(rbt))
         return 0;
 
-    if (rbt->tree == 0)
+    if (rbt->seg_num == 0 || rbt->seg_num > rbt->seg_cap)
         return 0;
 
+    /* The last segment must not be kept needlessly */
+    if (rbt->seg_num > 1 &&
+        rbt->node_num <= rbt_capacity(rbt) - RB_SEG_SZ * 3 / 2)
+        return 0;
+
+    int i;
+    for (i = 0; i < rbt->seg_num; i++) {
+        if (!rbt->segs[i] || (rbt_has_value(rbt) && !rbt->val_segs[i]))
+            return 0;
+    }
+
     /* step 2: Make sure it is a tree */
     int node_num = rbt->node_num;
-    rb_node_t* nd_vect = rbt->tree;
 
     int* cnt = (int*)MYMALLOC(sizeof(int) * node_num);
-    int i;
     for (i = 0; i < node_num; i++) cnt[i] = 0;
 
     for (i = SENTINEL_IDX + 1; i < node_num; i++) {
-        rb_node_t* nd = nd_vect + i;
+        rb_node_t* nd = NODE(i);
         int kid = nd->left;
         if (kid < SENTINEL_IDX || kid >= node_num)
             return 0;
@@ -723,12 +1009,12 @@ rbt_verify(rb_tree_t* rbt) {
         cnt[kid]++;
 
         /* Take this opportunity to check if the color is either red or black.*/
-        if (nd->color != RB_BLACK && nd->color != RB_RED)
+        if (node_color(nd) != RB_BLACK && node_color(nd) != RB_RED)
             return 0;
 
         /* make sure the "parent" pointer make sense */
-        if (nd->parent != INVALID_IDX) {
-            rb_node_t* dad = nd_vect + nd->parent;
+        if (node_parent(nd) != INVALID_IDX) {
+            rb_node_t* dad = NODE(node_parent(nd));
             if (dad->left != i && dad->right != i)
                 return 0;
         }
@@ -761,41 +1047,41 @@ rbt_verify(rb_tree_t* rbt) {
     /* Following is to check if the RB-tree properies are preserved */
 
     /* step 3: check if root and leaf are in black color */
-    if (nd_vect[rbt->root].color != RB_BLACK ||
-        nd_vect[SENTINEL_IDX].color != RB_BLACK)
+    if (node_color(NODE(rbt->root)) != RB_BLACK ||
+        node_color(NODE(SENTINEL_IDX)) != RB_BLACK)
         return 0;
 
     /* step 4: Check if there are adjacent red nodes. */
     for (i = SENTINEL_IDX + 1; i < node_num; i++) {
-        rb_node_t* nd = nd_vect + i;
-        if (nd->color == RB_RED) {
-            if (nd_vect[nd->left].color == RB_RED ||
-                nd_vect[nd->right].color == RB_RED)
+        rb_node_t* nd = NODE(i);
+        if (node_color(nd) == RB_RED) {
+            if (node_color(NODE(nd->left)) == RB_RED ||
+                node_color(NODE(nd->right)) == RB_RED)
                 return 0;
         }
     }
 
     /* step 5: check if all paths contain the same number of black nodes.*/
     int len = -1;
-    rb_node_t* sentinel = rbt->tree;
     for (i = SENTINEL_IDX + 1; i < node_num; i++) {
-        rb_node_t* nd = nd_vect + i;
+        rb_node_t* nd = NODE(i);
         if (nd->left != SENTINEL_IDX || nd->right != SENTINEL_IDX) {
             /* ignore internal node */
             continue;
         }
 
-        rb_node_t* cur = nd_vect + rbt->root;
+        int cur = rbt->root;
         int key = nd->key;
         int this_len = 0;
-        while (cur != sentinel) {
-            if (cur->color == RB_BLACK)
+        while (cur != SENTINEL_IDX) {
+            rb_node_t* cur_nd = NODE(cur);
+            if (node_color(cur_nd) == RB_BLACK)
                 this_len++;
 
-            if (less_than(cur, key)) {
-                cur = nd_vect + cur->left;
-            } else if (greater_than(cur, key)) {
-                cur = nd_vect + cur->right;
+            if (less_than(cur_nd, key)) {
+                cur = cur_nd->left;
+            } else if (greater_than(cur_nd, key)) {
+                cur = cur_nd->right;
             } else {
                 break;
             }
@@ -820,22 +1106,21 @@ rbt_dump_dot(rb_tree_t* rbt, const char* name) {
     fprintf(f, "digraph G {\n");
 
     int i, e = rbt->node_num;
-    rb_node_t* nd_vect = rbt->tree;
 
     for (i = SENTINEL_IDX + 1; i < e; i++) {
-        rb_node_t* node = nd_vect + i;
+        rb_node_t* node = NODE(i);
         fprintf(f, "\t\%d [style=filled, color=%s, fontcolor=white];\n",
-                node->key, node->color == RB_RED ? "red" : "black");
+                node->key, node_color(node) == RB_RED ? "red" : "black");
     }
 
     for (i = SENTINEL_IDX + 1; i < e; i++) {
-        rb_node_t* node = nd_vect + i;
+        rb_node_t* node = NODE(i);
         if (node->left != SENTINEL_IDX)
-            fprintf(f, "%d -> %d;\n", node->key, nd_vect[node->left].key);
+            fprintf(f, "%d -> %d;\n", node->key, NODE(node->left)->key);
 
         if (node->right != SENTINEL_IDX) {
             fprintf(f, "%d -> %d [label=r];\n", node->key,
-                    nd_vect[node->right].key);
+                    NODE(node->right)->key);
         }
     }
 
@@ -848,20 +1133,48 @@ rbt_dump_dot(rb_tree_t* rbt, const char* name) {
 /* Print the rb tree directly to the console in plain text format*/
 void
 rbt_dump_text(rb_tree_t* rbt) {
-    rb_node_t* nd_vect = rbt->tree;
     fprintf(stdout, "RB tree: root id:%d, node_num:%d\n",
             rbt->root, rbt->node_num);
 
     int i, e;
     for (i = 0, e = rbt->node_num; i < e; i++) {
-        rb_node_t* node = nd_vect + i;
+        rb_node_t* node = NODE(i);
         fprintf(stdout,
                 " Node:%d, key:%d, value:%ld, left:%d, right:%d, parent:%d\n",
-                i, node->key, node->value, node->left, node->right,
-                node->parent);
+                i, node->key, rbt_has_value(rbt) ? *rbt_value(rbt, i) : 0L,
+                node->left, node->right,
+                node_parent(node));
     }
     fprintf(stderr, "\n");
     fflush(stdout);
 }
 
 #endif /*defined(DEBUG) || defined(ENABLE_TESTING)*/
+
+#endif /*!LJMM_BTREE*/
+
+/****************************************************************************
+ *
+ *      Operations built on top of the interface, shared by both trees
+ *
+ ****************************************************************************
+ */
+int
+rbt_range(rb_tree_t* rbt, int lo, int hi, rb_range_cb_t cb, void* arg) {
+    int cnt = 0;
+
+    rb_iter_t iter, iter_e;
+    for (iter = rbt_iter_seek(rbt, lo), iter_e = rbt_iter_end(rbt);
+         iter != iter_e;
+         iter = rbt_iter_inc(rbt, iter)) {
+        int key = rbt_iter_key(rbt, iter);
+        if (key >= hi)
+            break;
+
+        cnt++;
+        if (!cb(key, rbt_iter_value(rbt, iter), arg))
+            break;
+    }
+
+    return cnt;
+}
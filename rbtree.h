@@ -11,22 +11,78 @@ typedef enum {
     RB_RED = 1
 } rb_color_t;
 
+#ifdef LJMM_BTREE
+    /* The B+-tree (btree.c) implements the interface declared here. */
+    #include "btree.h"
+#else
+
+/* 16 bytes, so that four nodes fit in a cache line. The color (either
+ * RB_BLACK or RB_RED) is packed into the least significant bit of
+ * "parent_color", see node_parent() and node_color() in rbtree.c.
+ */
 typedef struct {
-    intptr_t value;
     int key;
-    int parent;
+    int parent_color;
     int left;
     int right;
-    unsigned char color; /* either RB_BLACK or RB_RED */
 } rb_node_t;
 
+/* The nodes are stored in fixed-size segments of RB_SEG_SZ nodes, found via
+ * a directory: node i is segs[i / RB_SEG_SZ][i % RB_SEG_SZ]. Once allocated,
+ * a node never moves: growing or shrinking the tree allocates or frees a
+ * segment (and at most reallocates the directory), but never copies the
+ * nodes.
+ *
+ *  The values are kept apart from the nodes, in segments of the same size.
+ * A "set" does not have values at all (val_segs is NULL).
+ */
+#define RB_SEG_LOG2     8
+#define RB_SEG_SZ       (1 << RB_SEG_LOG2)
+
 typedef struct {
-    rb_node_t* tree;
+    rb_node_t** segs;
+    intptr_t** val_segs;
+    int seg_num;        /* number of segments allocated */
+    int seg_cap;        /* capacity of the directory */
     int root;
     int node_num;
-    int capacity;
 } rb_tree_t;
 
+/* Return the node of the given index */
+static inline rb_node_t*
+rbt_node(const rb_tree_t* rbt, int idx) {
+    return rbt->segs[idx >> RB_SEG_LOG2] + (idx & (RB_SEG_SZ - 1));
+}
+
+/* Return the value of the given node, which must not be in a set */
+static inline intptr_t*
+rbt_value(const rb_tree_t* rbt, int idx) {
+    return rbt->val_segs[idx >> RB_SEG_LOG2] + (idx & (RB_SEG_SZ - 1));
+}
+
+#define rbt_is_empty(rbt) ((rbt)->node_num == 1 ? 1 : 0)
+
+#define rbt_size(rbt)     ((rbt)->node_num - 1)
+
+/* RB-tree iterator. The elements are visited in ascending order of their
+ * keys; rbt_iter_inc() takes amortized O(1) time. The tree must not be
+ * modified in the course of the iteration. An iterator is the index of a
+ * node; the index of the sentinel, 0, marks the end.
+ */
+typedef int rb_iter_t;
+rb_iter_t rbt_iter_first(rb_tree_t*);
+rb_iter_t rbt_iter_next(rb_tree_t*, rb_iter_t);
+
+#define rbt_iter_begin(rbt)         rbt_iter_first(rbt)
+#define rbt_iter_end(rbt)           0
+#define rbt_iter_inc(rbt, iter)     rbt_iter_next((rbt), (iter))
+
+#define rbt_iter_key(rbt, iter)     (rbt_node((rbt), (iter))->key)
+#define rbt_iter_value(rbt, iter) \
+    ((rbt)->val_segs ? *rbt_value((rbt), (iter)) : 0)
+
+#endif /* LJMM_BTREE */
+
 /* Construt/destruct RB tree */
 rb_tree_t* rbt_create(void);
 void rbt_destroy(rb_tree_t*);
@@ -37,12 +93,24 @@ void rbt_destroy(rb_tree_t*);
 int rbt_init(rb_tree_t*);
 void rbt_fini(rb_tree_t*);
 
+/* Key-only variants. The value passed to rbt_insert() is ignored, values
+ * returned by searches are always 0, and rbt_set_value() fails.
+ */
+rb_tree_t* rbt_create_set(void);
+int rbt_init_set(rb_tree_t*);
+
 /* RB-tree operations */
 int rbt_insert(rb_tree_t*, int key, intptr_t val);
 int rbt_delete(rb_tree_t*, int key, intptr_t* val);
 int rbt_get_min(rb_tree_t*);
 int rbt_get_max(rb_tree_t*);
 
+/* Populate the empty tree with the given <n> keys in O(n) time. The keys
+ * must be strictly ascending. <vals> may be NULL, in which case all values
+ * are 0. Return 1 on success, 0 otherwise.
+ */
+int rbt_build_sorted(rb_tree_t*, const int* keys, const intptr_t* vals, int n);
+
 typedef enum {
     RBS_FAIL = 0,
     RBS_EXACT = 1,
@@ -60,17 +128,18 @@ RBS_RESULT rbt_search_variant(rb_tree_t*, int key,
 
 int rbt_set_value(rb_tree_t*, int key, intptr_t value);
 
-#define rbt_is_empty(rbt) ((rbt)->node_num == 1 ? 1 : 0)
-
-#define rbt_size(rbt)     ((rbt)->node_num - 1)
-
-/* RB-tree iterator */
-typedef rb_node_t* rb_iter_t;
-#define rbt_iter_begin(rbt)         ((rbt)->tree + 1)
-#define rbt_iter_end(rbt)           ((rbt)->tree + (rbt)->node_num)
-#define rbt_iter_inc(rbt, iter)     ((iter) + 1)
+/* Return the iterator of the minimum key no less than the given key, or
+ * rbt_iter_end() if there is no such key.
+ */
+rb_iter_t rbt_iter_seek(rb_tree_t*, int key);
 
-#define rbt_iter_deref(iter)        ((iter))
+/* Call <cb> with each key in [lo, hi) and its value in ascending order of
+ * keys, until <cb> returns 0. <cb> must not modify the tree. Return the
+ * number of keys visited. It takes O(log(n) + k) time, k being the number
+ * of keys visited.
+ */
+typedef int (*rb_range_cb_t)(int key, intptr_t value, void* arg);
+int rbt_range(rb_tree_t*, int lo, int hi, rb_range_cb_t cb, void* arg);
 
 #if defined(DEBUG) || defined(ENABLE_TESTING)
 /* NOTE: If DEBUG is off and ENABLE_TESTING is on, functions enclosed by this
@@ -0,0 +1,229 @@
+/* This file keeps track of the mappings lm_mmap() makes with mmap(2), and
+ * implements the preference of LM_ADAPTIVE. See sys_map.h for details.
+ *
+ *  LM_ADAPTIVE tries the user-mode allocator first, until the chunks are
+ * SM_HIGH_OCCUPANCY full; from then on, mmap(2) is tried first so that the
+ * rest of the chunks is kept for the requests the kernel cannot serve,
+ * until the occupancy drops to SM_LOW_OCCUPANCY. mmap(2) is not preferred,
+ * however, while it is failing (see the negative cache below), or is
+ * SM_SLOW_FACTOR times as slow as it has been lately, which it tends to be
+ * as the low address space gets crowded.
+ */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+#include <sys/mman.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <strings.h> /* for bzero() */
+#include "util.h"
+#include "rbtree.h"
+#include "page_alloc.h"
+#include "profile.h"
+#include "sys_map.h"
+
+#define SM_HIGH_OCCUPANCY   7   /* in eighths */
+#define SM_LOW_OCCUPANCY    6
+#define SM_SLOW_FACTOR      4
+
+/* While mmap(2) is deemed slow, the lowest latency seen rises by 1/64 each
+ * time LM_ADAPTIVE decides, so that mmap(2) is tried again at length and
+ * the latency measured afresh.
+ */
+#define SM_FLOOR_RISE_LOG2  6
+
+/* A failed request makes the requests no smaller than it fail right away,
+ * this many times at most, or until a tracked mapping is unmapped.
+ */
+#define SM_NEG_TTL          64
+
+static rb_tree_t sm_maps;   /* first page -> length in bytes */
+static int sm_inited;
+static int sm_page_log2;
+
+static size_t neg_size = SIZE_MAX;
+static int neg_ttl;
+
+static uint64_t sys_floor;  /* The lowest latency of mmap(2) seen, see above */
+static ljmm_mode_stat_t sm_stat;
+
+static int
+sm_init(void) {
+    if (!rbt_init(&sm_maps))
+        return 0;
+
+    sm_page_log2 = log2_int32(sysconf(_SC_PAGESIZE));
+    sm_inited = 1;
+    return 1;
+}
+
+void
+sm_fini(void) {
+    if (sm_inited) {
+        rbt_fini(&sm_maps);
+        sm_inited = 0;
+    }
+
+    neg_size = SIZE_MAX;
+    sys_floor = 0;
+    bzero(&sm_stat, sizeof(sm_stat));
+}
+
+const ljmm_mode_stat_t*
+lm_get_mode_stat(void) {
+    return &sm_stat;
+}
+
+/* Moving average over about the last 8 samples */
+static void
+update_cost(unsigned long long* avg, uint64_t cost) {
+    if (!*avg)
+        *avg = cost;
+    else
+        *avg = *avg - (*avg >> 3) + (cost >> 3);
+}
+
+static void
+track(uintptr_t addr, size_t len) {
+    /* The mappings mremap()ed beyond the reach of the keys go untracked. */
+    uintptr_t page = addr >> sm_page_log2;
+    if (page > INT_MAX || !rbt_insert(&sm_maps, page, len))
+        return;
+
+    sm_stat.sys_map_num++;
+    sm_stat.sys_map_bytes += len;
+}
+
+/* Untrack [start, end), which may cover any number of mappings in part or
+ * in whole. Return 1 if any of them is tracked, 0 otherwise.
+ */
+static int
+untrack(uintptr_t start, uintptr_t end) {
+    uintptr_t page = start >> sm_page_log2;
+    if (page > INT_MAX)
+        return 0;
+
+    /* The mapping starting below <start> may reach into it. */
+    int key;
+    intptr_t len;
+    if (rbt_search_le(&sm_maps, page, &key, &len) == RBS_FAIL ||
+        ((uintptr_t)key << sm_page_log2) + len <= start) {
+        if (rbt_search_ge(&sm_maps, page, &key, &len) == RBS_FAIL)
+            return 0;
+    }
+
+    int found = 0;
+    while (((uintptr_t)key << sm_page_log2) < end) {
+        uintptr_t s = (uintptr_t)key << sm_page_log2;
+        uintptr_t e = s + len;
+
+        rbt_delete(&sm_maps, key, NULL);
+        sm_stat.sys_map_num--;
+        sm_stat.sys_map_bytes -= len;
+        found = 1;
+
+        if (s < start)
+            track(s, start - s);
+        if (e > end)
+            track(end, e - end);
+
+        if (e >= end)
+            break;
+        if (rbt_search_ge(&sm_maps, e >> sm_page_log2, &key, &len) == RBS_FAIL)
+            break;
+    }
+
+    /* The space released may well serve the failed requests. */
+    if (found)
+        neg_size = SIZE_MAX;
+
+    return found;
+}
+
+void*
+sm_mmap(size_t length, int prot, int flags, int fallback) {
+    if (!sm_inited && !sm_init())
+        return mmap(NULL, length, prot, flags, -1, 0);
+
+    if (fallback && length >= neg_size) {
+        if (neg_ttl > 0) {
+            neg_ttl--;
+            sm_stat.neg_hit_num++;
+            errno = ENOMEM;
+            return MAP_FAILED;
+        }
+        neg_size = SIZE_MAX;
+    }
+
+    uint64_t t = lm_prof_now();
+    void* p = mmap(NULL, length, prot, flags, -1, 0);
+    uint64_t cost = lm_prof_now() - t;
+
+    if (p == MAP_FAILED) {
+        sm_stat.sys_fail_num++;
+        if (errno == ENOMEM && length < neg_size) {
+            neg_size = length;
+            neg_ttl = SM_NEG_TTL;
+        }
+        return p;
+    }
+
+    update_cost(&sm_stat.sys_cost, cost);
+    if (!sys_floor || cost < sys_floor)
+        sys_floor = cost;
+
+    size_t page_mask = ((size_t)1 << sm_page_log2) - 1;
+    track((uintptr_t)p, (length + page_mask) & ~page_mask);
+    return p;
+}
+
+int
+sm_munmap(void* addr, size_t length) {
+    int ret = munmap(addr, length);
+    if (!ret && sm_inited) {
+        size_t page_mask = ((size_t)1 << sm_page_log2) - 1;
+        untrack((uintptr_t)addr, (uintptr_t)addr + ((length + page_mask) &
+                                                    ~page_mask));
+    }
+    return ret;
+}
+
+void*
+sm_mremap(void* old_addr, size_t old_size, size_t new_size, int flags) {
+    void* p = mremap(old_addr, old_size, new_size, flags);
+    if (p == MAP_FAILED || !sm_inited)
+        return p;
+
+    size_t page_mask = ((size_t)1 << sm_page_log2) - 1;
+    old_size = (old_size + page_mask) & ~page_mask;
+    if (untrack((uintptr_t)old_addr, (uintptr_t)old_addr + old_size))
+        track((uintptr_t)p, (new_size + page_mask) & ~page_mask);
+
+    return p;
+}
+
+int
+sm_prefer_sys(void) {
+    int prefer = 1;
+    if (alloc_info && alloc_info->usable_page_num) {
+        int64_t usable = alloc_info->usable_page_num;
+        int64_t used = usable - alloc_info->free_page_num;
+        int occupancy = used * 8 / usable;
+        prefer = occupancy >= (sm_stat.prefer_sys ? SM_LOW_OCCUPANCY
+                                                  : SM_HIGH_OCCUPANCY);
+    }
+
+    if (sm_stat.sys_cost > SM_SLOW_FACTOR * sys_floor) {
+        sys_floor += (sys_floor >> SM_FLOOR_RISE_LOG2) + 1;
+        prefer = 0;
+    }
+    if (neg_size != SIZE_MAX && neg_ttl > 0)
+        prefer = 0;
+
+    if (prefer != sm_stat.prefer_sys) {
+        sm_stat.prefer_sys = prefer;
+        sm_stat.switch_num++;
+    }
+    return prefer;
+}
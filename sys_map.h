@@ -0,0 +1,32 @@
+#ifndef _SYS_MAP_H_
+#define _SYS_MAP_H_
+
+/* The mappings made with mmap(2) on behalf of lm_mmap(), i.e. in the modes
+ * other than LM_USER_MODE. They are tracked in an RB-tree keyed by their
+ * first page, and the recent failures of mmap(2) are remembered, so that a
+ * mode with a fallback does not retry them over and over. LM_ADAPTIVE
+ * decides here which side to try first. See ljmm_mode_stat_t for the
+ * statistics.
+ */
+#include <sys/types.h>
+#include <stdint.h>
+#include "lj_mm.h"
+
+void sm_fini(void);
+
+/* mmap(2) an anonymous mapping of <length> bytes, and track it. If
+ * <fallback> is set, i.e. the caller has another way to serve the request,
+ * a request no smaller than a recently failed one fails right away.
+ */
+void* sm_mmap(size_t length, int prot, int flags, int fallback);
+
+/* munmap(2) and mremap(2) the mappings made by sm_mmap(). Any other
+ * mapping is passed through as it is.
+ */
+int sm_munmap(void* addr, size_t length);
+void* sm_mremap(void* old_addr, size_t old_size, size_t new_size, int flags);
+
+/* Return 1 if LM_ADAPTIVE is to try mmap(2) first, 0 otherwise. */
+int sm_prefer_sys(void);
+
+#endif /* _SYS_MAP_H_ */
@@ -0,0 +1,471 @@
+/* placement-sim: an offline simulator for studying how placement policies
+ * fragment the address window.
+ *
+ *   It replays the mmap/munmap/mremap records of a trace (see trace.h) on
+ * the real buddy allocator of page_alloc.c, set up over a virtual window
+ * which is never mapped nor touched: the program is statically linked
+ * against libljmm.a with madvise() wrapped into a no-op, and nothing else
+ * in the page allocator dereferences the pages it manages.
+ *
+ *   Following policies are compared side by side. The first five are the
+ * placement policies of the library (see placement.c), run by lm_malloc():
+ *   o. lowest:    the default, i.e. the smallest order, lowest address.
+ *   o. two-sided: small blocks from the bottom, large ones from the top.
+ *   o. segregated: small, medium and large blocks around the bottom, the
+ *                 middle and the top respectively.
+ *   o. next-fit:  the first fit above the previous allocation.
+ *   o. top-down:  the highest block big enough, carved from its top.
+ *
+ * The others are simulated here only:
+ *   o. best-fit:  the smallest order, prefering the blocks whose buddy is
+ *                 allocated as a whole, so the holes left behind are less
+ *                 likely to be split further.
+ *   o. large-top: like "lowest" for small requests; requests of order
+ *                 >= large-order are placed at the highest address, and
+ *                 the split keeps the upper half.
+ *   o. exact-fit: like "lowest", but trailing pages of the block which are
+ *                 not needed by the request are returned to the allocator.
+ *
+ *   For each policy, it reports the peak span (distance between the lowest
+ * and the highest allocated byte), the largest free block over time, and the
+ * point where the first allocation failed.
+ *
+ *   Simplifications: mremap is simulated by allocating the new size and
+ * then freeing the old mapping, unless the new size fits in the pages
+ * already allocated; partial munmaps are ignored, the mapping keeps its
+ * size until it is unmapped completely. Touch records are ignored.
+ *
+ * Usage: placement-sim [-w window-in-MB] [-L large-order] [-s interval]
+ *                      trace-file
+ *   -w: the size of the virtual window, default 2048 (MB).
+ *   -L: the order from which on a request is considered large by the
+ *       policies, default 8 (i.e. 1MB with 4k page).
+ *   -s: print the largest-free-block every <interval> records.
+ */
+#include <sys/mman.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "page_alloc.h"
+#include "trace.h"
+
+/* The window is never mapped; make the page allocator's madvise() a nop */
+int
+__wrap_madvise(void* addr, size_t len, int advice) {
+    return 0;
+}
+
+#define MAX_SUB_BLK 32
+
+/* A simulated mapping. Only the exact-fit policy may need multiple buddy
+ * blocks to represent a mapping.
+ */
+typedef struct {
+    size_t len;
+    int blk_num;
+    page_idx_t blk[MAX_SUB_BLK];
+} sim_map_t;
+
+typedef struct {
+    const char* name;
+    /* The placement the page allocator is set up with */
+    ljmm_placement_t placement;
+    /* Allocate pages for at least <len> bytes. Return 0 on failure */
+    int (*alloc)(sim_map_t* m, size_t len);
+} policy_t;
+
+static int large_order = 8;
+
+/****************************************************************************
+ *
+ *              Policies
+ *
+ ****************************************************************************
+ */
+static int
+get_req_order(size_t len) {
+    int req_order = ceil_log2_int32(len) - alloc_info->page_size_log2;
+    return req_order < 0 ? 0 : req_order;
+}
+
+/* Return the smallest order no less than <req_order> that has free blocks,
+ * or -1 if there is none.
+ */
+static int
+get_avail_order(int req_order) {
+    int i;
+    for (i = req_order; i <= alloc_info->max_order; i++) {
+        if (!rbt_is_empty(alloc_info->free_blks + i))
+            return i;
+    }
+    return -1;
+}
+
+/* Split the free block <blk> of <blk_order> down to <req_order>, and
+ * allocate the lowest (or highest if <upper> is set) part of it.
+ */
+static page_idx_t
+split_and_alloc(page_idx_t blk, int blk_order, int req_order, int upper,
+                size_t len) {
+    blk = split_free_block(blk, blk_order, req_order, upper);
+    add_alloc_block(blk, len, req_order);
+    return blk;
+}
+
+/* Allocate with lm_malloc(), i.e. by the library's placement policy */
+static int
+lib_alloc(sim_map_t* m, size_t len) {
+    char* p = lm_malloc(len);
+    if (!p)
+        return 0;
+
+    m->blk_num = 1;
+    m->blk[0] = (p - alloc_info->first_page) >> alloc_info->page_size_log2;
+    return 1;
+}
+
+static int
+best_fit_alloc(sim_map_t* m, size_t len) {
+    int req_order = get_req_order(len);
+    int order = get_avail_order(req_order);
+    if (order < 0)
+        return 0;
+
+    rb_tree_t* rbt = alloc_info->free_blks + order;
+    lm_page_t* pi = alloc_info->page_info;
+    page_idx_t best = -1;
+
+    rb_iter_t iter, iter_e;
+    for (iter = rbt_iter_begin(rbt), iter_e = rbt_iter_end(rbt);
+         iter != iter_e; iter = rbt_iter_inc(rbt, iter)) {
+        page_idx_t blk = rbt_iter_key(rbt, iter);
+        page_id_t buddy_id = page_idx_to_id(blk) ^ (1 << order);
+        if (buddy_id < alloc_info->idx_2_id_adj)
+            continue;
+
+        page_idx_t buddy = buddy_id - alloc_info->idx_2_id_adj;
+        if (buddy >= alloc_info->page_num || !is_allocated_blk(pi + buddy) ||
+            pi[buddy].order != order) {
+            continue;
+        }
+
+        if (best == -1 || blk < best)
+            best = blk;
+    }
+
+    if (best == -1)
+        best = rbt_get_min(rbt);
+
+    m->blk_num = 1;
+    m->blk[0] = split_and_alloc(best, order, req_order, 0, len);
+    return 1;
+}
+
+static int
+large_top_alloc(sim_map_t* m, size_t len) {
+    int req_order = get_req_order(len);
+    if (req_order < large_order)
+        return lib_alloc(m, len);
+
+    int order = get_avail_order(req_order);
+    if (order < 0)
+        return 0;
+
+    page_idx_t blk = rbt_get_max(alloc_info->free_blks + order);
+    m->blk_num = 1;
+    m->blk[0] = split_and_alloc(blk, order, req_order, 1, len);
+    return 1;
+}
+
+static int
+exact_fit_alloc(sim_map_t* m, size_t len) {
+    int req_order = get_req_order(len);
+    int order = get_avail_order(req_order);
+    if (order < 0)
+        return 0;
+
+    page_idx_t blk = rbt_get_min(alloc_info->free_blks + order);
+    blk = split_and_alloc(blk, order, req_order, 0, len);
+    remove_alloc_block(blk);
+
+    /* Carve the exact number of pages out of [blk, blk + 2^req_order) by
+     * keeping the halves which are entirely needed, and returning the
+     * halves which are not needed at all.
+     */
+    int page_sz_log2 = alloc_info->page_size_log2;
+    int need = (len + alloc_info->page_size - 1) >> page_sz_log2;
+    int bo = req_order;
+    m->blk_num = 0;
+    while (need) {
+        if (need == (1 << bo)) {
+            add_alloc_block(blk, ((size_t)need) << page_sz_log2, bo);
+            m->blk[m->blk_num++] = blk;
+            break;
+        }
+
+        bo--;
+        if (need > (1 << bo)) {
+            add_alloc_block(blk, ((size_t)1 << bo) << page_sz_log2, bo);
+            m->blk[m->blk_num++] = blk;
+            blk += 1 << bo;
+            need -= 1 << bo;
+        } else {
+            add_free_block(blk + (1 << bo), bo);
+        }
+    }
+
+    return 1;
+}
+
+static const policy_t policies[] = {
+    { "lowest",     LM_PLACE_LOWEST,     lib_alloc },
+    { "two-sided",  LM_PLACE_TWO_SIDED,  lib_alloc },
+    { "segregated", LM_PLACE_SEGREGATED, lib_alloc },
+    { "next-fit",   LM_PLACE_NEXT_FIT,   lib_alloc },
+    { "top-down",   LM_PLACE_TOP_DOWN,   lib_alloc },
+    { "best-fit",   LM_PLACE_LOWEST,     best_fit_alloc },
+    { "large-top",  LM_PLACE_LOWEST,     large_top_alloc },
+    { "exact-fit",  LM_PLACE_LOWEST,     exact_fit_alloc },
+};
+
+#define POLICY_NUM ((int)(sizeof(policies)/sizeof(policies[0])))
+
+/****************************************************************************
+ *
+ *              Simulation
+ *
+ ****************************************************************************
+ */
+typedef struct {
+    size_t peak_span;
+    size_t peak_in_use;
+    long fail_num;
+    int first_fail_rec;          /* -1 if no allocation failed */
+    size_t first_fail_in_use;    /* the bytes in use at the first failure */
+    size_t first_fail_len;       /* the size of the failed request */
+    size_t min_largest_free;     /* the minimum of the largest free block */
+} sim_result_t;
+
+static void
+sim_free(sim_map_t* m) {
+    int i;
+    for (i = 0; i < m->blk_num; i++)
+        free_block(m->blk[i]);
+    m->blk_num = 0;
+    m->len = 0;
+}
+
+static size_t
+alloc_span(void) {
+    rb_tree_t* rbt = &alloc_info->alloc_blks;
+    if (rbt_is_empty(rbt))
+        return 0;
+
+    page_idx_t lo = rbt_get_min(rbt);
+    page_idx_t hi = rbt_get_max(rbt);
+    hi += 1 << alloc_info->page_info[hi].order;
+    return ((size_t)(hi - lo)) << alloc_info->page_size_log2;
+}
+
+static void
+simulate(const policy_t* pol, const trace_t* trace, size_t window,
+         int interval, size_t* samples, sim_result_t* res) {
+    lm_chunk_t chunk;
+    chunk.page_size = sysconf(_SC_PAGESIZE);
+    chunk.page_num = window / chunk.page_size;
+    chunk.size = (uint64_t)chunk.page_num * chunk.page_size;
+    /* Any address would do, it is never dereferenced */
+    chunk.base = (char*)(uintptr_t)0x40000000;
+
+    memset(res, 0, sizeof(*res));
+    res->first_fail_rec = -1;
+    res->min_largest_free = window;
+
+    ljmm_opt_t opt;
+    lm_init_mm_opt(&opt);
+    opt.placement = pol->placement;
+    opt.large_order = large_order;
+
+    /* The policies simulated here pick from the free-block trees, which
+     * neither the quick-lists nor the rest of a block split lazily are in.
+     */
+    if (pol->alloc != lib_alloc) {
+        opt.quick_list_len = 0;
+        opt.lazy_split = 0;
+    }
+    if (!lm_init_page_alloc(&chunk, 1, &opt)) {
+        fprintf(stderr, "fail to init page allocator\n");
+        exit(1);
+    }
+
+    sim_map_t* maps = (sim_map_t*)calloc(trace->max_id + 1, sizeof(sim_map_t));
+    size_t in_use = 0;
+
+    int i;
+    for (i = 0; i < trace->rec_num; i++) {
+        const trace_rec_t* rec = trace->recs + i;
+        sim_map_t* m = maps + rec->id;
+        int fail = 0;
+
+        switch (rec->op) {
+        case TR_MMAP:
+            if (m->blk_num || !pol->alloc(m, rec->len)) {
+                fail = 1;
+                break;
+            }
+            m->len = rec->len;
+            in_use += rec->len;
+            break;
+
+        case TR_MUNMAP:
+            if (m->blk_num && (rec->len == 0 || rec->len == m->len)) {
+                in_use -= m->len;
+                sim_free(m);
+            }
+            break;
+
+        case TR_MREMAP: {
+            if (!m->blk_num)
+                break;
+
+            int order = alloc_info->page_info[m->blk[0]].order;
+            if (m->blk_num == 1 && get_req_order(rec->len) == order) {
+                /* Resized in place */
+                in_use += rec->len - m->len;
+                m->len = rec->len;
+                break;
+            }
+
+            sim_map_t new_map;
+            if (!pol->alloc(&new_map, rec->len)) {
+                fail = 1;
+                break;
+            }
+            in_use += rec->len - m->len;
+            sim_free(m);
+            *m = new_map;
+            m->len = rec->len;
+            break;
+        }
+
+        default:
+            break;
+        }
+
+        if (fail) {
+            if (!res->fail_num++) {
+                res->first_fail_rec = i;
+                res->first_fail_in_use = in_use;
+                res->first_fail_len = rec->len;
+            }
+        }
+
+        if (in_use > res->peak_in_use)
+            res->peak_in_use = in_use;
+
+        size_t span = alloc_span();
+        if (span > res->peak_span)
+            res->peak_span = span;
+
+        size_t largest = lm_largest_free();
+        if (largest < res->min_largest_free)
+            res->min_largest_free = largest;
+
+        if (samples && (i % interval) == 0)
+            samples[i / interval] = largest;
+    }
+
+    int id;
+    for (id = 0; id <= trace->max_id; id++) {
+        if (maps[id].blk_num)
+            sim_free(maps + id);
+    }
+    free(maps);
+
+    lm_fini_page_alloc();
+}
+
+static void
+usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-w window-in-MB] [-L large-order] "
+            "[-s interval] trace-file\n", prog);
+}
+
+#define MB(x) ((double)(x) / (1024 * 1024))
+
+int
+main(int argc, char** argv) {
+    size_t window = (size_t)2048 << 20;
+    int interval = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "w:L:s:")) != -1) {
+        switch (opt) {
+        case 'w': window = ((size_t)atol(optarg)) << 20; break;
+        case 'L': large_order = atoi(optarg); break;
+        case 's': interval = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind + 1 != argc || !window || interval < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    trace_t* trace = trace_load(argv[optind]);
+    if (!trace)
+        return 1;
+
+    sim_result_t res[POLICY_NUM];
+    size_t* samples[POLICY_NUM];
+    int sample_num = interval ? (trace->rec_num + interval - 1) / interval : 0;
+
+    int i, j;
+    for (i = 0; i < POLICY_NUM; i++) {
+        samples[i] = NULL;
+        if (sample_num)
+            samples[i] = (size_t*)calloc(sample_num, sizeof(size_t));
+        simulate(policies + i, trace, window, interval, samples[i], res + i);
+    }
+
+    fprintf(stdout, "window=%.0fMB, records=%d\n", MB(window), trace->rec_num);
+    fprintf(stdout, "%-10s %12s %12s %12s %8s %10s %12s %12s\n", "policy",
+            "peak-use(MB)", "peak-span", "min-largest", "fails",
+            "1st-fail", "in-use@fail", "req@fail");
+    for (i = 0; i < POLICY_NUM; i++) {
+        sim_result_t* r = res + i;
+        fprintf(stdout, "%-10s %12.2f %12.2f %12.2f %8ld ", policies[i].name,
+                MB(r->peak_in_use), MB(r->peak_span),
+                MB(r->min_largest_free), r->fail_num);
+        if (r->first_fail_rec >= 0) {
+            fprintf(stdout, "%10d %12.2f %12.2f\n", r->first_fail_rec,
+                    MB(r->first_fail_in_use), MB(r->first_fail_len));
+        } else {
+            fprintf(stdout, "%10s %12s %12s\n", "-", "-", "-");
+        }
+    }
+
+    if (sample_num) {
+        fprintf(stdout, "\nlargest free block (MB) over time:\n%-8s", "record");
+        for (i = 0; i < POLICY_NUM; i++)
+            fprintf(stdout, " %10s", policies[i].name);
+        fputs("\n", stdout);
+
+        for (j = 0; j < sample_num; j++) {
+            fprintf(stdout, "%-8d", j * interval);
+            for (i = 0; i < POLICY_NUM; i++)
+                fprintf(stdout, " %10.2f", MB(samples[i][j]));
+            fputs("\n", stdout);
+        }
+    }
+
+    for (i = 0; i < POLICY_NUM; i++)
+        free(samples[i]);
+    trace_free(trace);
+
+    return 0;
+}
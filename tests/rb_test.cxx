@@ -1,5 +1,8 @@
 #include <stdio.h>
+#include <time.h>
+#include <map>
 #include <string>
+#include <vector>
 #include "rbtree.h"
 
 using namespace std;
@@ -88,7 +91,59 @@ public:
         return false;
     }
 
+    // Build the tree from the given keys with rbt_build_sorted(), then make
+    // sure each key can be found.
+    bool BuildSorted(const int* keys, int n, int expect_ret_val = 1) {
+        if (BuildSortedHelper(keys, n, expect_ret_val))
+            return true;
+        _fail_cnt ++;
+        return false;
+    }
+
+    bool MinMax(int min_key, int max_key) {
+        if (_rbt && !rbt_is_empty(_rbt) && rbt_get_min(_rbt) == min_key &&
+            rbt_get_max(_rbt) == max_key) {
+            return true;
+        }
+        fprintf(stdout, " fail to get min/max;");
+        _fail_cnt ++;
+        return false;
+    }
+
 private:
+    bool BuildSortedHelper(const int* keys, int n, int expect_ret_val) {
+        if (!_rbt)
+            return false;
+
+        vector<intptr_t> vals;
+        for (int i = 0; i < n; i++)
+            vals.push_back(keys[i] + KEY_VAL_DELTA);
+
+        int ret = rbt_build_sorted(_rbt, keys, n ? &vals[0] : 0, n);
+
+        if (_dump_tree)
+            Dump_Tree("after_build");
+
+        if (ret != expect_ret_val || !rbt_verify(_rbt) || !VerifyKeyVal()) {
+            fprintf(stdout, " fail to build %d nodes;", n);
+            return false;
+        }
+
+        if (!ret)
+            return rbt_is_empty(_rbt);
+
+        for (int i = 0; i < n; i++) {
+            intptr_t val;
+            if (rbt_search(_rbt, keys[i], &val) != RBS_EXACT ||
+                val != keys[i] + KEY_VAL_DELTA) {
+                fprintf(stdout, " fail to search %d;", keys[i]);
+                return false;
+            }
+        }
+
+        return rbt_size(_rbt) == n;
+    }
+
     bool DeleteHelper(int val, int expect_ret_val) {
         if (!_rbt)
             return false;
@@ -203,11 +258,11 @@ private:
     //
     bool VerifyKeyVal() {
         for (rb_iter_t iter = rbt_iter_begin(_rbt),
-                iter_e = rbt_iter_begin(_rbt);
+                iter_e = rbt_iter_end(_rbt);
              iter != iter_e;
-             iter = rbt_iter_inc(_iter, iter)) {
-            rb_node_t* nd = rbt_iter_deref(iter);
-            if (nd->value != nd->key + KEY_VAL_DELTA)
+             iter = rbt_iter_inc(_rbt, iter)) {
+            int key = rbt_iter_key(_rbt, iter);
+            if (rbt_iter_value(_rbt, iter) != key + KEY_VAL_DELTA)
                 return false;
         }
 
@@ -370,15 +425,244 @@ unit_test() {
         ut.SearchLessEqu(3, 3, RBS_EXACT);
         ut.SearchGreaterEqu(6, 7, RBS_GREATER);
         ut.SearchGreaterEqu(7, 7, RBS_EXACT);
+        ut.MinMax(1, 8);
+    }
+
+    // test 2. The root has no left kid.
+    {
+        int val[] = { 5, 9 };
+        RB_UNIT_TEST ut(2);
+        ut.BulkInsert(val, ARRAY_SIZE(val));
+        ut.MinMax(5, 9);
+    }
+
+    /////////////////////////////////////////////////////////////////////////
+    //
+    //              Bulk-construction Tests
+    //
+    /////////////////////////////////////////////////////////////////////////
+    //
+    fprintf(stdout, "\n>Testing bulk construction...\n");
+
+    // test 1-7. Various sizes, including 2^k - 1 where the deepest level is
+    // full, and 2^k where it has a single node.
+    {
+        int sizes[] = { 0, 1, 2, 3, 7, 8, 1000 };
+        for (int i = 0; i < (int)ARRAY_SIZE(sizes); i++) {
+            vector<int> keys;
+            for (int k = 0; k < sizes[i]; k++)
+                keys.push_back(k * 3 - 100);
+
+            RB_UNIT_TEST ut(i + 1);
+            ut.BuildSorted(sizes[i] ? &keys[0] : 0, sizes[i]);
+            if (sizes[i])
+                ut.MinMax(keys[0], keys[sizes[i] - 1]);
+        }
+    }
+
+    // test 8. The tree built in bulk remains fully functional.
+    {
+        int keys[] = { 10, 20, 30, 40, 50, 60 };
+        RB_UNIT_TEST ut(8);
+        ut.BuildSorted(keys, ARRAY_SIZE(keys));
+        ut.Insert(35);
+        ut.Insert(5);
+        ut.Delete(40);
+        ut.Delete(10);
+        ut.MinMax(5, 60);
+    }
+
+    // test 9. Reject keys not in strictly ascending order.
+    {
+        int keys[] = { 1, 3, 3, 4 };
+        RB_UNIT_TEST ut(9);
+        ut.BuildSorted(keys, ARRAY_SIZE(keys), 0);
     }
 
     return RB_UNIT_TEST::Get_Fail_Cnt() == 0;
 };
 
+// Key-only trees: values are not stored, and read back as 0.
+static bool
+test_set() {
+    fprintf(stdout, "\n>Testing set...\n");
+    fprintf(stdout, "Testing unit test 1 ...");
+
+    rb_tree_t* rbt = rbt_create_set();
+    bool succ = rbt != 0;
+    for (int i = 0; succ && i < 100; i++)
+        succ = rbt_insert(rbt, i * 7 % 101, i) && rbt_verify(rbt);
+
+    for (int i = 0; succ && i < 100; i += 2)
+        succ = rbt_delete(rbt, i * 7 % 101, 0) && rbt_verify(rbt);
+
+    intptr_t val = 1;
+    int key;
+    succ = succ && rbt_size(rbt) == 50;
+    succ = succ && rbt_search(rbt, 7, &val) == RBS_EXACT && val == 0;
+    succ = succ && rbt_search(rbt, 14, &val) == RBS_FAIL;
+    succ = succ && rbt_search_le(rbt, 14, &key, &val) == RBS_LESS &&
+           key == 12 && val == 0;
+    succ = succ && !rbt_set_value(rbt, 7, 1);
+
+    rbt_destroy(rbt);
+    fprintf(stdout, " %s\n", succ ? "succ" : "fail");
+    return succ;
+}
+
+// Random inserts and deletes checked against std::map. The tree grows to a
+// few thousand keys and shrinks back to empty, so that the nodes of the
+// B+-tree are split and merged at every level.
+static bool
+test_random() {
+    fprintf(stdout, "\n>Testing random operations...\n");
+    fprintf(stdout, "Testing unit test 1 ...");
+
+    rb_tree_t* rbt = rbt_create();
+    map<int, intptr_t> ref;
+    unsigned seed = 34;
+    bool succ = rbt != 0;
+
+    for (int i = 0; succ && i < 40000; i++) {
+        seed = seed * 1103515245 + 12345;
+        int key = (seed >> 8) % 6000;
+        bool grow = (i / 10000) % 2 == 0;
+        bool insert = ((seed >> 4) % 4) != 0 ? grow : !grow;
+
+        if (insert) {
+            int ret = rbt_insert(rbt, key, key * 2);
+            succ = ret == (ref.count(key) ? 0 : 1);
+            ref[key] = key * 2;
+        } else {
+            intptr_t val;
+            int ret = rbt_delete(rbt, key, &val);
+            succ = ret == (int)ref.erase(key) && (!ret || val == key * 2);
+        }
+
+        if (!succ || i % 97 == 0) {
+            succ = succ && rbt_verify(rbt) && rbt_size(rbt) == (int)ref.size();
+
+            // Check the predecessor and successor of a random key.
+            int res_key;
+            intptr_t res_val;
+            map<int, intptr_t>::iterator it = ref.upper_bound(key);
+            RBS_RESULT r = rbt_search_le(rbt, key, &res_key, &res_val);
+            if (it == ref.begin())
+                succ = succ && r == RBS_FAIL;
+            else {
+                --it;
+                succ = succ && r != RBS_FAIL && res_key == it->first &&
+                       res_val == it->second;
+            }
+
+            it = ref.lower_bound(key);
+            r = rbt_search_ge(rbt, key, &res_key, &res_val);
+            if (it == ref.end())
+                succ = succ && r == RBS_FAIL;
+            else
+                succ = succ && r != RBS_FAIL && res_key == it->first;
+        }
+    }
+    succ = succ && rbt_verify(rbt) && rbt_size(rbt) == (int)ref.size();
+
+    rbt_destroy(rbt);
+    fprintf(stdout, " %s\n", succ ? "succ" : "fail");
+    return succ;
+}
+
+static int
+collect_key(int key, intptr_t value, void* arg) {
+    vector<int>* keys = (vector<int>*)arg;
+    keys->push_back(key);
+    return value != -1;
+}
+
+// In-order iteration, rbt_iter_seek() and rbt_range().
+static bool
+test_range() {
+    fprintf(stdout, "\n>Testing in-order iteration and range query...\n");
+    fprintf(stdout, "Testing unit test 1 ...");
+
+    // Keys 0, 3, ..., 597 inserted in scrambled order
+    rb_tree_t* rbt = rbt_create();
+    bool succ = rbt != 0;
+    for (int i = 0; succ && i < 200; i++)
+        succ = rbt_insert(rbt, (i * 71 % 200) * 3, 0);
+
+    int expect = 0;
+    for (rb_iter_t iter = rbt_iter_begin(rbt), iter_e = rbt_iter_end(rbt);
+         succ && iter != iter_e;
+         iter = rbt_iter_inc(rbt, iter)) {
+        succ = rbt_iter_key(rbt, iter) == expect;
+        expect += 3;
+    }
+    succ = succ && expect == 600;
+
+    // Seek to an existing key, to a gap, and past the last key.
+    succ = succ && rbt_iter_key(rbt, rbt_iter_seek(rbt, 300)) == 300;
+    succ = succ && rbt_iter_key(rbt, rbt_iter_seek(rbt, 301)) == 303;
+    succ = succ && rbt_iter_seek(rbt, 598) == rbt_iter_end(rbt);
+
+    // [100, 130) covers 102, 105, ..., 129
+    vector<int> keys;
+    succ = succ && rbt_range(rbt, 100, 130, collect_key, &keys) == 10;
+    succ = succ && keys.size() == 10 && keys[0] == 102 && keys[9] == 129;
+
+    keys.clear();
+    succ = succ && rbt_range(rbt, 600, 1000, collect_key, &keys) == 0;
+    succ = succ && rbt_range(rbt, -5, 1, collect_key, &keys) == 1;
+
+    // The scan stops as soon as the callback returns 0.
+    rbt_set_value(rbt, 9, -1);
+    keys.clear();
+    succ = succ && rbt_range(rbt, 0, 600, collect_key, &keys) == 4;
+
+    rbt_destroy(rbt);
+    fprintf(stdout, " %s\n", succ ? "succ" : "fail");
+    return succ;
+}
+
+static double
+elapsed_ms(const timespec& t0, const timespec& t1) {
+    return (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6;
+}
+
+// Compare building a tree from sorted keys via rbt_insert() against
+// rbt_build_sorted().
+static void
+bench_build_sorted() {
+    const int n = 1 << 17;
+    vector<int> keys(n);
+    for (int i = 0; i < n; i++)
+        keys[i] = i * 2;
+
+    fprintf(stdout, "\n>Benchmarking the construction of %d-node tree...\n",
+            n);
+
+    timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    rb_tree_t* rbt = rbt_create();
+    for (int i = 0; i < n; i++)
+        rbt_insert(rbt, keys[i], 0);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    rbt_destroy(rbt);
+    fprintf(stdout, "  rbt_insert()       : %8.2f ms\n", elapsed_ms(t0, t1));
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    rbt = rbt_create();
+    rbt_build_sorted(rbt, &keys[0], 0, n);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    rbt_destroy(rbt);
+    fprintf(stdout, "  rbt_build_sorted() : %8.2f ms\n", elapsed_ms(t0, t1));
+}
+
 int
 main(int argc, char** argv) {
-    if (!unit_test())
+    if (!unit_test() || !test_set() || !test_random() ||
+        !test_range())
         return 1;
 
+    bench_build_sorted();
+
     return 0;
 }
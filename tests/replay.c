@@ -0,0 +1,512 @@
+/* ljmm-replay: replay a recorded mmap/munmap/mremap trace (see trace.h)
+ * against libljmm and against the kernel, and report for each of them:
+ *
+ *   o. latency percentiles of each kind of operation,
+ *   o. the number of memory-management syscalls it took,
+ *   o. minor page faults, and
+ *   o. peak RSS.
+ *
+ *   Each engine is replayed in a child process of its own, such that the
+ * page-fault and RSS figures of one engine are not polluted by the other.
+ *
+ *   The syscalls are counted by linking the program against libljmm.a with
+ * -Wl,--wrap=mmap etc (see Makefile); every call to these functions, be it
+ * from libljmm or from the kernel engine below, goes through the
+ * __wrap_xxx() defined in this file.
+ *
+ * Usage: ljmm-replay [-e lm|lm-tlsf|kernel|all] [-c cache-pages] [-q len]
+ *                    [-l 0|1] trace-file
+ *   -e: engine(s) to replay against, default "all". "lm-tlsf" is libljmm
+ *       with LM_ENGINE_TLSF, for comparing the tail latencies of the page
+ *       allocators.
+ *   -c: enable libljmm's block cache with the given number of pages.
+ *   -q: the length of libljmm's quick-lists (see ljmm_opt_t), 0 to disable
+ *       them, so that the split/merge churn reported can be compared.
+ *   -l: 0 to split libljmm's buddy blocks eagerly rather than lazily (see
+ *       ljmm_opt_t::lazy_split), likewise.
+ *
+ * The exit status is non-zero if any operation failed on any engine.
+ */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "lj_mm.h"
+#include "trace.h"
+
+/****************************************************************************
+ *
+ *              Syscall accounting
+ *
+ ****************************************************************************
+ */
+typedef enum {
+    SC_MMAP,
+    SC_MUNMAP,
+    SC_MREMAP,
+    SC_MADVISE,
+    SC_MPROTECT,
+    SC_NUM
+} syscall_t;
+
+static const char* syscall_name[SC_NUM] = {
+    "mmap", "munmap", "mremap", "madvise", "mprotect"
+};
+
+static long syscall_cnt[SC_NUM];
+
+void* __real_mmap(void*, size_t, int, int, int, off_t);
+int __real_munmap(void*, size_t);
+void* __real_mremap(void*, size_t, size_t, int, ...);
+int __real_madvise(void*, size_t, int);
+int __real_mprotect(void*, size_t, int);
+
+void*
+__wrap_mmap(void* addr, size_t len, int prot, int flags, int fd, off_t ofst) {
+    syscall_cnt[SC_MMAP]++;
+    return __real_mmap(addr, len, prot, flags, fd, ofst);
+}
+
+int
+__wrap_munmap(void* addr, size_t len) {
+    syscall_cnt[SC_MUNMAP]++;
+    return __real_munmap(addr, len);
+}
+
+void*
+__wrap_mremap(void* old_addr, size_t old_size, size_t new_size, int flags, ...) {
+    /* MREMAP_FIXED is never used, hence no need to forward the 5th arg */
+    syscall_cnt[SC_MREMAP]++;
+    return __real_mremap(old_addr, old_size, new_size, flags);
+}
+
+int
+__wrap_madvise(void* addr, size_t len, int advice) {
+    syscall_cnt[SC_MADVISE]++;
+    return __real_madvise(addr, len, advice);
+}
+
+int
+__wrap_mprotect(void* addr, size_t len, int prot) {
+    syscall_cnt[SC_MPROTECT]++;
+    return __real_mprotect(addr, len, prot);
+}
+
+/****************************************************************************
+ *
+ *              HDR-style latency histogram
+ *
+ ****************************************************************************
+ */
+
+/* Values are bucketed by their most significant bit, and each power-of-two
+ * range is further divided into 2^SUB_BITS linear sub-buckets, giving a
+ * relative error no worse than 1/2^SUB_BITS across the whole range.
+ */
+#define SUB_BITS    4
+#define SUB_NUM     (1 << SUB_BITS)
+#define BUCKET_NUM  ((64 - SUB_BITS + 1) * SUB_NUM)
+
+typedef struct {
+    long count;
+    uint64_t max;
+    uint64_t total;
+    long bucket[BUCKET_NUM];
+} histogram_t;
+
+static inline int
+hist_bucket(uint64_t v) {
+    if (v < SUB_NUM)
+        return v;
+
+    int msb = 63 - __builtin_clzll(v);
+    int shift = msb - SUB_BITS;
+    return ((shift + 1) << SUB_BITS) + ((v >> shift) & (SUB_NUM - 1));
+}
+
+/* The largest value which falls into the given bucket */
+static uint64_t
+hist_bucket_value(int b) {
+    if (b < SUB_NUM)
+        return b;
+
+    int shift = (b >> SUB_BITS) - 1;
+    uint64_t sub = (b & (SUB_NUM - 1)) | SUB_NUM;
+    return ((sub + 1) << shift) - 1;
+}
+
+static inline void
+hist_record(histogram_t* h, uint64_t v) {
+    h->count++;
+    h->total += v;
+    if (v > h->max)
+        h->max = v;
+    h->bucket[hist_bucket(v)]++;
+}
+
+static uint64_t
+hist_percentile(const histogram_t* h, double pct) {
+    long target = (long)(h->count * pct / 100.0 + 0.5);
+    if (target < 1)
+        target = 1;
+
+    long seen = 0;
+    int b;
+    for (b = 0; b < BUCKET_NUM; b++) {
+        seen += h->bucket[b];
+        if (seen >= target) {
+            uint64_t v = hist_bucket_value(b);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+
+/****************************************************************************
+ *
+ *              Engines
+ *
+ ****************************************************************************
+ */
+typedef struct {
+    const char* name;
+    int (*init)(void);
+    void* (*map)(size_t len);
+    int (*unmap)(void* addr, size_t len);
+    void* (*remap)(void* addr, size_t old_len, size_t new_len);
+    void (*report)(void);   /* engine-specific figures, if any */
+} engine_t;
+
+static int blk_cache_pages = 0;
+static int quick_list_len = -1;
+static int lazy_split = -1;
+
+static int
+init_libljmm(ljmm_engine_t kind) {
+    ljmm_opt_t opt;
+    lm_init_mm_opt(&opt);
+    opt.mode = LM_USER_MODE;
+    opt.engine = kind;
+    if (quick_list_len >= 0)
+        opt.quick_list_len = quick_list_len;
+    if (lazy_split >= 0)
+        opt.lazy_split = lazy_split;
+    if (blk_cache_pages > 0) {
+        opt.enable_block_cache = 1;
+        opt.blk_cache_in_page = blk_cache_pages;
+    }
+    return lm_init2(&opt);
+}
+
+static int
+lm_engine_init(void) {
+    return init_libljmm(LM_ENGINE_BUDDY);
+}
+
+static int
+tlsf_engine_init(void) {
+    return init_libljmm(LM_ENGINE_TLSF);
+}
+
+static void*
+lm_engine_map(size_t len) {
+    return lm_mmap(NULL, len, PROT_READ|PROT_WRITE,
+                   MAP_32BIT|MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+}
+
+static void*
+lm_engine_remap(void* addr, size_t old_len, size_t new_len) {
+    return lm_mremap(addr, old_len, new_len, MREMAP_MAYMOVE);
+}
+
+/* The split/merge churn of the buddy allocator */
+static void
+lm_engine_report(void) {
+    const ljmm_buddy_stat_t* st = lm_get_buddy_stat();
+    fprintf(stdout, "buddy: splits=%lu merges=%lu quick-hits=%lu "
+            "quick-flushes=%lu lazy-carves=%lu\n", st->split_num,
+            st->merge_num, st->quick_hit_num, st->quick_flush_num,
+            st->lazy_carve_num);
+}
+
+static int
+kernel_engine_init(void) {
+    return 1;
+}
+
+static void*
+kernel_engine_map(size_t len) {
+    return mmap(NULL, len, PROT_READ|PROT_WRITE,
+                MAP_32BIT|MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+}
+
+static void*
+kernel_engine_remap(void* addr, size_t old_len, size_t new_len) {
+    return mremap(addr, old_len, new_len, MREMAP_MAYMOVE);
+}
+
+static const engine_t engines[] = {
+    { "lm", lm_engine_init, lm_engine_map, lm_munmap, lm_engine_remap,
+      lm_engine_report },
+    { "lm-tlsf", tlsf_engine_init, lm_engine_map, lm_munmap,
+      lm_engine_remap, lm_engine_report },
+    { "kernel", kernel_engine_init, kernel_engine_map, munmap,
+      kernel_engine_remap, NULL },
+};
+
+#define ENGINE_NUM ((int)(sizeof(engines)/sizeof(engines[0])))
+
+/****************************************************************************
+ *
+ *              Replay
+ *
+ ****************************************************************************
+ */
+typedef enum {
+    OP_MMAP,
+    OP_MUNMAP,
+    OP_MREMAP,
+    OP_TOUCH,
+    OP_NUM
+} op_kind_t;
+
+static const char* op_name[OP_NUM] = { "mmap", "munmap", "mremap", "touch" };
+
+typedef struct {
+    char* addr;
+    size_t len;
+} mapping_t;
+
+static inline uint64_t
+now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void
+touch_pages(char* p, size_t len, long page_sz) {
+    char* e = p + len;
+    for (; p < e; p += page_sz)
+        *(volatile char*)p = 1;
+}
+
+static long
+replay(const engine_t* eng, const trace_t* trace, histogram_t* hist) {
+    long page_sz = sysconf(_SC_PAGESIZE);
+    long fail = 0;
+
+    mapping_t* maps = (mapping_t*)calloc(trace->max_id + 1, sizeof(mapping_t));
+
+    int i;
+    for (i = 0; i < trace->rec_num; i++) {
+        const trace_rec_t* rec = trace->recs + i;
+        mapping_t* m = maps + rec->id;
+        uint64_t t0 = now_ns();
+        uint64_t t1;
+
+        switch (rec->op) {
+        case TR_MMAP: {
+            if (m->addr) {
+                fail++;
+                continue;
+            }
+            char* p = (char*)eng->map(rec->len);
+            t1 = now_ns();
+            if (p == MAP_FAILED) {
+                fail++;
+                continue;
+            }
+            m->addr = p;
+            m->len = rec->len;
+            hist_record(hist + OP_MMAP, t1 - t0);
+            break;
+        }
+
+        case TR_MUNMAP: {
+            size_t ofst = rec->ofst;
+            size_t len = rec->len ? rec->len : m->len;
+            /* Only the leading and trailing portions can be unmapped. */
+            if (!m->addr || ofst + len > m->len ||
+                (ofst != 0 && ofst + len != m->len)) {
+                fail++;
+                continue;
+            }
+
+            int ret = eng->unmap(m->addr + ofst, len);
+            t1 = now_ns();
+            if (ret != 0) {
+                fail++;
+                continue;
+            }
+            hist_record(hist + OP_MUNMAP, t1 - t0);
+
+            if (len == m->len) {
+                m->addr = NULL;
+                m->len = 0;
+            } else if (ofst == 0) {
+                /* Keep the mapping page aligned as the engines do */
+                size_t pg_len = len & ~(page_sz - 1);
+                m->addr += pg_len;
+                m->len -= pg_len;
+            } else {
+                m->len = ofst;
+            }
+            break;
+        }
+
+        case TR_MREMAP: {
+            if (!m->addr) {
+                fail++;
+                continue;
+            }
+            char* p = (char*)eng->remap(m->addr, m->len, rec->len);
+            t1 = now_ns();
+            if (p == MAP_FAILED) {
+                fail++;
+                continue;
+            }
+            m->addr = p;
+            m->len = rec->len;
+            hist_record(hist + OP_MREMAP, t1 - t0);
+            break;
+        }
+
+        case TR_TOUCH:
+            if (!m->addr || rec->ofst + rec->len > m->len) {
+                fail++;
+                continue;
+            }
+            touch_pages(m->addr + rec->ofst, rec->len, page_sz);
+            hist_record(hist + OP_TOUCH, now_ns() - t0);
+            break;
+        }
+    }
+
+    free(maps);
+    return fail;
+}
+
+static int
+run_engine(const engine_t* eng, const trace_t* trace) {
+    if (!eng->init()) {
+        fprintf(stderr, "%s: fail to initialize\n", eng->name);
+        return 1;
+    }
+
+    histogram_t hist[OP_NUM];
+    memset(hist, 0, sizeof(hist));
+    memset(syscall_cnt, 0, sizeof(syscall_cnt));
+
+    struct rusage ru_before, ru_after;
+    getrusage(RUSAGE_SELF, &ru_before);
+    uint64_t t0 = now_ns();
+    long fail = replay(eng, trace, hist);
+    uint64_t elapse = now_ns() - t0;
+    getrusage(RUSAGE_SELF, &ru_after);
+
+    fprintf(stdout, "== engine: %s\n", eng->name);
+    fprintf(stdout, "%-8s %9s %9s %9s %9s %9s %9s %9s\n", "op(ns)", "count",
+            "mean", "p50", "p90", "p99", "p99.9", "max");
+
+    int i;
+    for (i = 0; i < OP_NUM; i++) {
+        const histogram_t* h = hist + i;
+        if (!h->count)
+            continue;
+
+        fprintf(stdout, "%-8s %9ld %9lu %9lu %9lu %9lu %9lu %9lu\n",
+                op_name[i], h->count, (unsigned long)(h->total / h->count),
+                (unsigned long)hist_percentile(h, 50),
+                (unsigned long)hist_percentile(h, 90),
+                (unsigned long)hist_percentile(h, 99),
+                (unsigned long)hist_percentile(h, 99.9),
+                (unsigned long)h->max);
+    }
+
+    fprintf(stdout, "syscalls:");
+    for (i = 0; i < SC_NUM; i++)
+        fprintf(stdout, " %s=%ld", syscall_name[i], syscall_cnt[i]);
+    fputs("\n", stdout);
+
+    if (eng->report)
+        eng->report();
+
+    fprintf(stdout, "minor-faults=%ld, peak-rss=%ldKB, elapse=%.3fms, "
+            "failed-ops=%ld\n\n",
+            ru_after.ru_minflt - ru_before.ru_minflt, ru_after.ru_maxrss,
+            elapse / 1e6, fail);
+    fflush(stdout);
+
+    return fail ? 1 : 0;
+}
+
+static void
+usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-e lm|lm-tlsf|kernel|all] [-c cache-pages] "
+            "[-q len] [-l 0|1] trace-file\n", prog);
+}
+
+int
+main(int argc, char** argv) {
+    const char* engine = "all";
+    int opt;
+    while ((opt = getopt(argc, argv, "e:c:q:l:")) != -1) {
+        switch (opt) {
+        case 'e': engine = optarg; break;
+        case 'c': blk_cache_pages = atoi(optarg); break;
+        case 'q': quick_list_len = atoi(optarg); break;
+        case 'l': lazy_split = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind + 1 != argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    trace_t* trace = trace_load(argv[optind]);
+    if (!trace)
+        return 1;
+
+    int fail = 0, run = 0;
+    int i;
+    for (i = 0; i < ENGINE_NUM; i++) {
+        const engine_t* eng = engines + i;
+        if (strcmp(engine, "all") && strcmp(engine, eng->name))
+            continue;
+
+        run++;
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0)
+            _exit(run_engine(eng, trace));
+
+        int status;
+        if (pid < 0 || waitpid(pid, &status, 0) != pid ||
+            !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "engine %s failed\n", eng->name);
+            fail = 1;
+        }
+    }
+
+    trace_free(trace);
+
+    if (!run) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    return fail;
+}
@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include "trace.h"
+
+static int
+parse_num(char** cursor, size_t* res) {
+    char* s = *cursor;
+    while (isspace(*s))
+        s++;
+
+    if (!isdigit(*s))
+        return 0;
+
+    char* end;
+    *res = strtoull(s, &end, 0);
+    *cursor = end;
+    return 1;
+}
+
+static int
+parse_line(char* line, trace_rec_t* rec) {
+    char* s = line;
+    while (isspace(*s))
+        s++;
+
+    rec->op = *s++;
+    rec->ofst = rec->len = 0;
+
+    size_t id;
+    if (!parse_num(&s, &id) || id > 0x7fffffff)
+        return 0;
+    rec->id = (int)id;
+
+    switch (rec->op) {
+    case TR_MMAP:
+    case TR_MREMAP:
+        if (!parse_num(&s, &rec->len) || !rec->len)
+            return 0;
+        break;
+
+    case TR_MUNMAP:
+        /* The offset and length are optional */
+        if (parse_num(&s, &rec->ofst) && !parse_num(&s, &rec->len))
+            return 0;
+        break;
+
+    case TR_TOUCH:
+        if (!parse_num(&s, &rec->ofst) || !parse_num(&s, &rec->len))
+            return 0;
+        break;
+
+    default:
+        return 0;
+    }
+
+    while (isspace(*s))
+        s++;
+
+    return *s == '\0';
+}
+
+trace_t*
+trace_load(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return NULL;
+    }
+
+    trace_t* t = (trace_t*)malloc(sizeof(trace_t));
+    int cap = 1024;
+    t->recs = (trace_rec_t*)malloc(cap * sizeof(trace_rec_t));
+    t->rec_num = 0;
+    t->max_id = -1;
+
+    char line[256];
+    int line_no = 0;
+    while (fgets(line, sizeof(line), f)) {
+        line_no++;
+
+        char* s = line;
+        while (isspace(*s))
+            s++;
+        if (*s == '\0' || *s == '#')
+            continue;
+
+        if (t->rec_num == cap) {
+            cap = cap * 3 / 2;
+            t->recs = (trace_rec_t*)realloc(t->recs, cap * sizeof(trace_rec_t));
+        }
+
+        trace_rec_t* rec = t->recs + t->rec_num;
+        if (!parse_line(s, rec)) {
+            fprintf(stderr, "%s:%d: malformed record: %s", path, line_no, line);
+            fclose(f);
+            trace_free(t);
+            return NULL;
+        }
+
+        if (rec->id > t->max_id)
+            t->max_id = rec->id;
+        t->rec_num++;
+    }
+
+    fclose(f);
+    return t;
+}
+
+void
+trace_free(trace_t* t) {
+    if (t) {
+        free(t->recs);
+        free(t);
+    }
+}
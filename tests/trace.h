@@ -0,0 +1,48 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+/* Recorded mmap/munmap/mremap trace, shared by the trace-driven tools
+ * (ljmm-replay, ...).
+ *
+ * A trace is a text file, one operation per line. Blank lines and lines
+ * starting with '#' are ignored. Each mapping is identified by a small
+ * non-negative integer assigned by the recorder; the id can be reused
+ * once the mapping is completely unmapped.
+ *
+ *   m <id> <len>                mmap <len> bytes
+ *   u <id> [<ofst> <len>]       munmap the whole mapping, or its leading
+ *                               (ofst == 0) or trailing portion.
+ *   r <id> <new_len>            mremap(..., MREMAP_MAYMOVE)
+ *   t <id> <ofst> <len>         the program touched [ofst, ofst+len)
+ *
+ * Numbers are accepted in any base strtoull() understands.
+ */
+#include <stddef.h> /* for size_t */
+
+typedef enum {
+    TR_MMAP   = 'm',
+    TR_MUNMAP = 'u',
+    TR_MREMAP = 'r',
+    TR_TOUCH  = 't',
+} trace_op_t;
+
+typedef struct {
+    char op;        /* one of trace_op_t */
+    int id;         /* the mapping the operation applies to */
+    size_t ofst;    /* munmap/touch: offset into the mapping */
+    size_t len;     /* mmap/mremap: (new) length, munmap/touch: length.
+                     * munmap with len == 0 unmaps the entire mapping.
+                     */
+} trace_rec_t;
+
+typedef struct {
+    trace_rec_t* recs;
+    int rec_num;
+    int max_id;     /* the largest mapping id referenced by the trace */
+} trace_t;
+
+/* Return NULL on failure, with the offending line reported to stderr. */
+trace_t* trace_load(const char* path);
+void trace_free(trace_t*);
+
+#endif /* _TRACE_H_ */
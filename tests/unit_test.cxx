@@ -4,10 +4,12 @@
 #include <sys/mman.h>
 
 #include <stdint.h>
+#include <errno.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
 #include <vector>
+#include <set>
 #include <algorithm>
 #include "lj_mm.h"
 
@@ -45,7 +47,9 @@ private:
 
 class UNIT_TEST {
 public:
-    UNIT_TEST(int test_id, int page_num);
+    UNIT_TEST(int test_id, int page_num,
+              ljmm_placement_t placement = LM_PLACE_DEFAULT,
+              int large_order = -1);
     ~UNIT_TEST();
 
     void VerifyStatus(blk_info2_t* alloc_blk_v, int alloc_blk_v_len,
@@ -90,13 +94,17 @@ MemExt::getStartAddr() const {
     return _ut.getChunkBase() + _ut.getPageSize() * _first_page;
 }
 
-UNIT_TEST::UNIT_TEST(int test_id, int page_num)
+UNIT_TEST::UNIT_TEST(int test_id, int page_num, ljmm_placement_t placement,
+                     int large_order)
     : _test_id(test_id) {
     ljmm_opt_t mm_opt;
 
     lm_init_mm_opt(&mm_opt);
     mm_opt.dbg_alloc_page_num = _page_num = page_num;
     mm_opt.mode = LM_USER_MODE;
+    mm_opt.placement = placement;
+    if (large_order >= 0)
+        mm_opt.large_order = large_order;
 
     _init_succ = lm_init2(&mm_opt);
     _test_succ = _init_succ ? true : false;
@@ -257,6 +265,17 @@ UNIT_TEST::VerifyStatus(blk_info2_t* alloc_blk_v, int alloc_blk_v_len,
         _test_succ = Compare_Blk_Info_Vect(v1, v2);
     }
 
+    // The largest free block is answered by the free-extent index, check
+    // it against the free blocks.
+    if (_test_succ) {
+        size_t largest = 0;
+        for (int i = 0; i < status->free_blk_num; i++) {
+            if ((size_t)status->free_blk_info[i].size > largest)
+                largest = status->free_blk_info[i].size;
+        }
+        _test_succ = (largest == ljmm_largest_free());
+    }
+
     lm_free_status(const_cast<lm_status_t*>(status));
 }
 
@@ -328,6 +347,18 @@ test_page_alloc() {
                         free_blk, ARRAY_SIZE(free_blk));
     }
 
+    // Test3: unmapping the leading page of a 2-page block
+    {
+        UNIT_TEST ut(3, 2);
+        ut.Mmap(MemExt(ut, 1, 123));     // map [page0 - page1:123]
+        ut.Munmap(MemExt(ut, 0, 100, 0));// unmap [page0]
+
+        blk_info2_t alloc_blk[] = { {1, 0, 0, 123} };
+        blk_info2_t free_blk[] = { {0, 0, 1, 0} };
+        ut.VerifyStatus(alloc_blk, ARRAY_SIZE(alloc_blk),
+                        free_blk, ARRAY_SIZE(free_blk));
+    }
+
     fprintf(stdout, "\n>>Remap unit testing\n");
 
     // Test1: remap, expand in place
@@ -383,6 +414,51 @@ test_page_alloc() {
                         free_blk, ARRAY_SIZE(free_blk));
     }
 
+    fprintf(stdout, "\n>>Placement unit testing\n");
+
+    // Test1: two-sided, blocks of 4 pages or more are large.
+    {
+        UNIT_TEST ut(1, 16, LM_PLACE_TWO_SIDED, 2);
+
+        ut.Mmap(MemExt(ut, 4, 0));   // large, carved from the top
+        ut.Mmap(MemExt(ut, 0, 103)); // small, from the bottom
+
+        blk_info2_t alloc_blk[] = { {12, 2, 4, 0}, {8, 0, 0, 103} };
+        blk_info2_t free_blk[] = { {0, 3, 8, 0}, {9, 0, 1, 0}, {10, 1, 2, 0}};
+        ut.VerifyStatus(alloc_blk, ARRAY_SIZE(alloc_blk),
+                        free_blk, ARRAY_SIZE(free_blk));
+    }
+
+    // Test2: next-fit resumes above the previous allocation, even though
+    // there is a free block of the right size below it.
+    {
+        UNIT_TEST ut(2, 16, LM_PLACE_NEXT_FIT);
+
+        ut.Mmap(MemExt(ut, 0, 103));        // blk1 at page0
+        ut.Mmap(MemExt(ut, 0, 103));        // blk2 at page1
+        ut.Munmap(MemExt(ut, 0, 103, 0));   // unmap blk1
+        ut.Mmap(MemExt(ut, 0, 104));        // blk3 at page2
+
+        blk_info2_t alloc_blk[] = { {1, 0, 0, 103}, {2, 0, 0, 104} };
+        blk_info2_t free_blk[] = { {0, 0, 1, 0}, {3, 0, 1, 0}, {4, 2, 4, 0},
+                                   {8, 3, 8, 0}};
+        ut.VerifyStatus(alloc_blk, ARRAY_SIZE(alloc_blk),
+                        free_blk, ARRAY_SIZE(free_blk));
+    }
+
+    // Test3: top-down carves from the top of the highest block big enough.
+    {
+        UNIT_TEST ut(3, 16, LM_PLACE_TOP_DOWN);
+
+        ut.Mmap(MemExt(ut, 0, 103));    // page 15
+        ut.Mmap(MemExt(ut, 2, 0));      // pages 12-13
+
+        blk_info2_t alloc_blk[] = { {12, 1, 2, 0}, {15, 0, 0, 103} };
+        blk_info2_t free_blk[] = { {0, 3, 8, 0}, {8, 2, 4, 0}, {14, 0, 1, 0}};
+        ut.VerifyStatus(alloc_blk, ARRAY_SIZE(alloc_blk),
+                        free_blk, ARRAY_SIZE(free_blk));
+    }
+
     return fail_num == 0;
 }
 
@@ -415,10 +491,19 @@ alloc_1M_blocks (int blk_num, vector<void*>& result) {
     return alloc_blocks(blk_num, result, ONE_M);
 }
 
+// The page allocator test_mode() runs against
+static ljmm_engine_t test_engine = LM_ENGINE_BUDDY;
+
+static void
+init_mm_opt(ljmm_opt_t* mm_opt) {
+    lm_init_mm_opt(mm_opt);
+    mm_opt->engine = test_engine;
+}
+
 static bool
 init_ljmm(ljmm_mode_t mode) {
     ljmm_opt_t mm_opt;
-    lm_init_mm_opt(&mm_opt);
+    init_mm_opt(&mm_opt);
     mm_opt.mode = mode;
 
     if (!lm_init2(&mm_opt)) {
@@ -513,6 +598,57 @@ test_hybrid_mode1() {
     return !fail;
 }
 
+//  In adaptive mode, lm_mmap() turns to mmap(2) once the chunk is mostly
+//  taken, and turns back as it is freed.
+//
+static bool
+test_adaptive_mode1() {
+    fprintf(stderr, "Adaptive mode testing 1... ");
+
+    if (!init_ljmm(LM_ADAPTIVE))
+        return false;
+
+    const ljmm_mode_stat_t* stat = lm_get_mode_stat();
+    bool fail = stat->prefer_sys != 0;
+
+    vector<void*> blks;
+    if (!alloc_1M_blocks(1000, blks))
+        fail = true;
+
+    if (stat->switch_num == 0 || stat->sys_map_num == 0 ||
+        stat->sys_map_bytes != stat->sys_map_num * ONE_M) {
+        fprintf(stderr, "no switching to mmap(2) (%lu switches, %lu maps)\n",
+                stat->switch_num, stat->sys_map_num);
+        fail = true;
+    }
+
+    for (size_t i = 0; i < blks.size(); i++) {
+        if (lm_munmap(blks[i], ONE_M) != 0) {
+            fprintf(stderr, "fail to de-allocate no.%d block", (int)i);
+            fail = true;
+        }
+    }
+    if (stat->sys_map_num != 0 || stat->sys_map_bytes != 0) {
+        fprintf(stderr, "mmap(2) mappings are not untracked\n");
+        fail = true;
+    }
+
+    // Back to the user-mode allocator, i.e. to the chunk below 1G
+    void* p = lm_mmap(NULL, ONE_M, PROT_READ|PROT_WRITE,
+                      MAP_32BIT|MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED || uintptr_t(p) >= ONE_G || stat->prefer_sys) {
+        fprintf(stderr, "no switching back to user mode\n");
+        fail = true;
+    }
+    if (p != MAP_FAILED)
+        lm_munmap(p, ONE_M);
+
+    lm_fini();
+
+    fprintf(stderr, "%s\n", fail ? "fail" : "succ");
+    return !fail;
+}
+
 static bool
 test_user_mode1() {
     fprintf(stderr, "User mode testing 1... ");
@@ -552,11 +688,876 @@ test_user_mode1() {
     return !fail;
 }
 
+/* With a second window in [2G, 4G), the LM_MAP_4G blocks should come from
+ * above 2G, while the MAP_32BIT blocks stay below it.
+ */
+static bool
+test_window1() {
+    fprintf(stderr, "Address window testing 1... ");
+
+    ljmm_opt_t mm_opt;
+    init_mm_opt(&mm_opt);
+    mm_opt.mode = LM_USER_MODE;
+    mm_opt.window_num = 2;
+    mm_opt.windows[0].start = 0;
+    mm_opt.windows[0].end = 2UL * ONE_G;
+    mm_opt.windows[1].start = 2UL * ONE_G;
+    mm_opt.windows[1].end = 4UL * ONE_G;
+
+    if (!lm_init2(&mm_opt)) {
+        fprintf(stderr, "fail to call lm_init2()\n");
+        return false;
+    }
+
+    bool fail = false;
+    for (int i = 0; i < 16; i++) {
+        bool high = i & 1;
+        int flags = (high ? LM_MAP_4G : MAP_32BIT) | MAP_PRIVATE |
+                    MAP_ANONYMOUS;
+        void* p = lm_mmap(NULL, ONE_M, PROT_READ|PROT_WRITE, flags, -1, 0);
+        if (p == MAP_FAILED) {
+            fprintf(stderr, "fail to allocate no.%d block\n", i);
+            fail = true;
+            break;
+        }
+
+        uintptr_t addr = uintptr_t(p);
+        if (high != (addr >= 2UL * ONE_G) || addr + ONE_M > 4UL * ONE_G) {
+            fprintf(stderr, "no.%d block (%p) is in the wrong window\n",
+                    i, p);
+            fail = true;
+        }
+
+        *(int*)p = i;
+        if (lm_munmap(p, ONE_M) != 0) {
+            fprintf(stderr, "fail to de-allocate no.%d block\n", i);
+            fail = true;
+        }
+    }
+
+    lm_fini();
+
+    fprintf(stderr, "%s\n", fail ? "fail" : "succ");
+    return !fail;
+}
+
+/* Windows more than 4G apart cannot be indexed: lm_init2() should fail
+ * without leaving any chunk behind, so that a later call can succeed.
+ */
+static bool
+test_window2() {
+    fprintf(stderr, "Address window testing 2... ");
+
+    ljmm_opt_t mm_opt;
+    init_mm_opt(&mm_opt);
+    mm_opt.mode = LM_USER_MODE;
+    mm_opt.window_num = 2;
+    mm_opt.windows[0].start = ONE_G;
+    mm_opt.windows[0].end = ONE_G + 64 * ONE_M;
+    mm_opt.windows[1].start = 5UL * ONE_G;
+    mm_opt.windows[1].end = 5UL * ONE_G + 64 * ONE_M;
+
+    bool fail = false;
+    if (lm_init2(&mm_opt)) {
+        fprintf(stderr, "windows spanning 5G are taken\n");
+        lm_fini();
+        fail = true;
+    }
+
+    mm_opt.window_num = 1;
+    if (!lm_init2(&mm_opt)) {
+        fprintf(stderr, "fail to call lm_init2() afterwards\n");
+        return false;
+    }
+
+    void* p = lm_mmap(NULL, ONE_M, PROT_READ|PROT_WRITE,
+                      MAP_32BIT|MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED || uintptr_t(p) < ONE_G ||
+        uintptr_t(p) + ONE_M > ONE_G + 64 * ONE_M) {
+        fprintf(stderr, "block %p is not in the window\n", p);
+        fail = true;
+    }
+    if (p != MAP_FAILED)
+        lm_munmap(p, ONE_M);
+
+    lm_fini();
+
+    fprintf(stderr, "%s\n", fail ? "fail" : "succ");
+    return !fail;
+}
+
+/* Harvesting the holes below 2G should find at least as much room as the
+ * single chunk does, and no block should go beyond 2G.
+ */
+static bool
+test_harvest1() {
+    fprintf(stderr, "Hole harvesting testing 1... ");
+
+    ljmm_opt_t mm_opt;
+    init_mm_opt(&mm_opt);
+    mm_opt.mode = LM_USER_MODE;
+    mm_opt.harvest_holes = 1;
+
+    if (!lm_init2(&mm_opt)) {
+        fprintf(stderr, "fail to call lm_init2()\n");
+        return false;
+    }
+
+    vector<void*> blks;
+    while (1) {
+        void* p = lm_mmap(NULL, ONE_M, PROT_READ|PROT_WRITE,
+                          MAP_32BIT|MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            break;
+        blks.push_back(p);
+    }
+
+    bool fail = blks.size() < 1024;
+    if (fail)
+        fprintf(stderr, "only %d blocks are allocated\n", (int)blks.size());
+
+    for (size_t i = 0; i < blks.size(); i++) {
+        void* p = blks[i];
+        if (uintptr_t(p) + ONE_M > 2UL * ONE_G) {
+            fail = true;
+            fprintf(stderr, "no.%d block (%p) is beyond 2G\n", (int)i, p);
+        }
+
+        if (lm_munmap(p, ONE_M) != 0) {
+            fail = true;
+            fprintf(stderr, "fail to de-allocate no.%d block\n", (int)i);
+        }
+    }
+
+    lm_fini();
+
+    fprintf(stderr, "%s\n", fail ? "fail" : "succ");
+    return !fail;
+}
+
+/* With a brk gap, the heap should still be able to grow right after the
+ * program break, while the top-down allocation stays clear of it.
+ */
+static bool
+test_brk_gap1() {
+    fprintf(stderr, "Brk gap testing 1... ");
+
+    ljmm_opt_t mm_opt;
+    init_mm_opt(&mm_opt);
+    mm_opt.mode = LM_USER_MODE;
+    mm_opt.placement = LM_PLACE_TOP_DOWN;
+    mm_opt.brk_gap = 64 * ONE_M;
+
+    if (!lm_init2(&mm_opt)) {
+        fprintf(stderr, "fail to call lm_init2()\n");
+        return false;
+    }
+
+    bool fail = false;
+    char* cur_brk = (char*)sbrk(0);
+    void* p = lm_mmap(NULL, ONE_M, PROT_READ|PROT_WRITE,
+                      MAP_32BIT|MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED || (char*)p < cur_brk + 64 * ONE_M) {
+        fprintf(stderr, "block (%p) is in the brk gap\n", p);
+        fail = true;
+    }
+
+    char* heap = (char*)sbrk(ONE_M);
+    if (heap == (char*)-1) {
+        fprintf(stderr, "fail to grow the heap\n");
+        fail = true;
+    } else {
+        heap[ONE_M - 1] = 1;
+        sbrk(-ONE_M);
+    }
+
+    if (p != MAP_FAILED && lm_munmap(p, ONE_M) != 0)
+        fail = true;
+
+    lm_fini();
+
+    fprintf(stderr, "%s\n", fail ? "fail" : "succ");
+    return !fail;
+}
+
+/* With commit-on-allocate, the blocks should be accessible once allocated,
+ * including those recommitted after the block cache purged them.
+ */
+static bool
+test_reserve1() {
+    fprintf(stderr, "Reserve-only testing 1... ");
+
+    ljmm_opt_t mm_opt;
+    init_mm_opt(&mm_opt);
+    mm_opt.mode = LM_USER_MODE;
+    mm_opt.reserve_only = 1;
+    mm_opt.enable_block_cache = 1;
+    mm_opt.blk_cache_in_page = 256;
+
+    if (!lm_init2(&mm_opt)) {
+        fprintf(stderr, "fail to call lm_init2()\n");
+        return false;
+    }
+
+    bool fail = false;
+    for (int round = 0; round < 2 && !fail; round++) {
+        vector<void*> blks;
+        fail = !alloc_1M_blocks(64, blks);
+
+        for (size_t i = 0; i < blks.size(); i++) {
+            char* p = (char*)blks[i];
+            p[0] = p[ONE_M - 1] = 1;
+            if (lm_munmap(p, ONE_M) != 0) {
+                fail = true;
+                fprintf(stderr, "fail to de-allocate no.%d block\n", (int)i);
+            }
+        }
+    }
+
+    lm_fini();
+
+    fprintf(stderr, "%s\n", fail ? "fail" : "succ");
+    return !fail;
+}
+
+/* Return VmLck of /proc/self/status in kB */
+static long
+get_locked_kb() {
+    FILE* f = fopen("/proc/self/status", "r");
+    if (!f)
+        return -1;
+
+    char line[256];
+    long kb = -1;
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "VmLck:", 6) == 0)
+            kb = atol(line + 6);
+    }
+    fclose(f);
+    return kb;
+}
+
+/* MAP_POPULATE and MAP_LOCKED blocks should be resident right away, and the
+ * locked pages should be unlocked as they are unmapped, in part or in whole.
+ */
+static bool
+test_populate1() {
+    fprintf(stderr, "Populate and lock testing 1... ");
+
+    if (!init_ljmm(LM_USER_MODE))
+        return false;
+
+    bool fail = false;
+    int page_sz = sysconf(_SC_PAGESIZE);
+    size_t len = 16 * page_sz;
+    unsigned char vec[16];
+
+    void* p = lm_mmap(NULL, len, PROT_READ|PROT_WRITE,
+                      MAP_32BIT|MAP_PRIVATE|MAP_ANONYMOUS|MAP_POPULATE, -1, 0);
+    if (p == MAP_FAILED || mincore(p, len, vec) != 0) {
+        fail = true;
+    } else {
+        for (int i = 0; i < 16; i++) {
+            if (!(vec[i] & 1)) {
+                fprintf(stderr, "page %d is not populated\n", i);
+                fail = true;
+            }
+        }
+        lm_munmap(p, len);
+    }
+
+    long locked_kb = get_locked_kb();
+    p = lm_mmap(NULL, len, PROT_READ|PROT_WRITE,
+                MAP_32BIT|MAP_PRIVATE|MAP_ANONYMOUS|MAP_LOCKED, -1, 0);
+    if (p == MAP_FAILED) {
+        fail = true;
+    } else {
+        /* mlock() may be denied by RLIMIT_MEMLOCK, which is no failure. */
+        long kb = get_locked_kb();
+        bool locked = kb > locked_kb;
+
+        lm_munmap((char*)p + len / 2, len / 2);
+        if (locked && get_locked_kb() != kb - long(len / 2 / 1024)) {
+            fprintf(stderr, "the upper half is still locked\n");
+            fail = true;
+        }
+
+        lm_munmap(p, len / 2);
+        if (locked && get_locked_kb() != locked_kb) {
+            fprintf(stderr, "the lower half is still locked\n");
+            fail = true;
+        }
+    }
+
+    lm_fini();
+
+    fprintf(stderr, "%s\n", fail ? "fail" : "succ");
+    return !fail;
+}
+
+/* A fresh block should be reported as zero, and a reused one as not, while
+ * lm_calloc() should clear the latter.
+ */
+static bool
+test_calloc1() {
+    fprintf(stderr, "Known-zero testing 1... ");
+
+    if (!init_ljmm(LM_USER_MODE))
+        return false;
+
+    bool fail = false;
+    int zeroed = -1;
+    char* p = (char*)lm_mmap_ex(NULL, ONE_M, PROT_READ|PROT_WRITE,
+                                MAP_32BIT|MAP_PRIVATE|MAP_ANONYMOUS, -1, 0,
+                                &zeroed);
+    if (p == MAP_FAILED || zeroed != 1) {
+        fprintf(stderr, "fresh block is not known to be zero\n");
+        fail = true;
+    }
+
+    if (p != MAP_FAILED) {
+        memset(p, 0xff, ONE_M);
+        lm_munmap(p, ONE_M);
+
+        char* q = (char*)lm_mmap_ex(NULL, ONE_M, PROT_READ|PROT_WRITE,
+                                    MAP_32BIT|MAP_PRIVATE|MAP_ANONYMOUS,
+                                    -1, 0, &zeroed);
+        if (q != p || zeroed != 0) {
+            fprintf(stderr, "reused block is taken as zero\n");
+            fail = true;
+        }
+        if (q != MAP_FAILED)
+            lm_munmap(q, ONE_M);
+
+        char* r = (char*)lm_calloc(ONE_M);
+        for (int i = 0; r && i < ONE_M; i++) {
+            if (r[i]) {
+                fprintf(stderr, "lm_calloc() returns non-zero byte\n");
+                fail = true;
+                break;
+            }
+        }
+        if (!r || !lm_free(r))
+            fail = true;
+    }
+
+    lm_fini();
+
+    fprintf(stderr, "%s\n", fail ? "fail" : "succ");
+    return !fail;
+}
+
+static bool
+test_aligned1() {
+    fprintf(stderr, "Aligned mapping testing 1... ");
+
+    if (!init_ljmm(LM_USER_MODE))
+        return false;
+
+    bool fail = false;
+    const int flags = MAP_32BIT|MAP_PRIVATE|MAP_ANONYMOUS;
+    const size_t align = 2 * ONE_M;
+    const int page_sz = sysconf(_SC_PAGESIZE);
+
+    // Leave the lowest blocks misaligned to the 2M boundaries
+    char* small = (char*)lm_mmap(NULL, page_sz, PROT_READ|PROT_WRITE,
+                                 flags, -1, 0);
+    char* p = (char*)lm_mmap_aligned(64 * 1024, align, flags);
+    char* q = (char*)lm_mmap_aligned(64 * 1024, align, flags);
+    if (small == MAP_FAILED || p == MAP_FAILED || q == MAP_FAILED ||
+        p == q || ((uintptr_t)p & (align - 1)) ||
+        ((uintptr_t)q & (align - 1))) {
+        fprintf(stderr, "misaligned or failed allocation\n");
+        fail = true;
+    }
+
+    // The blocks take just what is asked for; there is no padding.
+    const lm_status_t* status = lm_get_status();
+    for (int i = 0; !fail && i < status->alloc_blk_num; i++) {
+        block_info_t* blk = status->alloc_blk_info + i;
+        char* addr = status->first_page + (size_t)blk->page_idx * page_sz;
+        if ((addr == p || addr == q) && (page_sz << blk->order) != 64 * 1024) {
+            fprintf(stderr, "aligned block is padded\n");
+            fail = true;
+        }
+    }
+    lm_free_status(const_cast<lm_status_t*>(status));
+
+    if (!fail) {
+        memset(p, 0x5a, 64 * 1024);
+        if (lm_munmap(p, 64 * 1024) || lm_munmap(q, 64 * 1024))
+            fail = true;
+    }
+
+    // The alignment must be a power of 2.
+    errno = 0;
+    if (lm_mmap_aligned(page_sz, 3 * page_sz, flags) != MAP_FAILED ||
+        errno != EINVAL) {
+        fprintf(stderr, "bad alignment is accepted\n");
+        fail = true;
+    }
+
+    if (small != MAP_FAILED)
+        lm_munmap(small, page_sz);
+
+    lm_fini();
+
+    fprintf(stderr, "%s\n", fail ? "fail" : "succ");
+    return !fail;
+}
+
+struct pressure_info {
+    int low;
+    int fail;
+    vector<void*> blks;     // freed on LM_PRESSURE_FAIL
+};
+
+static void
+on_pressure(ljmm_pressure_t level, size_t, void* ud) {
+    pressure_info* pi = (pressure_info*)ud;
+    if (level == LM_PRESSURE_LOW) {
+        pi->low++;
+        return;
+    }
+
+    pi->fail++;
+    for (size_t i = 0; i < pi->blks.size(); i++)
+        lm_free(pi->blks[i]);
+    pi->blks.clear();
+}
+
+static bool
+test_pressure1() {
+    fprintf(stderr, "Pressure callback testing 1... ");
+
+    if (!init_ljmm(LM_USER_MODE))
+        return false;
+
+    pressure_info pi;
+    pi.low = pi.fail = 0;
+    lm_set_pressure_callback(on_pressure, &pi, 64 * ONE_M);
+
+    // Take the largest free block until there is none.
+    size_t sz;
+    while ((sz = lm_largest_free()) != 0) {
+        void* p = lm_malloc(sz);
+        if (!p)
+            break;
+        pi.blks.push_back(p);
+    }
+
+    bool fail = false;
+    if (pi.low != 1 || pi.fail != 0) {
+        fprintf(stderr, "low pressure is reported %d times\n", pi.low);
+        fail = true;
+    }
+
+    // The callback frees all the blocks, and the allocation is retried.
+    void* p = lm_malloc(ONE_M);
+    if (!p || pi.fail != 1 || !pi.blks.empty()) {
+        fprintf(stderr, "allocation is not retried after the callback\n");
+        fail = true;
+    }
+    if (p)
+        lm_free(p);
+
+    lm_set_pressure_callback(NULL, NULL, 0);
+    for (size_t i = 0; i < pi.blks.size(); i++)
+        lm_free(pi.blks[i]);
+    lm_fini();
+
+    fprintf(stderr, "%s\n", fail ? "fail" : "succ");
+    return !fail;
+}
+
+static bool
+test_extent1() {
+    fprintf(stderr, "Extent allocator testing 1... ");
+
+    ljmm_opt_t mm_opt;
+    init_mm_opt(&mm_opt);
+    mm_opt.mode = LM_USER_MODE;
+    mm_opt.extent_order = 8;
+    if (!lm_init2(&mm_opt)) {
+        fprintf(stderr, "fail to call lm_init2()\n");
+        return false;
+    }
+
+    const int prot = PROT_READ|PROT_WRITE;
+    const int flags = MAP_32BIT|MAP_PRIVATE|MAP_ANONYMOUS;
+    const size_t page_sz = sysconf(_SC_PAGESIZE);
+    const size_t odd_sz = 3 * ONE_M + page_sz;
+    bool fail = false;
+
+    // Extents take the exact number of pages, first-fit.
+    char* a = (char*)lm_mmap(NULL, odd_sz, prot, flags, -1, 0);
+    char* b = (char*)lm_mmap(NULL, 5 * ONE_M, prot, flags, -1, 0);
+    if (a == MAP_FAILED || b != a + odd_sz) {
+        fprintf(stderr, "extents are not packed (%p, %p)\n", a, b);
+        lm_fini();
+        return false;
+    }
+
+    memset(a, 0xff, odd_sz);
+    lm_munmap(a, odd_sz);
+    char* c = (char*)lm_calloc(2 * ONE_M);
+    char* d = (char*)lm_mmap(NULL, ONE_M + page_sz, prot, flags, -1, 0);
+    if (c != a || d != a + 2 * ONE_M || c[0] || c[2 * ONE_M - 1]) {
+        fprintf(stderr, "freed extent is not reused, or not zapped\n");
+        fail = true;
+    }
+
+    // Grow in place into the free pages behind
+    if (lm_mremap(b, 5 * ONE_M, 6 * ONE_M, 0) != b) {
+        fprintf(stderr, "extent is not grown in place\n");
+        fail = true;
+    }
+
+    // The free neighbors coalesce.
+    lm_munmap(d, ONE_M + page_sz);
+    lm_free(c);
+    lm_munmap(b, 6 * ONE_M);
+    char* e = (char*)lm_mmap(NULL, 16 * ONE_M, prot, flags, -1, 0);
+    if (e != a) {
+        fprintf(stderr, "free extents are not coalesced\n");
+        fail = true;
+    }
+
+    // Unmap the middle part, and reuse it
+    if (lm_munmap(e + 4 * ONE_M, 4 * ONE_M) != 0 ||
+        lm_mmap(NULL, 4 * ONE_M, prot, flags, -1, 0) != e + 4 * ONE_M) {
+        fprintf(stderr, "middle part is not unmapped\n");
+        fail = true;
+    }
+    for (int i = 0; i < 4; i++) {
+        if (lm_munmap(e + i * 4 * ONE_M, 4 * ONE_M) != 0)
+            fail = true;
+    }
+
+    lm_fini();
+
+    fprintf(stderr, "%s\n", fail ? "fail" : "succ");
+    return !fail;
+}
+
+// A block freed is held in the quick-list of its order, and reused as it is
+// by the next request of the order, until a bigger request needs it merged.
+static bool
+test_quick_list1() {
+    fprintf(stderr, "Quick-list testing 1... ");
+
+    if (!init_ljmm(LM_USER_MODE))
+        return false;
+
+    const ljmm_buddy_stat_t* stat = lm_get_buddy_stat();
+    const int prot = PROT_READ|PROT_WRITE;
+    const int flags = MAP_32BIT|MAP_PRIVATE|MAP_ANONYMOUS;
+    const size_t sz = 64 * 1024;
+    bool fail = false;
+
+    void* p = lm_mmap(NULL, sz, prot, flags, -1, 0);
+    unsigned long split_num = stat->split_num;
+    unsigned long merge_num = stat->merge_num;
+    for (int i = 0; i < 100 && !fail; i++) {
+        lm_munmap(p, sz);
+        if (lm_mmap(NULL, sz, prot, flags, -1, 0) != p)
+            fail = true;
+    }
+    if (fail || stat->split_num != split_num ||
+        stat->merge_num != merge_num || stat->quick_hit_num != 100) {
+        fprintf(stderr, "freed block is not reused as it is\n");
+        fail = true;
+    }
+
+    // Take all the space, then free two buddies. They are merged only as
+    // a request of the next order would fail otherwise.
+    lm_munmap(p, sz);
+    set<uintptr_t> blks;
+    while ((p = lm_mmap(NULL, sz, prot, flags, -1, 0)) != MAP_FAILED)
+        blks.insert(uintptr_t(p));
+
+    uintptr_t pair = 0;
+    for (set<uintptr_t>::iterator iter = blks.begin(), iter_e = blks.end();
+         iter != iter_e && !pair; ++iter) {
+        if (!(*iter & (2 * sz - 1)) && blks.count(*iter + sz))
+            pair = *iter;
+    }
+    if (pair) {
+        blks.erase(pair);
+        blks.erase(pair + sz);
+        lm_munmap((void*)pair, sz);
+        lm_munmap((void*)(pair + sz), sz);
+    }
+
+    // The status reports them as they are, with nothing merged.
+    const lm_status_t* status = lm_get_status();
+    int found = 0;
+    for (int i = 0; i < status->free_blk_num; i++) {
+        const block_info_t& b = status->free_blk_info[i];
+        uintptr_t addr = uintptr_t(status->first_page) +
+                         uintptr_t(b.page_idx) * sysconf(_SC_PAGESIZE);
+        if ((addr == pair || addr == pair + sz) && (size_t)b.size == sz)
+            found++;
+    }
+    lm_free_status(const_cast<lm_status_t*>(status));
+    if (found != 2 || stat->quick_flush_num != 0) {
+        fprintf(stderr, "status merges the quick-lists\n");
+        fail = true;
+    }
+
+    void* q = lm_mmap(NULL, 2 * sz, prot, flags, -1, 0);
+    if (q != (void*)pair || stat->quick_flush_num != 1) {
+        fprintf(stderr, "quick-list is not merged on demand\n");
+        fail = true;
+    }
+
+    for (set<uintptr_t>::iterator iter = blks.begin(), iter_e = blks.end();
+         iter != iter_e; ++iter) {
+        lm_munmap((void*)*iter, sz);
+    }
+    if (q != MAP_FAILED)
+        lm_munmap(q, 2 * sz);
+
+    lm_fini();
+
+    fprintf(stderr, "%s\n", fail ? "fail" : "succ");
+    return !fail;
+}
+
+// A block taken for a smaller request is split lazily: the requests of the
+// same order that follow are carved from the rest of it, with no split at
+// all, and the blocks freed right below the rest rejoin it.
+static bool
+test_lazy_split1() {
+    fprintf(stderr, "Lazy splitting testing 1... ");
+
+    ljmm_opt_t mm_opt;
+    init_mm_opt(&mm_opt);
+    mm_opt.mode = LM_USER_MODE;
+    mm_opt.quick_list_len = 0;
+    if (!lm_init2(&mm_opt)) {
+        fprintf(stderr, "fail to call lm_init2()\n");
+        return false;
+    }
+
+    const ljmm_buddy_stat_t* stat = lm_get_buddy_stat();
+    const int prot = PROT_READ|PROT_WRITE;
+    const int flags = MAP_32BIT|MAP_PRIVATE|MAP_ANONYMOUS;
+    const size_t sz = 64 * 1024;
+    bool fail = false;
+
+    size_t largest = lm_largest_free();
+    vector<void*> blks;
+    for (int i = 0; i < 64; i++) {
+        void* p = lm_mmap(NULL, sz, prot, flags, -1, 0);
+        if (p == MAP_FAILED)
+            break;
+        blks.push_back(p);
+    }
+    if (blks.size() != 64 || stat->split_num != 0 ||
+        stat->lazy_carve_num < 32) {
+        fprintf(stderr, "blocks are split eagerly\n");
+        fail = true;
+    }
+
+    for (vector<void*>::reverse_iterator iter = blks.rbegin(),
+         iter_e = blks.rend(); iter != iter_e; ++iter) {
+        lm_munmap(*iter, sz);
+    }
+    if (stat->split_num != 0 || lm_largest_free() != largest) {
+        fprintf(stderr, "freed blocks do not rejoin the rest\n");
+        fail = true;
+    }
+
+    lm_fini();
+
+    fprintf(stderr, "%s\n", fail ? "fail" : "succ");
+    return !fail;
+}
+
+// A block grows in place into its free buddy, even if the buddy is yet to
+// split off the rest of a block split lazily, or is held in a quick-list.
+static bool
+test_grow_in_place1() {
+    fprintf(stderr, "Growing in place testing 1... ");
+
+    if (!init_ljmm(LM_USER_MODE))
+        return false;
+
+    const ljmm_buddy_stat_t* stat = lm_get_buddy_stat();
+    const int prot = PROT_READ|PROT_WRITE;
+    const int flags = MAP_32BIT|MAP_PRIVATE|MAP_ANONYMOUS;
+    const size_t page_sz = sysconf(_SC_PAGESIZE);
+    bool fail = false;
+
+    // Take pages until one is carved with its buddy right after it.
+    vector<void*> blks;
+    void* p = MAP_FAILED;
+    for (int i = 0; i < 64 && p == MAP_FAILED; i++) {
+        unsigned long carve_num = stat->lazy_carve_num;
+        void* q = lm_mmap(NULL, page_sz, prot, flags, -1, 0);
+        if (q == MAP_FAILED)
+            break;
+
+        blks.push_back(q);
+        if (stat->lazy_carve_num != carve_num &&
+            !(uintptr_t(q) & (2 * page_sz - 1))) {
+            p = q;
+        }
+    }
+    if (p == MAP_FAILED || lm_mremap(p, page_sz, 2 * page_sz, 0) != p) {
+        fprintf(stderr, "fail to grow into the frontier\n");
+        fail = true;
+    }
+
+    for (vector<void*>::iterator iter = blks.begin(), iter_e = blks.end();
+         iter != iter_e; ++iter) {
+        lm_munmap(*iter, *iter == p && !fail ? 2 * page_sz : page_sz);
+    }
+
+    // Take pages until two are buddies, then free the upper one.
+    set<uintptr_t> pages;
+    uintptr_t a = 0;
+    for (int i = 0; i < 64 && !a; i++) {
+        void* q = lm_mmap(NULL, page_sz, prot, flags, -1, 0);
+        if (q == MAP_FAILED)
+            break;
+
+        uintptr_t pg = uintptr_t(q);
+        pages.insert(pg);
+        if (!(pg & (2 * page_sz - 1)) && pages.count(pg + page_sz))
+            a = pg;
+        else if ((pg & (2 * page_sz - 1)) && pages.count(pg - page_sz))
+            a = pg - page_sz;
+    }
+    if (a) {
+        pages.erase(a + page_sz);
+        lm_munmap((void*)(a + page_sz), page_sz);
+    }
+
+    if (!a || lm_mremap((void*)a, page_sz, 2 * page_sz, 0) != (void*)a) {
+        fprintf(stderr, "fail to grow into a quick-list\n");
+        fail = true;
+        a = 0;
+    }
+
+    for (set<uintptr_t>::iterator iter = pages.begin(),
+         iter_e = pages.end(); iter != iter_e; ++iter) {
+        lm_munmap((void*)*iter, *iter == a ? 2 * page_sz : page_sz);
+    }
+
+    lm_fini();
+
+    fprintf(stderr, "%s\n", fail ? "fail" : "succ");
+    return !fail;
+}
+
+// The frontier is kept while the requests go to the other side of 2G, and
+// carved from again as they come back.
+static bool
+test_lazy_split2() {
+    fprintf(stderr, "Lazy splitting testing 2... ");
+
+    ljmm_opt_t mm_opt;
+    init_mm_opt(&mm_opt);
+    mm_opt.mode = LM_USER_MODE;
+    mm_opt.quick_list_len = 0;
+    mm_opt.window_num = 2;
+    mm_opt.windows[0].start = ONE_G;
+    mm_opt.windows[0].end = ONE_G + 64 * ONE_M;
+    mm_opt.windows[1].start = 3UL * ONE_G;
+    mm_opt.windows[1].end = 3UL * ONE_G + 64 * ONE_M;
+    if (!lm_init2(&mm_opt)) {
+        fprintf(stderr, "fail to call lm_init2()\n");
+        return false;
+    }
+
+    const ljmm_buddy_stat_t* stat = lm_get_buddy_stat();
+    const size_t page_sz = sysconf(_SC_PAGESIZE);
+    bool fail = false;
+
+    vector<void*> blks;
+    for (int i = 0; i < 32 && !fail; i++) {
+        bool high = i & 1;
+        int flags = (high ? LM_MAP_4G : MAP_32BIT) | MAP_PRIVATE |
+                    MAP_ANONYMOUS;
+        void* p = lm_mmap(NULL, page_sz, PROT_READ|PROT_WRITE, flags, -1, 0);
+        if (p == MAP_FAILED || high != (uintptr_t(p) >= 2UL * ONE_G)) {
+            fprintf(stderr, "no.%d block (%p) is in the wrong window\n",
+                    i, p);
+            fail = true;
+            break;
+        }
+        blks.push_back(p);
+    }
+
+    // All the requests below 2G but the first are carved.
+    if (!fail && stat->lazy_carve_num < 15) {
+        fprintf(stderr, "frontier is flushed (%lu carved)\n",
+                stat->lazy_carve_num);
+        fail = true;
+    }
+
+    for (size_t i = 0; i < blks.size(); i++)
+        lm_munmap(blks[i], page_sz);
+    lm_fini();
+
+    fprintf(stderr, "%s\n", fail ? "fail" : "succ");
+    return !fail;
+}
+
+// An aligned request sees the free blocks the frontier stands for.
+static bool
+test_lazy_split3() {
+    fprintf(stderr, "Lazy splitting testing 3... ");
+
+    ljmm_opt_t mm_opt;
+    init_mm_opt(&mm_opt);
+    mm_opt.mode = LM_USER_MODE;
+    mm_opt.window_num = 1;
+    mm_opt.windows[0].start = ONE_G;
+    mm_opt.windows[0].end = ONE_G + 64 * ONE_M;
+    if (!lm_init2(&mm_opt)) {
+        fprintf(stderr, "fail to call lm_init2()\n");
+        return false;
+    }
+
+    const size_t align = 2 * ONE_M;
+    bool fail = false;
+
+    void* small = lm_malloc(sysconf(_SC_PAGESIZE));
+    void* p = lm_mmap_aligned(8192, align, MAP_32BIT);
+    if (!small || p == MAP_FAILED || (uintptr_t(p) & (align - 1))) {
+        fprintf(stderr, "aligned request fails after a lazy split\n");
+        fail = true;
+    }
+
+    if (p != MAP_FAILED)
+        lm_munmap(p, 8192);
+    if (small)
+        lm_free(small);
+    lm_fini();
+
+    fprintf(stderr, "%s\n", fail ? "fail" : "succ");
+    return !fail;
+}
+
 static bool
 test_mode() {
     return test_sys_mode1() &&
            test_hybrid_mode1() &&
-           test_user_mode1();
+           test_adaptive_mode1() &&
+           test_user_mode1() &&
+           test_window1() &&
+           test_window2() &&
+           test_harvest1() &&
+           test_brk_gap1() &&
+           test_reserve1() &&
+           test_populate1() &&
+           test_calloc1() &&
+           test_aligned1() &&
+           test_pressure1() &&
+           test_extent1();
 }
 
 // Test if we still work properly if the lm_init*() is not explictly called.
@@ -587,7 +1588,18 @@ int
 main(int argc, char** argv) {
     bool result = test_page_alloc() &&
                   test_lazy_init() &&
-                  test_mode();
+                  test_mode() &&
+                  test_quick_list1() &&
+                  test_lazy_split1() &&
+                  test_grow_in_place1() &&
+                  test_lazy_split2() &&
+                  test_lazy_split3();
+
+    if (result) {
+        fprintf(stderr, "\nWith the TLSF engine:\n");
+        test_engine = LM_ENGINE_TLSF;
+        result = test_mode();
+    }
 
     return result ? 0 : 1;
 }
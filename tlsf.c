@@ -0,0 +1,301 @@
+/* The TLSF index of the extent allocator, see tlsf.h for the big picture.
+ *
+ *  The free extents are divided into size classes in two levels: the first
+ * level is the power of two of the number of pages, and each power-of-two
+ * range is further divided into SL_NUM linear classes. The extents below
+ * SL_NUM pages take one class per size. e.g. with SL_NUM 16, the extents of
+ * 256 to 271 pages share a class, as do those of 272 to 287 pages.
+ *
+ *  Each class is a doubly-linked list; fl_map has a bit set for each first
+ * level that has any non-empty class, and sl_map[] likewise for the classes
+ * of each first level, so that the first non-empty class at or above a
+ * given one is found with a couple of bit scans.
+ *
+ *  A request is rounded up to the next class boundary before the search,
+ * so that any extent in the classes found is big enough ("good fit"); the
+ * head of the request's own class is checked first, though, as it may well
+ * fit. Only if both fail are the classes in between walked extent by
+ * extent; this is the one step that is not bounded, and it is taken only
+ * when the allocation would otherwise fail.
+ *
+ *  The free pages may be zapped, or even inaccessible with reserve_only, so
+ * the links cannot live in them as in the textbook TLSF. Instead, there is
+ * a tag per page of the region: the tag of the first page of a free extent
+ * has its length and its links, and the tag of the last page the first
+ * page, so that the free extent right before any page is found in O(1) as
+ * well.
+ */
+#include <sys/mman.h>
+#include <stdlib.h>
+#include "util.h"
+#include "page_alloc.h"
+#include "tlsf.h"
+
+#define SL_LOG2     4
+#define SL_NUM      (1 << SL_LOG2)
+
+/* An extent takes up to 1 << MAX_ORDER pages */
+#define FL_NUM      (MAX_ORDER - SL_LOG2 + 2)
+#define CLASS_NUM   (FL_NUM * SL_NUM)
+
+typedef struct {
+    int len;            /* At the first page: the pages of the free extent,
+                         * 0 if the page is not the first one of any */
+    page_idx_t first;   /* At the last page: the first page */
+    page_idx_t prev;    /* At the first page: the links in the class, -1 at
+                         * the ends */
+    page_idx_t next;
+} tlsf_tag_t;
+
+typedef struct {
+    page_idx_t start;   /* tags[0] is the tag of this page */
+    page_idx_t end;
+    unsigned int fl_map;
+    unsigned int sl_map[FL_NUM];
+    page_idx_t heads[CLASS_NUM];
+    tlsf_tag_t* tags;
+} tlsf_t;
+
+static tlsf_t* tlsf;
+
+static inline tlsf_tag_t*
+tag_of(page_idx_t page) {
+    return tlsf->tags + (page - tlsf->start);
+}
+
+/* Return the class of the extents of <len> pages */
+static inline int
+class_of(int len) {
+    if (len < SL_NUM)
+        return len;
+
+    int log2 = 31 - __builtin_clz(len);
+    int fl = log2 - SL_LOG2 + 1;
+    int sl = (len >> (log2 - SL_LOG2)) - SL_NUM;
+    return fl * SL_NUM + sl;
+}
+
+/* Return the lowest class whose extents are all no smaller than <len> */
+static inline int
+class_above(int len) {
+    if (len >= SL_NUM) {
+        int log2 = 31 - __builtin_clz(len);
+        len += (1 << (log2 - SL_LOG2)) - 1;
+    }
+    return class_of(len);
+}
+
+/* Return the first non-empty class at or above <cls>, or -1 if there is
+ * none.
+ */
+static int
+first_class_ge(int cls) {
+    if (cls >= CLASS_NUM)
+        return -1;
+
+    int fl = cls >> SL_LOG2;
+    unsigned int map = tlsf->sl_map[fl] & (~0u << (cls & (SL_NUM - 1)));
+    if (!map) {
+        unsigned int fl_map = fl + 1 < FL_NUM ?
+                              tlsf->fl_map & (~0u << (fl + 1)) : 0;
+        if (!fl_map)
+            return -1;
+
+        fl = __builtin_ctz(fl_map);
+        map = tlsf->sl_map[fl];
+    }
+
+    return (fl << SL_LOG2) + __builtin_ctz(map);
+}
+
+static int
+tlsf_init(void) {
+    tlsf = (tlsf_t*)MYMALLOC(sizeof(tlsf_t));
+    if (!tlsf)
+        return 0;
+
+    page_idx_t start = extent_info->start;
+    page_idx_t end = extent_info->end;
+    tlsf->tags = (tlsf_tag_t*)MYMALLOC((end - start + 1) * sizeof(tlsf_tag_t));
+    if (!tlsf->tags) {
+        MYFREE(tlsf);
+        tlsf = NULL;
+        return 0;
+    }
+
+    tlsf->start = start;
+    tlsf->end = end;
+    tlsf->fl_map = 0;
+
+    /* Set all the tags now rather than having them faulted in on the
+     * allocation path.
+     */
+    int i;
+    for (i = 0; i <= end - start; i++) {
+        tlsf_tag_t* tag = tlsf->tags + i;
+        tag->len = 0;
+        tag->first = tag->prev = tag->next = -1;
+    }
+
+    for (i = 0; i < FL_NUM; i++)
+        tlsf->sl_map[i] = 0;
+    for (i = 0; i < CLASS_NUM; i++)
+        tlsf->heads[i] = -1;
+
+    return 1;
+}
+
+static void
+tlsf_fini(void) {
+    if (tlsf) {
+        MYFREE(tlsf->tags);
+        MYFREE(tlsf);
+        tlsf = NULL;
+    }
+}
+
+static void
+tlsf_insert(page_idx_t ext, int len) {
+    int cls = class_of(len);
+    page_idx_t head = tlsf->heads[cls];
+
+    tlsf_tag_t* tag = tag_of(ext);
+    tag->len = len;
+    tag->prev = -1;
+    tag->next = head;
+    tag_of(ext + len - 1)->first = ext;
+
+    if (head >= 0)
+        tag_of(head)->prev = ext;
+    tlsf->heads[cls] = ext;
+
+    tlsf->sl_map[cls >> SL_LOG2] |= 1u << (cls & (SL_NUM - 1));
+    tlsf->fl_map |= 1u << (cls >> SL_LOG2);
+}
+
+static void
+tlsf_remove(page_idx_t ext, int len) {
+    int cls = class_of(len);
+    tlsf_tag_t* tag = tag_of(ext);
+    ASSERT(tag->len == len);
+
+    if (tag->prev >= 0)
+        tag_of(tag->prev)->next = tag->next;
+    else
+        tlsf->heads[cls] = tag->next;
+    if (tag->next >= 0)
+        tag_of(tag->next)->prev = tag->prev;
+    tag->len = 0;
+
+    if (tlsf->heads[cls] < 0) {
+        int fl = cls >> SL_LOG2;
+        tlsf->sl_map[fl] &= ~(1u << (cls & (SL_NUM - 1)));
+        if (!tlsf->sl_map[fl])
+            tlsf->fl_map &= ~(1u << fl);
+    }
+}
+
+static int
+tlsf_len_at(page_idx_t page) {
+    if (page < tlsf->start || page >= tlsf->end)
+        return 0;
+    return tag_of(page)->len;
+}
+
+static page_idx_t
+tlsf_ending_at(page_idx_t end) {
+    if (end <= tlsf->start || end > tlsf->end)
+        return -1;
+
+    /* The tag of the last page is stale unless the first page agrees. */
+    page_idx_t first = tag_of(end - 1)->first;
+    if (first < tlsf->start || first >= end ||
+        tag_of(first)->len != end - first) {
+        return -1;
+    }
+    return first;
+}
+
+static inline int
+fits(page_idx_t ext, int pages, int align_order) {
+    return ext_align_up(ext, align_order) + pages <= ext + tag_of(ext)->len;
+}
+
+static page_idx_t
+tlsf_find(int pages, int align_order, int* len) {
+    if (pages > (1 << MAX_ORDER) || align_order > MAX_ORDER)
+        return -1;
+
+    /* The head of the request's own class */
+    int cls = class_of(pages);
+    page_idx_t ext = tlsf->heads[cls];
+    if (ext < 0 || !fits(ext, pages, align_order)) {
+        /* Any extent in these classes fits, wherever it is aligned. */
+        int need = pages + (1 << align_order) - 1;
+        int above = class_above(need);
+        int c = first_class_ge(above);
+        ext = c >= 0 ? tlsf->heads[c] : -1;
+
+        /* The last resort: walk the classes which may or may not fit. */
+        for (c = first_class_ge(cls); ext < 0 && c >= 0 && c < above;
+             c = first_class_ge(c + 1)) {
+            for (ext = tlsf->heads[c]; ext >= 0; ext = tag_of(ext)->next) {
+                if (fits(ext, pages, align_order))
+                    break;
+            }
+        }
+    }
+
+    if (ext >= 0)
+        *len = tag_of(ext)->len;
+    return ext;
+}
+
+/* The extents of the top class are within 1/16 of each other, so any of
+ * them, i.e. the head, stands for the largest one; finding which is the
+ * largest would take walking the class.
+ */
+static int
+tlsf_largest(void) {
+    if (!tlsf->fl_map)
+        return 0;
+
+    int fl = 31 - __builtin_clz(tlsf->fl_map);
+    int sl = 31 - __builtin_clz(tlsf->sl_map[fl]);
+    return tag_of(tlsf->heads[(fl << SL_LOG2) + sl])->len;
+}
+
+const lm_ext_index_t ext_tlsf = {
+    "tlsf", tlsf_init, tlsf_fini, tlsf_insert, tlsf_remove, tlsf_len_at,
+    tlsf_ending_at, tlsf_find, tlsf_largest
+};
+
+#ifdef DEBUG
+int
+tlsf_verify(void) {
+    int cls, free_page_num = 0;
+    for (cls = 0; cls < CLASS_NUM; cls++) {
+        int fl = cls >> SL_LOG2;
+        int bit = (tlsf->sl_map[fl] >> (cls & (SL_NUM - 1))) & 1;
+        if (bit != (tlsf->heads[cls] >= 0) ||
+            (bit && !(tlsf->fl_map & (1u << fl)))) {
+            return 0;
+        }
+
+        /* The extents are in the right class, and tagged at both ends. */
+        page_idx_t prev = -1, ext;
+        for (ext = tlsf->heads[cls]; ext >= 0; ext = tag_of(ext)->next) {
+            tlsf_tag_t* tag = tag_of(ext);
+            if (tag->prev != prev || tag->len <= 0 ||
+                class_of(tag->len) != cls ||
+                tag_of(ext + tag->len - 1)->first != ext) {
+                return 0;
+            }
+            free_page_num += tag->len;
+            prev = ext;
+        }
+    }
+
+    return free_page_num == extent_info->free_page_num;
+}
+#endif
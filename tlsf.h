@@ -0,0 +1,19 @@
+#ifndef _TLSF_H_
+#define _TLSF_H_
+
+/* The Two-Level Segregated Fit index of the extent allocator, used by
+ * LM_ENGINE_TLSF. The free extents are kept in doubly-linked lists, one per
+ * size class, and a two-level bitmap tells which lists are non-empty, so
+ * that both finding a free extent big enough and coalescing with the
+ * neighbors take constant time, no matter how many free extents there are.
+ * See tlsf.c for details.
+ */
+#include "extent.h"
+
+extern const lm_ext_index_t ext_tlsf;
+
+#ifdef DEBUG
+int tlsf_verify(void);
+#endif
+
+#endif /* _TLSF_H_ */